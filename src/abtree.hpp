@@ -3,29 +3,124 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <cstdint>
 #include <queue>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+#include <atomic>
+#include "allocator.hpp"
 #include "vertex.hpp"
+#include "merge_iterator.hpp"
 #include "iterator.hpp"
+#include "parallel.hpp"
+
+/**
+ * The (a, b) parameters of a tree that are known at compile time.
+ * The conditions on the parameters are checked by the compiler.
+ */
+template <size_t A, size_t B>
+struct abtree_params
+{
+	static_assert(A >= 2, "a has to be at least 2");
+	static_assert(B >= (2 * A) - 1, "b has to be at least (2 * a) - 1");
+	
+	static const size_t a = A;
+	static const size_t b = B;
+};
+
+template <size_t A, size_t B>
+const size_t abtree_params<A, B>::a;
+
+template <size_t A, size_t B>
+const size_t abtree_params<A, B>::b;
+
+/**
+ * The (a, b) parameters of a tree that are specified at runtime
+ */
+template <>
+struct abtree_params<0, 0>
+{
+	const size_t a, b;
+	
+	/**
+	 * @param a The minimum number of children for all non-root vertices (has to be at least 2)
+	 * @param b The maximum number of children for all vertices (has to be at least (2 * a) - 1)
+	 * @throws std::invalid_argument if a and b don't meet (a, b)-tree conditions
+	 */
+	abtree_params (size_t a, size_t b): a(a), b(b)
+	{
+		if (a < 2 || b < (2 * a) - 1) {
+			throw std::invalid_argument(a < 2 ? "a" : "b");
+		}
+	}
+};
 
 /**
  * A generic associative container that uses (a, b)-trees to store data.
  * The keys are always stored in order and grouped with associated values using std::pair
+ * @tparam A, B The (a, b) parameters of the tree if they should be fixed at compile time.
+ * If both of them are 0 (the default), the parameters are passed to the constructor instead.
+ * @tparam Allocator A std::allocator-compatible allocator. It's rebound to allocate whole vertices
+ * in blocks of abtree_cache_line objects (see abtree_pool_allocator for an allocator suited for this).
+ * @tparam Aggregate A monoid whose value is cached for every subtree, so that it can be computed
+ * over any range of keys in O(log n) (see aggregate.hpp and reduce()). By default, nothing is cached.
+ * With an aggregate, values can't be changed behind the back of the tree: iterators are const iterators,
+ * at() returns const references and operator[] is disabled. Values are changed by insert_or_assign()
+ * or in place by update().
  */
-template <typename TKey, typename TVal>
-class abtree {
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >,
+	typename Aggregate = abtree_no_aggregate
+>
+class abtree: private abtree_params<A, B> {
+	typedef abtree_vertex<TKey, TVal, B, Aggregate> vertex;
+	typedef abtree_params<A, B> params;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<abtree_cache_line> block_allocator;
+	
 public:
-	typedef abtree_iterator<TKey, TVal> iterator;
-	typedef abtree_iterator<TKey, TVal const> const_iterator;
+	/**
+	 * Whether an aggregate is maintained, in which case values can only be changed through the tree
+	 */
+	static const bool has_aggregate = !std::is_same<Aggregate, abtree_no_aggregate>::value;
+	
+	typedef abtree_iterator<vertex, typename std::conditional<has_aggregate, TVal const, TVal>::type> iterator;
+	typedef abtree_iterator<vertex, TVal const> const_iterator;
 	typedef TKey key_type;
 	typedef TVal mapped_type;
 	typedef std::pair<const key_type, mapped_type> value_type;
+	typedef Allocator allocator_type;
+	typedef typename Aggregate::value_type aggregate_type;
 	
 private:
-	typedef abtree_vertex<TKey, TVal> vertex;
+	using params::a;
+	using params::b;
 	
 	vertex * root;
-	const size_t a, b;
 	size_t size_;
+	block_allocator alloc_;
+	
+	/**
+	 * Allocate a new vertex using the allocator of the tree
+	 * @param leaf whether the vertex is a leaf
+	 */
+	vertex * create_vertex (bool leaf)
+	{
+		return vertex::create(alloc_, b, leaf);
+	}
+	
+	/**
+	 * Destroy a vertex and return its memory to the allocator of the tree
+	 */
+	void destroy_vertex (vertex * v)
+	{
+		vertex::destroy(alloc_, v, b);
+	}
 	
 	/**
 	 * Split vertex pointed to by cursor in half. The middle key of this vertex gets
@@ -33,62 +128,80 @@ private:
 	 * If the root vertex is reached this way, a new root is created and the tree's depth is 
 	 * increased by one.
 	 * @param cursor the vertex to be split
-	 * @return the newly created vertex
+	 * @param item the position of an item in cursor that should be followed.
+	 * It's updated to the position of the item in the returned vertex.
+	 * @return the vertex that holds the followed item after the split
 	 */
-	vertex * split_vertex (vertex * cursor)
+	vertex * split_vertex (vertex * cursor, size_t & item)
 	{
 		size_t middle = (b / 2);
-		vertex * new_vertex = new vertex(b);
-		auto median = cursor->items[middle];
-		cursor->items[middle] = nullptr;
-		cursor->item_count--;
+		vertex * new_vertex = create_vertex(cursor->leaf);
 		
 		for (size_t i = middle + 1; i < b; i++) {
-			new_vertex->items[i - (middle + 1)] = cursor->items[i];
+			cursor->move_item(i, new_vertex, i - (middle + 1));
 			new_vertex->item_count++;
-			cursor->items[i] = nullptr;
 			cursor->item_count--;
 		}
-		for (size_t i = middle + 1; i < b + 1; i++) {
-			if (cursor->children[i] != nullptr) {
-				new_vertex->children[i - (middle + 1)] = cursor->children[i];
-				cursor->children[i]->parent = new_vertex;
+		if (!cursor->leaf) {
+			for (size_t i = middle + 1; i < b + 1; i++) {
+				new_vertex->set_child(i - (middle + 1), cursor->children[i]);
+				cursor->children[i] = nullptr;
 			}
-			cursor->children[i] = nullptr;
+		}
+		
+		// The median stays in place until it's moved to the parent
+		cursor->item_count--;
+		cursor->update_subtree();
+		new_vertex->update_subtree();
+		
+		vertex * holder = cursor;
+		if (item > middle) {
+			holder = new_vertex;
+			item -= middle + 1;
 		}
 		
 		if (cursor == root) {
-			root = new vertex(b);
-			root->children[0] = cursor;
-			root->items[0] = median;
-			root->children[1] = new_vertex;
+			root = create_vertex(false);
+			root->set_child(0, cursor);
+			cursor->move_item(middle, root, 0);
+			root->set_child(1, new_vertex);
 			root->item_count++;
-			cursor->parent = root;
-			new_vertex->parent = root;
-			return new_vertex;
+			root->update_subtree();
+			if (item == middle && holder == cursor) {
+				holder = root;
+				item = 0;
+			}
+			return holder;
 		}
 		
 		auto parent = cursor->parent;
 		
-		size_t pos = parent->search(median->first);
+		size_t pos = cursor->index;
 		for (size_t i = parent->item_count; i > pos; i--) {
-			parent->items[i] = parent->items[i - 1];
+			parent->move_item(i - 1, parent, i);
 		}
 		for (size_t i = parent->item_count + 1; i > pos + 1; i--) {
-			parent->children[i] = parent->children[i - 1];
+			parent->set_child(i, parent->children[i - 1]);
 		}
 		
-		parent->items[pos] = median;
-		parent->children[pos + 1] = new_vertex;
+		cursor->move_item(middle, parent, pos);
+		parent->set_child(pos + 1, new_vertex);
 		parent->item_count++;
 		
-		new_vertex->parent = parent;
+		if (item == middle && holder == cursor) {
+			holder = parent;
+			item = pos;
+		}
 		
 		if (parent->item_count == b) {
-			split_vertex(parent);
+			if (holder == parent) {
+				return split_vertex(parent, item);
+			}
+			size_t median = 0;
+			split_vertex(parent, median);
 		}
 		
-		return new_vertex;
+		return holder;
 	}
 	
 	/**
@@ -98,55 +211,59 @@ private:
 	 * or merging the vertex with its neighbour.
 	 * @param parent The parent of the vertex to be refilled
 	 * @param i The position of the vertex in the parent's children
+	 * @return The vertex that holds the items of the refilled vertex afterwards
+	 * (the vertex itself or its left neighbour if they got merged)
 	 */
-	void refill_vertex (vertex * parent, size_t i)
+	vertex * refill_vertex (vertex * parent, size_t i)
 	{
 		auto cursor = parent->children[i];
 		if (i > 0) {
 			auto neighbour = cursor->parent->children[i - 1];
 			if (neighbour->item_count >= a) {
 				for (size_t j = cursor->item_count; j > 0; j--) {
-					cursor->items[j] = cursor->items[j - 1];
+					cursor->move_item(j - 1, cursor, j);
 				}
-				for (size_t j = cursor->item_count + 1; j > 0; j--) {
-					cursor->children[j] = cursor->children[j - 1];
-				}
-				cursor->items[0] = cursor->parent->items[i - 1];
-				cursor->children[0] = neighbour->children[neighbour->item_count];
-				if (cursor->children[0] != nullptr) {
-					cursor->children[0]->parent = cursor;
+				cursor->parent->move_item(i - 1, cursor, 0);
+				if (!cursor->leaf) {
+					for (size_t j = cursor->item_count + 1; j > 0; j--) {
+						cursor->set_child(j, cursor->children[j - 1]);
+					}
+					cursor->set_child(0, neighbour->children[neighbour->item_count]);
+					neighbour->children[neighbour->item_count] = nullptr;
 				}
 				cursor->item_count++;
-				cursor->parent->items[i - 1] = neighbour->items[neighbour->item_count - 1];
-				neighbour->items[neighbour->item_count - 1] = nullptr;
-				neighbour->children[neighbour->item_count] = nullptr;
+				neighbour->move_item(neighbour->item_count - 1, cursor->parent, i - 1);
 				neighbour->item_count--;
+				cursor->update_subtree();
+				neighbour->update_subtree();
 			} else {
 				merge_vertices(neighbour, cursor, i - 1);
+				return neighbour;
 			}
 		} else {
 			auto neighbour = cursor->parent->children[1];
 			if (neighbour->item_count >= a) {
-				cursor->items[cursor->item_count] = cursor->parent->items[0];
-				cursor->children[cursor->item_count + 1] = neighbour->children[0];
-				if (neighbour->children[0] != nullptr) {
-					neighbour->children[0]->parent = cursor;
+				cursor->parent->move_item(0, cursor, cursor->item_count);
+				if (!cursor->leaf) {
+					cursor->set_child(cursor->item_count + 1, neighbour->children[0]);
+					for (size_t j = 0; j < neighbour->item_count; j++) {
+						neighbour->set_child(j, neighbour->children[j + 1]);
+					}
+					neighbour->children[neighbour->item_count] = nullptr;
 				}
 				cursor->item_count++;
-				cursor->parent->items[0] = neighbour->items[0];
+				neighbour->move_item(0, cursor->parent, 0);
 				for (size_t j = 0; j < neighbour->item_count - 1; j++) {
-					neighbour->items[j] = neighbour->items[j + 1];
-				}
-				for (size_t j = 0; j < neighbour->item_count; j++) {
-					neighbour->children[j] = neighbour->children[j + 1];
+					neighbour->move_item(j + 1, neighbour, j);
 				}
-				neighbour->items[neighbour->item_count - 1] = nullptr;
-				neighbour->children[neighbour->item_count] = nullptr;
 				neighbour->item_count--;
+				cursor->update_subtree();
+				neighbour->update_subtree();
 			} else {
 				merge_vertices(cursor, neighbour, 0);
 			}
 		}
+		return cursor;
 	}
 	
 	/**
@@ -161,390 +278,2376 @@ private:
 	 */
 	void merge_vertices (vertex * left, vertex * right, size_t key_pos)
 	{
-		size_t pos;
-		if (left->parent != root) {
-			pos = left->parent->parent->search(left->parent->items[key_pos]->first);
-		}
+		size_t pos = left->parent->index;
 		
-		left->items[left->item_count] = right->parent->items[key_pos];
+		right->parent->move_item(key_pos, left, left->item_count);
 		left->item_count++;
-		for (size_t j = 0; j < right->item_count; j++) {
-			left->items[left->item_count] = right->items[j];
-			left->children[left->item_count] = right->children[j];
-			if (right->children[j] != nullptr) {
-				right->children[j]->parent = left;
+		if (!left->leaf) {
+			for (size_t j = 0; j <= right->item_count; j++) {
+				left->set_child(left->item_count + j, right->children[j]);
 			}
-			left->item_count++;
 		}
-		left->children[left->item_count] = right->children[right->item_count];
-		if (left->children[left->item_count] != nullptr) {
-			left->children[left->item_count]->parent = left;
+		for (size_t j = 0; j < right->item_count; j++) {
+			right->move_item(j, left, left->item_count);
+			left->item_count++;
 		}
+		right->item_count = 0;
+		left->update_subtree();
 		
 		for (size_t j = key_pos + 1; j < left->parent->item_count; j++) {
-			left->parent->items[j - 1] = left->parent->items[j];
-			left->parent->children[j] = left->parent->children[j + 1];
+			left->parent->move_item(j, left->parent, j - 1);
+			left->parent->set_child(j, left->parent->children[j + 1]);
 		}
+		left->parent->children[left->parent->item_count] = nullptr;
 		left->parent->item_count--;
 		
 		if (left->parent != root && left->parent->item_count < a - 1) {
 			refill_vertex(left->parent->parent, pos);
 		} else if (left->parent == root && left->parent->item_count == 0) {
 			root = left;
-			delete left->parent;
+			destroy_vertex(left->parent);
 			left->parent = nullptr;
+			left->index = 0;
 		}
-		delete right;
+		destroy_vertex(right);
 	}
 	
 	/**
-	 * A function template for the begin() and cbegin() methods
+	 * Destroy all the vertices of the tree (using BFS), leaving the root pointer dangling
 	 */
-	template <typename iterator>
-	iterator do_begin () const
+	void destroy_tree ()
 	{
-		auto cursor = root;
-		while (cursor->children[0] != nullptr) {
-			cursor = cursor->children[0];
+		std::queue<vertex *> queue;
+		queue.push(root);
+		
+		while (queue.size() > 0) {
+			vertex * cursor = queue.front();
+			if (!cursor->leaf) {
+				for (size_t i = 0; i <= cursor->item_count; i++) {
+					queue.push(cursor->children[i]);
+				}
+			}
+			destroy_vertex(cursor);
+			queue.pop();
 		}
-		return iterator(cursor, 0);
 	}
 	
 	/**
-	 * A function template for the end() and cend() methods
+	 * Compute base raised to exp, saturating at the maximum value of size_t
 	 */
-	template <typename iterator>
-	iterator do_end () const
+	static size_t bounded_pow (size_t base, size_t exp)
 	{
-		return iterator(root, root->item_count);
+		size_t result = 1;
+		for (size_t i = 0; i < exp; i++) {
+			if (result > SIZE_MAX / base) {
+				return SIZE_MAX;
+			}
+			result *= base;
+		}
+		return result;
 	}
 	
 	/**
-	 * A function template for the find() method (this method can return an iterator or a const_iterator)
+	 * The number of children of a vertex built by build_subtree() (see there)
+	 * @param slots the number of slots of the subtree of the vertex
+	 * @param height the height of the vertex (at least 1)
+	 * @param fill the desired number of items in a vertex
+	 * @param is_root whether the vertex is the root of the tree
 	 */
-	template <typename iterator>
-	iterator do_find (const TKey & key) const
+	size_t build_children (size_t slots, size_t height, size_t fill, bool is_root) const
 	{
-		vertex * cursor = root;
-		size_t i = cursor->search(key);
+		size_t min_child_slots = bounded_pow(a, height);
+		size_t max_child_slots = bounded_pow(b, height);
+		size_t fill_child_slots = bounded_pow(fill + 1, height);
 		
-		while (true) {
-			if (i < cursor->item_count && cursor->items[i]->first == key) {
-				return iterator(cursor, i);
-			}
-			if (cursor->children[i] == nullptr) {
-				return do_end<iterator>();
-			}
-			cursor = cursor->children[i];
-			i = cursor->search(key);
-		}
+		size_t children = slots / fill_child_slots + (slots % fill_child_slots != 0);
+		children = std::max(children, slots / max_child_slots + (slots % max_child_slots != 0));
+		children = std::max(children, is_root ? size_t(2) : size_t(a));
+		return std::min(children, std::min(size_t(b), slots / min_child_slots));
 	}
 	
 	/**
-	 * A function template for the lower_bound() method (this method can return an iterator or a const_iterator)
+	 * The height of a tree built from count items by build()
 	 */
-	template <typename iterator>
-	iterator do_lower_bound (const key_type & key) const
+	size_t build_height (size_t count, size_t fill) const
 	{
-		auto cursor = root;
-		size_t i = cursor->search(key);
-		std::pair<vertex *, size_t> back = std::make_pair(root, root->item_count);
-		
-		while (cursor->children[0] != nullptr) {
-			if (i < cursor->item_count) {
-				if (cursor->items[i]->first == key) {
-					return iterator(cursor, i);
-				}
-				back = std::make_pair(cursor, i);
-			}
-			cursor = cursor->children[i];
-			i = cursor->search(key);
+		size_t slots = count + 1;
+		size_t height = 0;
+		while (bounded_pow(fill + 1, height + 1) < slots) {
+			height++;
 		}
-		
-		if (i == cursor->item_count) {
-			cursor = back.first;
-			i = back.second;
+		while (height > 0 && slots / 2 < bounded_pow(a, height)) {
+			height--;
 		}
-		
-		return iterator(cursor, i);
+		return height;
 	}
 	
 	/**
-	 * A function template for the upper_bound() method (this method can return an iterator or a const_iterator)
+	 * Build a subtree of given height from the next count items of a sorted sequence.
+	 * A subtree with m items has m + 1 "slots" (the gaps between its items), and the slots of a vertex
+	 * are divided evenly among its children. The number of children is chosen so that the vertices get
+	 * close to fill items while every subtree has enough slots for the (a, b)-tree conditions to hold.
+	 * @param it the iterator pointing to the next item, it's advanced past the consumed items
+	 * @param count the number of items in the subtree
+	 * @param height the height of the subtree (0 for a leaf)
+	 * @param fill the desired number of items in a vertex
+	 * @param is_root whether the subtree is the whole tree (the root only needs 2 children)
+	 * @return the root of the new subtree
 	 */
-	template <typename iterator>
-	iterator do_upper_bound (const key_type & key) const
+	template <typename Iterator>
+	vertex * build_subtree (Iterator & it, size_t count, size_t height, size_t fill, bool is_root)
 	{
-		auto cursor = root;
-		size_t i = cursor->search(key);
-		std::pair<vertex *, size_t> back = std::make_pair(root, root->item_count);
+		vertex * cursor = create_vertex(height == 0);
 		
-		while (cursor->children[0] != nullptr) {
-			if (i < cursor->item_count) {
-				if (cursor->items[i]->first == key) {
-					cursor = cursor->children[i + 1];
-					while (cursor->children[0] != nullptr) {
-						cursor = cursor->children[0];
-					}
-					return iterator(cursor, 0);
-				}
-				back = std::make_pair(cursor, i);
+		if (height == 0) {
+			for (; cursor->item_count < count; ++it) {
+				cursor->construct_item(cursor->item_count, it->first, it->second);
+				cursor->item_count++;
 			}
-			cursor = cursor->children[i];
-			i = cursor->search(key);
-		}
-		
-		if (i < cursor->item_count && cursor->items[i]->first == key) {
-			i++;
+			cursor->update_subtree();
+			return cursor;
 		}
 		
-		if (i >= cursor->item_count) {
-			cursor = back.first;
-			i = back.second;
+		size_t slots = count + 1;
+		size_t children = build_children(slots, height, fill, is_root);
+		for (size_t i = 0; i < children; i++) {
+			size_t child_slots = slots / children + (i < slots % children);
+			vertex * child = build_subtree(it, child_slots - 1, height - 1, fill, false);
+			cursor->set_child(i, child);
+			
+			if (i + 1 < children) {
+				cursor->construct_item(i, it->first, it->second);
+				cursor->item_count++;
+				++it;
+			}
 		}
 		
-		return iterator(cursor, i);
+		cursor->update_subtree();
+		return cursor;
 	}
 	
-public:
 	/**
-	 * The basic constructor
-	 * @param a The minimum number of children for all non-root vertices (has to be at least 2)
-	 * @param b The maximum number of children for all vertices (has to be at least (2 * a) - 1)
-	 * @throws std::invalid_argument if a and b don't meet (a, b)-tree conditions
+	 * Replace the contents of the tree with count items from a sequence sorted by strictly increasing keys
+	 * @param first an iterator pointing to the first item
+	 * @param count the number of items
+	 * @param fill the desired number of items in a vertex
 	 */
-	abtree (size_t a, size_t b): a(a), b(b), size_(0)
+	template <typename Iterator>
+	void build (Iterator first, size_t count, size_t fill)
 	{
-		if (a < 2 || b < (2 * a) - 1) {
-			throw std::invalid_argument(a < 2 ? "a" : "b");
-		}
-		root = new vertex(b);
+		vertex * new_root = build_subtree(first, count, build_height(count, fill), fill, true);
+		destroy_tree();
+		root = new_root;
+		size_ = count;
 	}
 	
 	/**
-	 * The destructor. Uses BFS to destroy all the vertices.
+	 * Convert a fill factor to the desired number of items in a vertex (see assign())
+	 * @throws std::invalid_argument if fill is out of range
 	 */
-	~abtree ()
+	size_t fill_items (double fill) const
 	{
-		std::queue<vertex *> queue;
-		queue.push(root);
-		
-		while (queue.size() > 0) {
-			vertex * cursor = queue.front();
-			for (size_t i = 0; i < cursor->item_count; i++) {
-				delete cursor->items[i];
-			}
-			for (size_t i = 0; i <= cursor->item_count; i++) {
-				if (cursor->children[i] != nullptr) {
-					queue.push(cursor->children[i]);
-				}
-			}
-			delete cursor;
-			queue.pop();
+		if (!(fill > 0.0 && fill <= 1.0)) {
+			throw std::invalid_argument("fill");
 		}
+		
+		size_t items = static_cast<size_t>((b - 1) * fill + 0.5);
+		return std::min(std::max(items, size_t(a - 1)), size_t(b - 1));
 	}
 	
 	/**
-	 * @name Return an iterator to the first (and smallest) item in the tree
+	 * Replace the contents of the tree with the result of a set operation on two trees (see assign_union()).
+	 * The result is walked twice, first to count its items and then to build the tree.
 	 */
-	//@{
-	iterator begin ()
+	void assign_merged (abtree_set_operation operation, const abtree & x, const abtree & y, double fill)
 	{
-		return do_begin<iterator>();
+		build_merged(operation, x.cbegin(), x.cend(), y.cbegin(), y.cend(), fill_items(fill));
 	}
 	
-	const_iterator cbegin () const
+	/**
+	 * Replace the contents of the tree with the result of a set operation on two ranges of items
+	 * sorted by strictly increasing keys (see assign_merged())
+	 */
+	void build_merged (abtree_set_operation operation, const_iterator x, const_iterator x_end, const_iterator y, const_iterator y_end, size_t fill)
 	{
-		return do_begin<const_iterator>();
+		abtree_merge_iterator<const_iterator> first(operation, x, x_end, y, y_end);
+		size_t count = 0;
+		for (auto it = first; !it.at_end(); ++it) {
+			count++;
+		}
+		build(first, count, fill);
 	}
-	//@}
 	
 	/**
-	 * @name Return an iterator pointing to the item that would follow the last (and largest) item in the tree
+	 * Replace the contents of the tree with the result of a set operation on two trees using more threads
+	 * (see assign_union_parallel()). The keys are cut into one range per thread at the keys of evenly spaced
+	 * ranks in the larger tree. Every thread builds the result of its range as a separate tree, the trees
+	 * are then joined in order, which takes O(log n) steps per range.
 	 */
-	//@{
-	iterator end ()
+	void assign_merged_parallel (abtree_set_operation operation, const abtree & x, const abtree & y, double fill, size_t threads)
 	{
-		return do_end<iterator>();
+		size_t items = fill_items(fill);
+		const abtree & larger = x.size_ >= y.size_ ? x : y;
+		size_t parts = std::max(std::min(abtree_thread_count(threads), larger.size_), size_t(1));
+		
+		std::vector<const_iterator> x_borders(parts + 1);
+		std::vector<const_iterator> y_borders(parts + 1);
+		x_borders[0] = x.cbegin();
+		y_borders[0] = y.cbegin();
+		for (size_t i = 1; i < parts; i++) {
+			const key_type & key = larger.do_select<const_iterator>(larger.size_ * i / parts)->first;
+			x_borders[i] = x.lower_bound(key);
+			y_borders[i] = y.lower_bound(key);
+		}
+		x_borders[parts] = x.cend();
+		y_borders[parts] = y.cend();
+		
+		std::vector<abtree> results;
+		results.reserve(parts);
+		for (size_t i = 0; i < parts; i++) {
+			results.push_back(abtree(static_cast<const params &>(*this), alloc_));
+		}
+		abtree_run_parallel(parts, [operation, items, &x_borders, &y_borders, &results] (size_t i) {
+			results[i].build_merged(operation, x_borders[i], x_borders[i + 1], y_borders[i], y_borders[i + 1], items);
+		});
+		for (size_t i = 1; i < parts; i++) {
+			results[0].join(results[i]);
+		}
+		
+		// The operands may include this tree, so it's only replaced once the result is complete
+		vertex * empty = results[0].create_vertex(true);
+		destroy_tree();
+		root = results[0].root;
+		size_ = results[0].size_;
+		results[0].root = empty;
+		results[0].size_ = 0;
 	}
 	
-	const_iterator cend () const
+	/**
+	 * Compare two items by their keys
+	 */
+	static bool compare_keys (const std::pair<key_type, mapped_type> & x, const std::pair<key_type, mapped_type> & y)
 	{
-		return do_end<const_iterator>();
+		return x.first < y.first;
 	}
-	//@}
 	
 	/**
-	 * @name If an item with specified key is present in the tree, return an iterator pointing to it.
-	 * If it is not, return end().
-	 * @param key The key to search for
-	 * @return an iterator pointing to given item or past the end
+	 * Remove the items with duplicate keys from a vector sorted by keys, keeping the last one of each key
 	 */
-	//@{
-	iterator find (const TKey & key)
+	static void remove_duplicates (std::vector<std::pair<key_type, mapped_type> > & items)
 	{
-		return do_find<iterator>(key);
+		size_t count = 0;
+		for (size_t i = 0; i < items.size(); i++) {
+			if (count > 0 && !(items[count - 1].first < items[i].first)) {
+				items[count - 1] = std::move(items[i]);
+			} else if (count++ != i) {
+				items[count - 1] = std::move(items[i]);
+			}
+		}
+		items.erase(items.begin() + count, items.end());
 	}
 	
-	const_iterator find (const TKey & key) const
+	/**
+	 * Build the tree from a range that isn't known to be sorted. The items are copied and sorted first,
+	 * when there are more items with the same key, the last one is kept (as if they were inserted one by one).
+	 */
+	template <typename InputIterator>
+	void build_unsorted (InputIterator first, InputIterator last, size_t fill)
 	{
-		return do_find<const_iterator>(key);
+		std::vector<std::pair<key_type, mapped_type> > items(first, last);
+		std::stable_sort(items.begin(), items.end(), compare_keys);
+		remove_duplicates(items);
+		build(items.begin(), items.size(), fill);
 	}
-	//@}
 	
 	/**
-	 * @name Return a reference to the value of the item with given key if it is present in the tree,
-	 * throw an exception otherwise.
-	 * @return a reference to the value with specified key
-	 * @throws std::out_of_range if given key is not found
+	 * Build the tree from a range that isn't known to be sorted using more threads (see build_unsorted())
 	 */
-	//@{
-	TVal & at (const TKey & key)
+	template <typename RandomAccessIterator>
+	void build_unsorted_parallel (RandomAccessIterator first, RandomAccessIterator last, size_t fill, size_t threads)
 	{
-		iterator it = find(key);
-		if (it != end()) {
-			return it->second;
-		}
-		throw std::out_of_range();
+		std::vector<std::pair<key_type, mapped_type> > items(first, last);
+		abtree_parallel_sort(items.begin(), items.end(), compare_keys, threads);
+		remove_duplicates(items);
+		build_parallel(items.begin(), items.size(), fill, threads);
 	}
 	
-	const TVal & at (const TKey & key) const
+	/**
+	 * Build the tree from a forward range. If it's already sorted, no copy is needed.
+	 */
+	template <typename ForwardIterator>
+	void build_range (ForwardIterator first, ForwardIterator last, size_t fill, std::forward_iterator_tag)
 	{
-		const_iterator it = find(key);
-		if (it != end()) {
-			return it->second;
+		typedef typename std::iterator_traits<ForwardIterator>::value_type item_type;
+		auto out_of_order = std::adjacent_find(first, last, [] (const item_type & x, const item_type & y) {
+			return !(x.first < y.first);
+		});
+		
+		if (out_of_order == last) {
+			build(first, std::distance(first, last), fill);
+		} else {
+			build_unsorted(first, last, fill);
 		}
-		throw std::out_of_range();
 	}
-	//@}
 	
 	/**
-	 * @name Returns an iterator pointing to the smallest item that has a key larger or equal to given key.
-	 * If there's no such item in the tree, returns end().
-	 * @param key The key to search for
-	 * @return An iterator pointing to desired item or end()
+	 * Build the tree from an input range, which can only be traversed once
 	 */
-	//@{
-	iterator lower_bound (const key_type & key)
+	template <typename InputIterator>
+	void build_range (InputIterator first, InputIterator last, size_t fill, std::input_iterator_tag)
 	{
-		return do_lower_bound<iterator>(key);
+		build_unsorted(first, last, fill);
 	}
 	
-	const_iterator lower_bound (const key_type & key) const
+	/**
+	 * A subtree left out of the upper levels of the tree by build_upper(), to be built by one of the threads
+	 */
+	template <typename Iterator>
+	struct build_task
 	{
-		return do_lower_bound<const_iterator>(key);
-	}
-	//@}
+		vertex * parent;
+		size_t index;
+		Iterator first;
+		size_t count;
+	};
 	
 	/**
-	 * @name Returns an iterator pointing to the smallest item that has a key larger than given key.
-	 * If there's no such item in the tree, returns end().
-	 * @param key The key to search for
-	 * @return An iterator pointing to desired item or end()
+	 * Build the levels of a subtree above given height like build_subtree() does. The subtrees of that
+	 * height are only recorded as tasks, their places among the children are left empty and the sizes
+	 * of the built vertices aren't computed until the tasks are done (see finish_upper()).
+	 * @param it the iterator pointing to the next item, it's advanced past the items of the subtree
+	 * @param count the number of items in the subtree
+	 * @param height the height of the subtree (larger than cut)
+	 * @param cut the height of the subtrees left to the tasks
+	 * @param fill the desired number of items in a vertex
+	 * @param is_root whether the subtree is the whole tree
+	 * @param tasks the list the tasks are appended to
+	 * @return the root of the new subtree
 	 */
-	//@{
-	iterator upper_bound (const key_type & key)
+	template <typename Iterator>
+	vertex * build_upper (Iterator & it, size_t count, size_t height, size_t cut, size_t fill, bool is_root, std::vector<build_task<Iterator> > & tasks)
 	{
-		return do_upper_bound<iterator>(key);
+		vertex * cursor = create_vertex(false);
+		size_t slots = count + 1;
+		size_t children = build_children(slots, height, fill, is_root);
+		for (size_t i = 0; i < children; i++) {
+			size_t child_slots = slots / children + (i < slots % children);
+			if (height - 1 == cut) {
+				tasks.push_back(build_task<Iterator>{cursor, i, it, child_slots - 1});
+				it += child_slots - 1;
+			} else {
+				cursor->set_child(i, build_upper(it, child_slots - 1, height - 1, cut, fill, false, tasks));
+			}
+			
+			if (i + 1 < children) {
+				cursor->construct_item(i, it->first, it->second);
+				cursor->item_count++;
+				++it;
+			}
+		}
+		return cursor;
 	}
 	
-	const_iterator upper_bound (const key_type & key) const
+	/**
+	 * Compute the sizes of the vertices built by build_upper() once all their descendants are in place
+	 */
+	static void finish_upper (vertex * cursor, size_t height, size_t cut)
 	{
-		return do_upper_bound<const_iterator>(key);
+		if (height - 1 > cut) {
+			for (size_t i = 0; i <= cursor->item_count; i++) {
+				finish_upper(cursor->children[i], height - 1, cut);
+			}
+		}
+		cursor->update_subtree();
 	}
-	//@}
 	
 	/**
-	 * Inserts a new item into the tree. If there's already an item with the same key in the tree,
-	 * it gets replaced by the new item.
-	 * If the insertion causes a vertex to have more than b children, split_vertex() is called on it.
-	 * @param pair The item that gets copied into the tree
-	 * @return An iterator pointing to the inserted item
+	 * Replace the contents of the tree with count items from a sequence sorted by strictly increasing keys
+	 * using more threads. The result is the same tree that build() makes. The upper levels are built first,
+	 * the subtrees below them are divided among the threads. There are a few times more subtrees than threads,
+	 * the threads take them one by one, so a slow thread doesn't hold up the rest.
+	 * @param first an iterator pointing to the first item
+	 * @param count the number of items
+	 * @param fill the desired number of items in a vertex
+	 * @param threads the number of threads
 	 */
-	iterator insert (const value_type & pair)
+	template <typename RandomAccessIterator>
+	void build_parallel (RandomAccessIterator first, size_t count, size_t fill, size_t threads)
 	{
-		auto new_item = new value_type(pair);
-		auto cursor = root;
-		while (true) {
-			size_t i = cursor->search(new_item->first);
-			if (i < cursor->item_count && cursor->items[i]->first == new_item->first) {
-				delete cursor->items[i];
-				cursor->items[i] = new_item;
-				return iterator(cursor, i);
-			}
-			if (cursor->children[i] == nullptr) {
-				break;
-			}
-			cursor = cursor->children[i];
+		size_t height = build_height(count, fill);
+		if (threads == 1 || height == 0) {
+			build(first, count, fill);
+			return;
 		}
-		
-		size_t i = cursor->search(new_item->first);
-		if (i < cursor->item_count) {
-			for (size_t j = cursor->item_count; j > i; j--) {
-				cursor->items[j] = cursor->items[j - 1];
-			}
+		size_t cut = height - 1;
+		while (cut > 0 && (count + 1) / bounded_pow(fill + 1, cut + 1) < 4 * threads) {
+			cut--;
 		}
 		
-		cursor->items[i] = new_item;
-		cursor->item_count++;
-		
-		size_++;
+		std::vector<build_task<RandomAccessIterator> > tasks;
+		RandomAccessIterator it = first;
+		vertex * new_root = build_upper(it, count, height, cut, fill, true, tasks);
 		
-		if (cursor->item_count < b) {
-			return iterator(cursor, i);
-		}
+		std::atomic<size_t> next(0);
+		abtree_run_parallel(std::min(threads, tasks.size()), [this, &tasks, &next, cut, fill] (size_t) {
+			for (size_t i = next++; i < tasks.size(); i = next++) {
+				build_task<RandomAccessIterator> & task = tasks[i];
+				RandomAccessIterator it = task.first;
+				task.parent->set_child(task.index, build_subtree(it, task.count, cut, fill, false));
+			}
+		});
+		finish_upper(new_root, height, cut);
 		
-		cursor = split_vertex(cursor);
-		return find(new_item->first);
+		destroy_tree();
+		root = new_root;
+		size_ = count;
 	}
 	
 	/**
-	 * Erase the item with given key from the tree. If such item isn't present in the tree, don't do anything.
-	 * If the deletion causes a vertex to have less than a children, refill_vertex is called on it.
-	 * @param key The key of the item to be erased
+	 * Find the lowest vertex on the path from given vertex to the root whose subtree covers given key,
+	 * that is, the key lies strictly between the keys in the ancestors that bound the subtree.
+	 * Searching for nearby keys this way only takes a few steps instead of a full descent from the root.
+	 * @param cursor the starting vertex
+	 * @param key the key
+	 * @return the vertex where a search for the key can start
 	 */
-	void erase (const TKey & key)
+	vertex * climb (vertex * cursor, const key_type & key) const
+	{
+		while (cursor != root) {
+			// A key between the first and the last key of the vertex is covered without looking at the parent
+			bool after_first = !(key < cursor->keys[0]);
+			bool before_last = !(cursor->keys[cursor->item_count - 1] < key);
+			if (after_first && before_last) {
+				return cursor;
+			}
+			
+			// Only one of the bounding keys matters. Ancestors whose first (or last) child is on the path
+			// share it, so they are skipped without searching.
+			vertex * child = cursor;
+			vertex * parent = child->parent;
+			while (parent != nullptr && child == parent->children[before_last ? 0 : parent->item_count]) {
+				child = parent;
+				parent = child->parent;
+			}
+			if (parent == nullptr) {
+				return cursor;
+			}
+			
+			size_t i = child->index;
+			if (before_last ? parent->keys[i - 1] < key : key < parent->keys[i]) {
+				return cursor;
+			}
+			cursor = parent;
+		}
+		return cursor;
+	}
+	
+	/**
+	 * Find the keys in the ancestors of given vertex that bound the range of its subtree
+	 * @param cursor the vertex
+	 * @param lo set to the largest key before the range, nullptr if there isn't any
+	 * @param hi set to the smallest key after the range, nullptr if there isn't any
+	 */
+	static void subtree_bounds (vertex * cursor, const key_type *& lo, const key_type *& hi)
+	{
+		lo = nullptr;
+		hi = nullptr;
+		for (; cursor->parent != nullptr && (lo == nullptr || hi == nullptr); cursor = cursor->parent) {
+			vertex * parent = cursor->parent;
+			if (lo == nullptr && cursor->index > 0) {
+				lo = &parent->keys[cursor->index - 1];
+			}
+			if (hi == nullptr && cursor->index < parent->item_count) {
+				hi = &parent->keys[cursor->index];
+			}
+		}
+	}
+	
+	/**
+	 * @name Add one to (or subtract one from) the subtree sizes of given vertex and all of its ancestors
+	 * after an item has been inserted into (or erased from) the vertex, and recompute their aggregates.
+	 * Rebalancing doesn't change the contents of any subtree above the rebalanced vertices,
+	 * so it only recomputes the sizes and aggregates of those.
+	 */
+	//@{
+	void grow_subtree_sizes (vertex * cursor)
+	{
+		for (; cursor != nullptr; cursor = cursor->parent) {
+			cursor->subtree_size++;
+			cursor->update_aggregate();
+		}
+	}
+	
+	void shrink_subtree_sizes (vertex * cursor)
+	{
+		for (; cursor != nullptr; cursor = cursor->parent) {
+			cursor->subtree_size--;
+			cursor->update_aggregate();
+		}
+	}
+	//@}
+	
+	/**
+	 * Recompute the aggregates of given vertex and all of its ancestors after a value has been replaced
+	 */
+	void update_aggregates (vertex * cursor)
+	{
+		for (; cursor != nullptr; cursor = cursor->parent) {
+			cursor->update_aggregate();
+		}
+	}
+	
+	/**
+	 * Insert an item with given key into the subtree of given vertex, unless the key is already present.
+	 * The range of the subtree has to cover the key. The value is constructed in place,
+	 * the arguments are left untouched if the key is present.
+	 * If the insertion causes a vertex to have more than b children, split_vertex() is called on it.
+	 * @param cursor the root of the subtree
+	 * @param finger set to the vertex that holds the item, where climb() can start for the next key
+	 * @param key the key of the item
+	 * @param args the arguments passed to the constructor of the value
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	template <typename K, typename... Args>
+	std::pair<iterator, bool> emplace_from (vertex * cursor, vertex *& finger, K && key, Args &&... args)
+	{
+		size_t i;
+		while (true) {
+			i = cursor->search(key);
+			if (i < cursor->item_count && cursor->keys[i] == key) {
+				finger = cursor;
+				return std::make_pair(iterator(cursor, i), false);
+			}
+			if (cursor->leaf) {
+				break;
+			}
+			cursor = cursor->children[i];
+			cursor->prefetch(b);
+		}
+		
+		for (size_t j = cursor->item_count; j > i; j--) {
+			cursor->move_item(j - 1, cursor, j);
+		}
+		
+		cursor->construct_item(i, std::forward<K>(key), std::forward<Args>(args)...);
+		cursor->item_count++;
+		
+		size_++;
+		grow_subtree_sizes(cursor);
+		
+		if (cursor->item_count == b) {
+			cursor = split_vertex(cursor, i);
+		}
+		
+		finger = cursor;
+		return std::make_pair(iterator(cursor, i), true);
+	}
+	
+	/**
+	 * Insert an item into the subtree of given vertex (see emplace_from()).
+	 * If the key is already present, its value gets replaced instead.
+	 * @param cursor the root of the subtree
+	 * @param finger set to the vertex that holds the item, where climb() can start for the next key
+	 * @param key the key of the item
+	 * @param value the value of the item
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	template <typename K, typename V>
+	std::pair<iterator, bool> assign_from (vertex * cursor, vertex *& finger, K && key, V && value)
+	{
+		auto result = emplace_from(cursor, finger, std::forward<K>(key), std::forward<V>(value));
+		if (!result.second) {
+			// The value hasn't been consumed by emplace_from()
+			result.first.vertex_->values[result.first.position_] = std::forward<V>(value);
+			update_aggregates(finger);
+		}
+		return result;
+	}
+	
+	/**
+	 * Erase the item with given key from the subtree of given vertex, whose range has to cover the key
+	 * (see erase()).
+	 * @param cursor the root of the subtree
+	 * @param key the key of the item to be erased
+	 * @return a leaf close to the position of the key, where climb() can start for the next key
+	 */
+	vertex * erase_from (vertex * cursor, const key_type & key)
 	{
-		auto cursor = root;
 		size_t i, pos;
 		while (true) {
 			i = cursor->search(key);
-			if (i < cursor->item_count && cursor->items[i]->first == key) {
+			if (i < cursor->item_count && cursor->keys[i] == key) {
 				break;
 			}
-			if (cursor->children[0] == nullptr) {
-				return;
+			if (cursor->leaf) {
+				return cursor;
 			}
 			cursor = cursor->children[i];
 		}
 		
-		delete cursor->items[i];
-		
-		if (cursor->children[0] != nullptr) {
+		if (!cursor->leaf) {
 			auto cursor_leaf = cursor->children[i];
-			while (cursor_leaf->children[0] != nullptr) {
+			while (!cursor_leaf->leaf) {
 				cursor_leaf = cursor_leaf->children[cursor_leaf->item_count];
 			}
-			cursor->items[i] = cursor_leaf->items[cursor_leaf->item_count - 1];
+			cursor->destroy_item(i);
+			cursor_leaf->move_item(cursor_leaf->item_count - 1, cursor, i);
+			pos = cursor_leaf->index;
 			cursor = cursor_leaf;
-			pos = cursor_leaf->parent->search(cursor->items[cursor->item_count -1]->first);
 		} else {
+			pos = cursor->index;
+			cursor->destroy_item(i);
 			for (size_t j = i; j < cursor->item_count - 1; j++) {
-				cursor->items[j] = cursor->items[j + 1];
-			}
-			
-			if (cursor != root) {
-				pos = cursor->parent->search(key);
+				cursor->move_item(j + 1, cursor, j);
 			}
 		}
 		
 		cursor->item_count--;
+		size_--;
+		shrink_subtree_sizes(cursor);
 		
 		if (cursor != root && cursor->item_count < a - 1) {
-			refill_vertex(cursor->parent, pos);
+			return refill_vertex(cursor->parent, pos);
+		}
+		return cursor;
+	}
+	
+	/**
+	 * Insert the items of a sorted batch that belong to given leaf all at once (see insert_sorted()).
+	 * Items are taken from the batch for as long as their keys increase and stay in the range of the leaf.
+	 * They are merged with the items of the leaf from the back, so that every item is moved only once.
+	 * If they don't fit, the leaf is divided into as few leaves as possible with the items spread evenly,
+	 * and the keys between them are inserted into the parent one after another.
+	 * All new vertices are allocated before anything is moved.
+	 * @param leaf the leaf whose range covers the key of the first item
+	 * @param first the batch, advanced past the items that have been inserted
+	 * @param last the end of the batch
+	 * @param batch a buffer for the items
+	 * @param leaves a buffer for the leaves the items are divided into
+	 * (both buffers are kept by the caller between the groups)
+	 * @return the last of the leaves, where climb() can start for the next key
+	 */
+	template <typename InputIterator>
+	vertex * insert_group (vertex * leaf, InputIterator & first, InputIterator last, std::vector<std::pair<key_type, mapped_type> > & batch, std::vector<vertex *> & leaves)
+	{
+		batch.clear();
+		batch.emplace_back(first->first, first->second);
+		++first;
+		if (first != last) {
+			const key_type * lo;
+			const key_type * hi;
+			subtree_bounds(leaf, lo, hi);
+			for (; first != last && (hi == nullptr || first->first < *hi); ++first) {
+				if (!(batch.back().first < first->first)) {
+					break;
+				}
+				batch.emplace_back(first->first, first->second);
+			}
+		}
+		if (batch.size() == 1) {
+			vertex * finger;
+			assign_from(leaf, finger, std::move(batch[0].first), std::move(batch[0].second));
+			return finger;
 		}
 		
-		size_--;
+		size_t count = leaf->item_count;
+		size_t added = 0;
+		for (size_t i = 0, j = 0; i < batch.size(); i++) {
+			while (j < count && leaf->keys[j] < batch[i].first) {
+				j++;
+			}
+			added += j == count || !(leaf->keys[j] == batch[i].first);
+		}
+		
+		// The merged sequence is cut into parts, all of them but the last one followed by a key for the parent.
+		// The first `larger` parts get one item more than the others.
+		size_t total = count + added;
+		size_t parts = (total + b) / b;
+		size_t items = total - (parts - 1);
+		size_t part_items = items / parts;
+		size_t larger = items % parts;
+		auto start = [part_items, larger] (size_t p) {
+			return p * (part_items + 1) + std::min(p, larger);
+		};
+		
+		leaves.clear();
+		leaves.reserve(parts);
+		leaves.push_back(leaf);
+		vertex * new_root = nullptr;
+		try {
+			for (size_t p = 1; p < parts; p++) {
+				leaves.push_back(create_vertex(true));
+			}
+			if (parts > 1 && leaf == root) {
+				new_root = create_vertex(false);
+			}
+		} catch (...) {
+			for (size_t p = 1; p < leaves.size(); p++) {
+				destroy_vertex(leaves[p]);
+			}
+			throw;
+		}
+		
+		// Positions only decrease, so no item of the leaf is overwritten before it has been moved
+		size_t part = parts - 1;
+		size_t i = batch.size();
+		size_t j = count;
+		for (size_t position = total; position-- > 0;) {
+			while (position < start(part)) {
+				part--;
+			}
+			vertex * target = leaves[part];
+			size_t slot = position - start(part);
+			if (i > 0 && (j == 0 || leaf->keys[j - 1] < batch[i - 1].first)) {
+				target->construct_item(slot, std::move(batch[i - 1].first), std::move(batch[i - 1].second));
+				i--;
+				continue;
+			}
+			if (target != leaf || slot != j - 1) {
+				leaf->move_item(j - 1, target, slot);
+			}
+			if (i > 0 && target->keys[slot] == batch[i - 1].first) {
+				target->values[slot] = std::move(batch[i - 1].second);
+				i--;
+			}
+			j--;
+		}
+		
+		size_ += added;
+		for (size_t p = 0; p < parts; p++) {
+			leaves[p]->item_count = part_items + (p < larger);
+			leaves[p]->update_subtree();
+		}
+		for (vertex * cursor = leaf->parent; cursor != nullptr; cursor = cursor->parent) {
+			cursor->subtree_size = cursor->subtree_size + leaf->item_count - count;
+			cursor->update_aggregate();
+		}
+		if (new_root != nullptr) {
+			root = new_root;
+			root->set_child(0, leaf);
+			root->update_subtree();
+		}
+		
+		for (size_t p = 1; p < parts; p++) {
+			vertex * left = leaves[p - 1];
+			vertex * parent = left->parent;
+			size_t pos = left->index;
+			for (size_t k = parent->item_count; k > pos; k--) {
+				parent->move_item(k - 1, parent, k);
+			}
+			for (size_t k = parent->item_count + 1; k > pos + 1; k--) {
+				parent->set_child(k, parent->children[k - 1]);
+			}
+			left->move_item(left->item_count, parent, pos);
+			parent->set_child(pos + 1, leaves[p]);
+			parent->item_count++;
+			for (vertex * cursor = parent; cursor != nullptr; cursor = cursor->parent) {
+				cursor->subtree_size += leaves[p]->subtree_size + 1;
+				cursor->update_aggregate();
+			}
+			if (parent->item_count == b) {
+				size_t median = 0;
+				split_vertex(parent, median);
+			}
+		}
+		return leaves[parts - 1];
+	}
+	
+	/**
+	 * Erase the keys of a sorted batch that belong to given leaf all at once (see erase_sorted()).
+	 * Keys are taken from the batch for as long as they stay in the range of the leaf and don't precede
+	 * the items that have already been passed. The remaining items are compacted in a single pass
+	 * and the leaf is refilled at most once, by moving all the missing items from a neighbour
+	 * at once or by merging with it (see rebalance_children()).
+	 * @param leaf the leaf whose range covers the first key
+	 * @param first the batch, advanced past the keys that have been handled
+	 * @param last the end of the batch
+	 * @return a leaf that holds the items around the erased ones, where climb() can start for the next key
+	 */
+	template <typename InputIterator>
+	vertex * erase_group (vertex * leaf, InputIterator & first, InputIterator last)
+	{
+		const key_type * lo;
+		const key_type * hi;
+		subtree_bounds(leaf, lo, hi);
+		
+		size_t count = leaf->item_count;
+		size_t kept = 0;
+		size_t j = 0;
+		for (; first != last; ++first) {
+			const key_type & key = *first;
+			if ((lo != nullptr && !(*lo < key)) || (hi != nullptr && !(key < *hi)) || (kept > 0 && !(leaf->keys[kept - 1] < key))) {
+				break;
+			}
+			for (; j < count && leaf->keys[j] < key; j++, kept++) {
+				if (kept < j) {
+					leaf->move_item(j, leaf, kept);
+				}
+			}
+			if (j < count && leaf->keys[j] == key) {
+				leaf->destroy_item(j);
+				j++;
+			}
+		}
+		for (; j < count; j++, kept++) {
+			if (kept < j) {
+				leaf->move_item(j, leaf, kept);
+			}
+		}
+		
+		leaf->item_count = kept;
+		size_ -= count - kept;
+		for (vertex * cursor = leaf; cursor != nullptr; cursor = cursor->parent) {
+			cursor->subtree_size -= count - kept;
+			cursor->update_aggregate();
+		}
+		
+		if (leaf == root || kept >= a - 1) {
+			return leaf;
+		}
+		// The left one of the two rebalanced leaves survives a merge
+		vertex * parent = leaf->parent;
+		size_t i = std::min(leaf->index, parent->item_count - 1);
+		vertex * left = parent->children[i];
+		rebalance_children(parent, i);
+		return left;
+	}
+	
+	/**
+	 * The height of the subtree of given vertex (0 for a leaf)
+	 */
+	static size_t height (vertex * cursor)
+	{
+		size_t result = 0;
+		for (; !cursor->leaf; cursor = cursor->children[0]) {
+			result++;
+		}
+		return result;
+	}
+	
+	/**
+	 * Make sure that both neighbouring children i and i + 1 of given vertex have at least a - 1 items,
+	 * after one of them has been attached by join_subtrees(). If they have enough items together,
+	 * the missing items are moved from the other child through the key that separates them
+	 * (all at once, unlike refill_vertex()). Otherwise the children are merged.
+	 * @param parent the parent of the children
+	 * @param i the position of the left child
+	 */
+	void rebalance_children (vertex * parent, size_t i)
+	{
+		vertex * left = parent->children[i];
+		vertex * right = parent->children[i + 1];
+		size_t l = left->item_count;
+		size_t r = right->item_count;
+		if (l >= a - 1 && r >= a - 1) {
+			return;
+		}
+		if (l + r < 2 * (a - 1)) {
+			merge_vertices(left, right, i);
+			return;
+		}
+		
+		if (l < a - 1) {
+			size_t n = a - 1 - l;
+			parent->move_item(i, left, l);
+			for (size_t j = 0; j < n - 1; j++) {
+				right->move_item(j, left, l + 1 + j);
+			}
+			right->move_item(n - 1, parent, i);
+			for (size_t j = n; j < r; j++) {
+				right->move_item(j, right, j - n);
+			}
+			if (!left->leaf) {
+				for (size_t j = 0; j < n; j++) {
+					left->set_child(l + 1 + j, right->children[j]);
+				}
+				for (size_t j = n; j <= r; j++) {
+					right->set_child(j - n, right->children[j]);
+				}
+				for (size_t j = r - n + 1; j <= r; j++) {
+					right->children[j] = nullptr;
+				}
+			}
+			left->item_count += n;
+			right->item_count -= n;
+		} else {
+			size_t n = a - 1 - r;
+			for (size_t j = r; j > 0; j--) {
+				right->move_item(j - 1, right, j - 1 + n);
+			}
+			parent->move_item(i, right, n - 1);
+			for (size_t j = 0; j < n - 1; j++) {
+				left->move_item(l - n + 1 + j, right, j);
+			}
+			left->move_item(l - n, parent, i);
+			if (!left->leaf) {
+				for (size_t j = r + 1; j > 0; j--) {
+					right->set_child(j - 1 + n, right->children[j - 1]);
+				}
+				for (size_t j = 0; j < n; j++) {
+					right->set_child(j, left->children[l - n + 1 + j]);
+					left->children[l - n + 1 + j] = nullptr;
+				}
+			}
+			left->item_count -= n;
+			right->item_count += n;
+		}
+		left->update_subtree();
+		right->update_subtree();
+	}
+	
+	/**
+	 * Join two detached subtrees and an item between them into a single subtree. All keys in the left subtree
+	 * have to be smaller than the key of the item and all keys in the right subtree larger.
+	 * The roots of the subtrees may have any number of items (like the root of a tree), either subtree
+	 * may be missing altogether. The lower subtree is attached to the border of the higher one at the level
+	 * where their heights match and only the vertices on that border are rebalanced, so it takes
+	 * O(1 + the difference of their heights) steps.
+	 * The root pointer of the tree is used for the root of the joined subtree (so that rebalancing
+	 * can grow or shrink it), the size of the tree is left to the caller.
+	 * The heights are passed in by the caller, who knows them from the split path, because finding them
+	 * here would take O(log n) steps for every join.
+	 * @param left the root of the left subtree or nullptr
+	 * @param left_height the height of the left subtree (ignored if it's missing)
+	 * @param key, value the item
+	 * @param right the root of the right subtree or nullptr
+	 * @param right_height the height of the right subtree (ignored if it's missing)
+	 * @param height set to the height of the joined subtree
+	 * @return the root of the joined subtree
+	 */
+	vertex * join_subtrees (vertex * left, size_t left_height, key_type && key, mapped_type && value, vertex * right, size_t right_height, size_t & height)
+	{
+		if (left == nullptr || right == nullptr) {
+			vertex * finger;
+			root = left != nullptr ? left : right;
+			height = left != nullptr ? left_height : right_height;
+			if (root == nullptr) {
+				root = create_vertex(true);
+				height = 0;
+			}
+			// The insert can only make the subtree higher, by splitting the root
+			vertex * top = root;
+			emplace_from(root, finger, std::move(key), std::move(value));
+			height += root != top;
+			return root;
+		}
+		
+		if (left_height == right_height) {
+			vertex * top = create_vertex(false);
+			root = top;
+			root->set_child(0, left);
+			root->construct_item(0, std::move(key), std::move(value));
+			root->set_child(1, right);
+			root->item_count = 1;
+			root->update_subtree();
+			// If the two subtrees get merged, the merged vertex replaces the new root
+			rebalance_children(root, 0);
+			height = root == top ? left_height + 1 : left_height;
+			return root;
+		}
+		
+		vertex * cursor;
+		size_t i;
+		height = std::max(left_height, right_height);
+		if (left_height > right_height) {
+			root = left;
+			cursor = left;
+			for (size_t h = left_height; h > right_height + 1; h--) {
+				cursor = cursor->children[cursor->item_count];
+			}
+			i = cursor->item_count;
+			cursor->construct_item(i, std::move(key), std::move(value));
+			cursor->set_child(i + 1, right);
+		} else {
+			root = right;
+			cursor = right;
+			for (size_t h = right_height; h > left_height + 1; h--) {
+				cursor = cursor->children[0];
+			}
+			i = 0;
+			for (size_t j = cursor->item_count; j > 0; j--) {
+				cursor->move_item(j - 1, cursor, j);
+			}
+			for (size_t j = cursor->item_count + 1; j > 0; j--) {
+				cursor->set_child(j, cursor->children[j - 1]);
+			}
+			cursor->construct_item(0, std::move(key), std::move(value));
+			cursor->set_child(0, left);
+		}
+		cursor->item_count++;
+		for (vertex * ancestor = cursor; ancestor != nullptr; ancestor = ancestor->parent) {
+			ancestor->update_subtree();
+		}
+		
+		// The cursor has gained an item, so rebalancing its children can't make it underflow.
+		// The subtree can only get higher, by splitting the cursor up to the root.
+		vertex * top = root;
+		rebalance_children(cursor, i);
+		if (cursor->item_count == b) {
+			size_t median = 0;
+			split_vertex(cursor, median);
+		}
+		height += root != top;
+		return root;
+	}
+	
+	/**
+	 * Split the subtree of given vertex into the subtree of the items with keys smaller than given key
+	 * and the subtree of the rest. The vertex is detached from its parent first. The items and children
+	 * of each vertex on the search path are divided around the key, the parts are joined with the
+	 * parts of the split child from bottom to top (see join_subtrees()). The heights of the parts
+	 * grow along the path, so the joins take O(log n) steps in total. The heights are carried along
+	 * the recursion, so that the joins don't have to look for them.
+	 * @param cursor the root of the subtree
+	 * @param cursor_height the height of the subtree
+	 * @param key the key
+	 * @param lower set to the root of the smaller keys, nullptr if there aren't any
+	 * @param lower_height set to the height of the smaller keys
+	 * @param upper set to the root of the rest, nullptr if it's empty
+	 * @param upper_height set to the height of the rest
+	 */
+	void split_subtree (vertex * cursor, size_t cursor_height, const key_type & key, vertex *& lower, size_t & lower_height, vertex *& upper, size_t & upper_height)
+	{
+		cursor->parent = nullptr;
+		cursor->index = 0;
+		size_t count = cursor->item_count;
+		size_t i = cursor->search(key);
+		
+		if (cursor->leaf) {
+			lower = i > 0 ? cursor : nullptr;
+			upper = i < count ? cursor : nullptr;
+			lower_height = 0;
+			upper_height = 0;
+			if (i > 0 && i < count) {
+				upper = create_vertex(true);
+				for (size_t j = i; j < count; j++) {
+					cursor->move_item(j, upper, j - i);
+				}
+				upper->item_count = count - i;
+				cursor->item_count = i;
+				cursor->update_subtree();
+				upper->update_subtree();
+			}
+			return;
+		}
+		
+		vertex * lower_child;
+		vertex * upper_child;
+		size_t lower_child_height;
+		size_t upper_child_height;
+		split_subtree(cursor->children[i], cursor_height - 1, key, lower_child, lower_child_height, upper_child, upper_child_height);
+		cursor->children[i] = nullptr;
+		
+		// The items after the key and the children between them, joined with the upper part of the child
+		upper = upper_child;
+		upper_height = upper_child_height;
+		if (i < count) {
+			vertex * rest = cursor->children[i + 1];
+			size_t rest_height = cursor_height - 1;
+			if (i + 1 < count) {
+				rest = create_vertex(false);
+				for (size_t j = i + 1; j < count; j++) {
+					cursor->move_item(j, rest, j - (i + 1));
+				}
+				for (size_t j = i + 1; j <= count; j++) {
+					rest->set_child(j - (i + 1), cursor->children[j]);
+				}
+				rest->item_count = count - (i + 1);
+				rest->update_subtree();
+				rest_height = cursor_height;
+			}
+			for (size_t j = i + 1; j <= count; j++) {
+				cursor->children[j] = nullptr;
+			}
+			rest->parent = nullptr;
+			rest->index = 0;
+			
+			key_type separator(std::move(cursor->keys[i]));
+			mapped_type separator_value(std::move(cursor->values[i]));
+			cursor->destroy_item(i);
+			upper = join_subtrees(upper_child, upper_child_height, std::move(separator), std::move(separator_value), rest, rest_height, upper_height);
+		}
+		cursor->item_count = i;
+		
+		// The items before the key stay in the vertex, which is joined with the lower part of the child
+		lower = lower_child;
+		lower_height = lower_child_height;
+		if (i > 0) {
+			key_type separator(std::move(cursor->keys[i - 1]));
+			mapped_type separator_value(std::move(cursor->values[i - 1]));
+			cursor->destroy_item(i - 1);
+			cursor->item_count = i - 1;
+			
+			vertex * rest = cursor;
+			size_t rest_height = cursor_height;
+			if (i == 1) {
+				rest = cursor->children[0];
+				rest_height = cursor_height - 1;
+				rest->parent = nullptr;
+				rest->index = 0;
+				destroy_vertex(cursor);
+			} else {
+				cursor->update_subtree();
+			}
+			lower = join_subtrees(rest, rest_height, std::move(separator), std::move(separator_value), lower_child, lower_child_height, lower_height);
+		} else {
+			destroy_vertex(cursor);
+		}
+	}
+	
+	/**
+	 * A function template for the begin() and cbegin() methods
+	 */
+	template <typename iterator>
+	iterator do_begin () const
+	{
+		auto cursor = root;
+		while (!cursor->leaf) {
+			cursor = cursor->children[0];
+		}
+		return iterator(cursor, 0);
+	}
+	
+	/**
+	 * A function template for the end() and cend() methods
+	 */
+	template <typename iterator>
+	iterator do_end () const
+	{
+		return iterator(root, root->item_count);
+	}
+	
+	/**
+	 * A function template for the find() method (this method can return an iterator or a const_iterator)
+	 */
+	template <typename iterator>
+	iterator do_find (const TKey & key, vertex * cursor) const
+	{
+		size_t i = cursor->search(key);
+		
+		while (true) {
+			if (i < cursor->item_count && cursor->keys[i] == key) {
+				return iterator(cursor, i);
+			}
+			if (cursor->leaf) {
+				return do_end<iterator>();
+			}
+			cursor = cursor->children[i];
+			cursor->prefetch(b);
+			i = cursor->search(key);
+		}
+	}
+	
+	/**
+	 * A function template for the lower_bound() method (this method can return an iterator or a const_iterator)
+	 */
+	template <typename iterator>
+	iterator do_lower_bound (const key_type & key, vertex * cursor) const
+	{
+		size_t i = cursor->search(key);
+		// The successor of a subtree other than the whole tree lies above the starting vertex
+		std::pair<vertex *, size_t> back = std::make_pair(cursor == root ? root : nullptr, root->item_count);
+		
+		while (!cursor->leaf) {
+			if (i < cursor->item_count) {
+				if (cursor->keys[i] == key) {
+					return iterator(cursor, i);
+				}
+				back = std::make_pair(cursor, i);
+			}
+			cursor = cursor->children[i];
+			cursor->prefetch(b);
+			i = cursor->search(key);
+		}
+		
+		if (i == cursor->item_count) {
+			if (back.first == nullptr) {
+				return ++iterator(cursor, i - 1);
+			}
+			cursor = back.first;
+			i = back.second;
+		}
+		
+		return iterator(cursor, i);
+	}
+	
+	/**
+	 * A function template for the upper_bound() method (this method can return an iterator or a const_iterator)
+	 */
+	template <typename iterator>
+	iterator do_upper_bound (const key_type & key) const
+	{
+		auto cursor = root;
+		size_t i = cursor->search(key);
+		std::pair<vertex *, size_t> back = std::make_pair(root, root->item_count);
+		
+		while (!cursor->leaf) {
+			if (i < cursor->item_count) {
+				if (cursor->keys[i] == key) {
+					cursor = cursor->children[i + 1];
+					while (!cursor->leaf) {
+						cursor = cursor->children[0];
+					}
+					return iterator(cursor, 0);
+				}
+				back = std::make_pair(cursor, i);
+			}
+			cursor = cursor->children[i];
+			cursor->prefetch(b);
+			i = cursor->search(key);
+		}
+		
+		if (i < cursor->item_count && cursor->keys[i] == key) {
+			i++;
+		}
+		
+		if (i >= cursor->item_count) {
+			cursor = back.first;
+			i = back.second;
+		}
+		
+		return iterator(cursor, i);
+	}
+	
+	/**
+	 * The number of lookups of a batch that advance together (see do_batch())
+	 */
+	static const size_t batch_group = 16;
+	
+	/**
+	 * The state of one lookup of a batch: the vertex it has reached, the candidate for the lower bound
+	 * (like in do_lower_bound()) and the result once it's done
+	 */
+	template <typename iterator>
+	struct batch_lookup
+	{
+		vertex * cursor;
+		std::pair<vertex *, size_t> back;
+		iterator result;
+		bool done;
+	};
+	
+	/**
+	 * The keys of a group of lookups (see do_batch()), constructed in place so that a batch doesn't
+	 * allocate. The keys are destroyed by clear() and when the group goes out of scope.
+	 */
+	struct batch_keys
+	{
+		alignas(key_type) unsigned char storage[batch_group * sizeof(key_type)];
+		size_t count = 0;
+		
+		key_type & operator[] (size_t i)
+		{
+			return reinterpret_cast<key_type *>(storage)[i];
+		}
+		
+		template <typename T>
+		void push_back (T && key)
+		{
+			new (&(*this)[count]) key_type(std::forward<T>(key));
+			count++;
+		}
+		
+		void clear ()
+		{
+			for (; count > 0; count--) {
+				(*this)[count - 1].~key_type();
+			}
+		}
+		
+		~batch_keys ()
+		{
+			clear();
+		}
+	};
+	
+	/**
+	 * A function template for the find_batch() and lower_bound_batch() methods. The keys are taken
+	 * in groups of batch_group lookups, which descend the tree in lockstep: each round does one step
+	 * of every unfinished lookup and prefetches the vertex it's going to search next, so the cache misses
+	 * of different lookups overlap instead of each lookup waiting for its own.
+	 * The lookups of a group can't start where the previous lookup of the same group ends, as that one
+	 * is still on its way. If the keys of a group are in order, its lookups start instead at the lowest vertex
+	 * covering their key on the path of the last lookup of the previous group (see climb()), so consecutive
+	 * groups of a sorted batch don't walk the common part of their paths again.
+	 * @param first, last The range of keys
+	 * @param out The output iterator the results are written to, in the order of the keys
+	 * @param lower_bound Whether the lookups look for the lower bound instead of an exact match
+	 * @return The output iterator past the last result
+	 */
+	template <typename iterator, typename InputIterator, typename OutputIterator>
+	OutputIterator do_batch (InputIterator first, InputIterator last, OutputIterator out, bool lower_bound) const
+	{
+		batch_keys keys;
+		batch_lookup<iterator> lookups[batch_group];
+		vertex * finger = root;
+		
+		while (first != last) {
+			keys.clear();
+			bool sorted = true;
+			for (; first != last && keys.count < batch_group; ++first) {
+				keys.push_back(*first);
+				sorted = sorted && (keys.count == 1 || !(keys[keys.count - 1] < keys[keys.count - 2]));
+			}
+			
+			for (size_t j = 0; j < keys.count; j++) {
+				batch_lookup<iterator> & lookup = lookups[j];
+				lookup.cursor = sorted ? climb(finger, keys[j]) : root;
+				lookup.back = std::make_pair(lookup.cursor == root ? root : nullptr, root->item_count);
+				lookup.done = false;
+			}
+			
+			for (size_t active = keys.count; active > 0;) {
+				for (size_t j = 0; j < keys.count; j++) {
+					batch_lookup<iterator> & lookup = lookups[j];
+					if (lookup.done) {
+						continue;
+					}
+					vertex * cursor = lookup.cursor;
+					size_t i = cursor->search(keys[j]);
+					
+					if (i < cursor->item_count && cursor->keys[i] == keys[j]) {
+						lookup.result = iterator(cursor, i);
+					} else if (!cursor->leaf) {
+						if (lower_bound && i < cursor->item_count) {
+							lookup.back = std::make_pair(cursor, i);
+						}
+						lookup.cursor = cursor->children[i];
+						lookup.cursor->prefetch(b);
+						continue;
+					} else if (!lower_bound) {
+						lookup.result = do_end<iterator>();
+					} else if (i < cursor->item_count) {
+						lookup.result = iterator(cursor, i);
+					} else if (lookup.back.first == nullptr) {
+						lookup.result = ++iterator(cursor, i - 1);
+					} else {
+						lookup.result = iterator(lookup.back.first, lookup.back.second);
+					}
+					lookup.done = true;
+					active--;
+				}
+			}
+			
+			for (size_t j = 0; j < keys.count; j++) {
+				*out = lookups[j].result;
+				++out;
+			}
+			finger = lookups[keys.count - 1].cursor;
+		}
+		return out;
+	}
+	
+	/**
+	 * Count the items that precede given position of given vertex in the order of the tree.
+	 * The subtree sizes of the children on the left are added up on the way to the root.
+	 */
+	size_t items_before (vertex * cursor, size_t position) const
+	{
+		size_t count = position;
+		if (!cursor->leaf) {
+			for (size_t i = 0; i <= position; i++) {
+				count += cursor->children[i]->subtree_size;
+			}
+		}
+		for (; cursor->parent != nullptr; cursor = cursor->parent) {
+			count += cursor->index;
+			for (size_t i = 0; i < cursor->index; i++) {
+				count += cursor->parent->children[i]->subtree_size;
+			}
+		}
+		return count;
+	}
+	
+	/**
+	 * Compute the aggregate of the items of a subtree whose keys lie in a range. Children that lie entirely
+	 * in the range contribute their cached aggregates, so only the (at most two) paths to the bounds are visited.
+	 * @param cursor the root of the subtree
+	 * @param lo the lower bound of the range (inclusive), nullptr if the subtree lies entirely above it
+	 * @param hi the upper bound of the range (exclusive), nullptr if the subtree lies entirely below it
+	 * @return the aggregate
+	 */
+	aggregate_type reduce_subtree (vertex * cursor, const key_type * lo, const key_type * hi) const
+	{
+		if (lo == nullptr && hi == nullptr) {
+			return cursor->aggregate;
+		}
+		
+		size_t first = lo != nullptr ? cursor->search(*lo) : 0;
+		size_t last = hi != nullptr ? cursor->search(*hi) : cursor->item_count;
+		if (cursor->leaf) {
+			aggregate_type result = Aggregate::identity();
+			for (size_t i = first; i < last; i++) {
+				result = Aggregate::combine(result, Aggregate::from_item(cursor->keys[i], cursor->values[i]));
+			}
+			return result;
+		}
+		if (first == last) {
+			// Both bounds lie between the same two keys
+			return reduce_subtree(cursor->children[first], lo, hi);
+		}
+		
+		// The child left of the first key in the range only matters if it can hold keys larger than lo
+		aggregate_type result = lo != nullptr && cursor->keys[first] == *lo
+			? Aggregate::identity()
+			: reduce_subtree(cursor->children[first], lo, nullptr);
+		for (size_t i = first; i < last; i++) {
+			result = Aggregate::combine(result, Aggregate::from_item(cursor->keys[i], cursor->values[i]));
+			if (i + 1 < last) {
+				result = Aggregate::combine(result, cursor->children[i + 1]->aggregate);
+			}
+		}
+		return Aggregate::combine(result, reduce_subtree(cursor->children[last], nullptr, hi));
+	}
+	
+	/**
+	 * A function template for the select() method (this method can return an iterator or a const_iterator)
+	 */
+	template <typename iterator>
+	iterator do_select (size_t index) const
+	{
+		if (index >= size_) {
+			return do_end<iterator>();
+		}
+		
+		auto cursor = root;
+		while (!cursor->leaf) {
+			size_t i = 0;
+			// The subtree of the vertex holds the item, so the index runs out before the last child
+			while (index >= cursor->children[i]->subtree_size) {
+				index -= cursor->children[i]->subtree_size;
+				if (index == 0) {
+					return iterator(cursor, i);
+				}
+				index--;
+				i++;
+			}
+			cursor = cursor->children[i];
+		}
+		return iterator(cursor, index);
+	}
+	
+	/**
+	 * A function template for the parallel_for_each() method (the function gets items either through
+	 * an iterator or a const_iterator)
+	 */
+	template <typename iterator, typename F>
+	void do_parallel_for_each (const key_type & lo, const key_type & hi, F & f, size_t threads) const
+	{
+		if (!(lo < hi)) {
+			return;
+		}
+		size_t first = rank(lo);
+		size_t count = rank(hi) - first;
+		size_t parts = std::min(abtree_thread_count(threads), count);
+		
+		// A border that falls into a leaf is moved back to the start of the leaf
+		std::vector<size_t> borders(parts + 1, first + count);
+		borders[0] = first;
+		for (size_t i = 1; i < parts; i++) {
+			size_t border = first + count * i / parts;
+			iterator it = do_select<iterator>(border);
+			if (it.vertex_->leaf) {
+				border -= it.position_;
+			}
+			borders[i] = std::max(border, borders[i - 1]);
+		}
+		
+		abtree_run_parallel(parts, [this, &borders, &f] (size_t i) {
+			iterator it = do_select<iterator>(borders[i]);
+			for (size_t j = borders[i]; j < borders[i + 1]; j++, ++it) {
+				auto item = *it;
+				f(item.first, item.second);
+			}
+		});
+	}
+	
+	/**
+	 * Construct an empty tree with the parameters and the allocator of another tree (see split())
+	 */
+	abtree (const params & p, const block_allocator & alloc): params(p), size_(0), alloc_(alloc)
+	{
+		root = create_vertex(true);
+	}
+	
+public:
+	/**
+	 * The basic constructor
+	 * @param a The minimum number of children for all non-root vertices (has to be at least 2)
+	 * @param b The maximum number of children for all vertices (has to be at least (2 * a) - 1)
+	 * @param alloc The allocator used for the vertices of the tree
+	 * @throws std::invalid_argument if a and b don't meet (a, b)-tree conditions
+	 */
+	abtree (size_t a, size_t b, const Allocator & alloc = Allocator()): params(a, b), size_(0), alloc_(alloc)
+	{
+		root = create_vertex(true);
+	}
+	
+	/**
+	 * The constructor of a tree whose (a, b) parameters are given as template arguments
+	 * @param alloc The allocator used for the vertices of the tree
+	 */
+	explicit abtree (const Allocator & alloc = Allocator()): size_(0), alloc_(alloc)
+	{
+		root = create_vertex(true);
+	}
+	
+	/**
+	 * Construct a tree from a range of items in linear time (see assign())
+	 * @param first, last The range of items
+	 * @param a, b The (a, b) parameters of the tree (see the basic constructor)
+	 * @param fill The desired fill factor of the vertices
+	 * @param alloc The allocator used for the vertices of the tree
+	 */
+	template <typename InputIterator, typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+	abtree (InputIterator first, InputIterator last, size_t a, size_t b, double fill = 1.0, const Allocator & alloc = Allocator())
+		: abtree(a, b, alloc)
+	{
+		assign(first, last, fill);
+	}
+	
+	/**
+	 * Construct a tree with compile-time parameters from a range of items in linear time (see assign())
+	 * @param first, last The range of items
+	 * @param fill The desired fill factor of the vertices
+	 * @param alloc The allocator used for the vertices of the tree
+	 */
+	template <typename InputIterator, typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+	abtree (InputIterator first, InputIterator last, double fill = 1.0, const Allocator & alloc = Allocator())
+		: abtree(alloc)
+	{
+		assign(first, last, fill);
+	}
+	
+	/**
+	 * The move constructor. The other tree is left empty.
+	 */
+	abtree (abtree && other): params(other), root(other.root), size_(other.size_), alloc_(other.alloc_)
+	{
+		other.root = other.create_vertex(true);
+		other.size_ = 0;
+	}
+	
+	abtree (const abtree &) = delete;
+	abtree & operator= (const abtree &) = delete;
+	
+	/**
+	 * The destructor
+	 */
+	~abtree ()
+	{
+		destroy_tree();
+	}
+	
+	/**
+	 * @name Return an iterator to the first (and smallest) item in the tree
+	 */
+	//@{
+	iterator begin ()
+	{
+		return do_begin<iterator>();
+	}
+	
+	const_iterator cbegin () const
+	{
+		return do_begin<const_iterator>();
+	}
+	//@}
+	
+	/**
+	 * @name Return an iterator pointing to the item that would follow the last (and largest) item in the tree
+	 */
+	//@{
+	iterator end ()
+	{
+		return do_end<iterator>();
+	}
+	
+	const_iterator cend () const
+	{
+		return do_end<const_iterator>();
+	}
+	//@}
+	
+	/**
+	 * @name If an item with specified key is present in the tree, return an iterator pointing to it.
+	 * If it is not, return end().
+	 * @param key The key to search for
+	 * @return an iterator pointing to given item or past the end
+	 */
+	//@{
+	iterator find (const TKey & key)
+	{
+		return do_find<iterator>(key, root);
+	}
+	
+	const_iterator find (const TKey & key) const
+	{
+		return do_find<const_iterator>(key, root);
+	}
+	//@}
+	
+	/**
+	 * @name Find an item like find(), but start the search at an iterator that points close to it.
+	 * Only the part of the path to the iterator that doesn't cover the key is climbed before the search,
+	 * so finding an item near the previous one is amortized constant time.
+	 * @param from An iterator pointing to an item of this tree (or end())
+	 * @param key The key to search for
+	 * @return an iterator pointing to given item or past the end
+	 */
+	//@{
+	iterator find (const_iterator from, const key_type & key)
+	{
+		return do_find<iterator>(key, climb(from.vertex_, key));
+	}
+	
+	const_iterator find (const_iterator from, const key_type & key) const
+	{
+		return do_find<const_iterator>(key, climb(from.vertex_, key));
+	}
+	//@}
+	
+	/**
+	 * @name Return a reference to the value of the item with given key if it is present in the tree,
+	 * throw an exception otherwise. The reference is const if the tree has an aggregate.
+	 * @return a reference to the value with specified key
+	 * @throws std::out_of_range if given key is not found
+	 */
+	//@{
+	typename std::conditional<has_aggregate, const TVal &, TVal &>::type at (const TKey & key)
+	{
+		iterator it = find(key);
+		if (it != end()) {
+			return it->second;
+		}
+		throw std::out_of_range("abtree::at");
+	}
+	
+	const TVal & at (const TKey & key) const
+	{
+		const_iterator it = find(key);
+		if (it != end()) {
+			return it->second;
+		}
+		throw std::out_of_range("abtree::at");
+	}
+	//@}
+	
+	/**
+	 * @name Returns an iterator pointing to the smallest item that has a key larger or equal to given key.
+	 * If there's no such item in the tree, returns end().
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	//@{
+	iterator lower_bound (const key_type & key)
+	{
+		return do_lower_bound<iterator>(key, root);
+	}
+	
+	const_iterator lower_bound (const key_type & key) const
+	{
+		return do_lower_bound<const_iterator>(key, root);
+	}
+	//@}
+	
+	/**
+	 * @name Like lower_bound(), but start the search at an iterator that points close to the result
+	 * (see the find() variant with an iterator).
+	 * @param from An iterator pointing to an item of this tree (or end())
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	//@{
+	iterator lower_bound (const_iterator from, const key_type & key)
+	{
+		return do_lower_bound<iterator>(key, climb(from.vertex_, key));
+	}
+	
+	const_iterator lower_bound (const_iterator from, const key_type & key) const
+	{
+		return do_lower_bound<const_iterator>(key, climb(from.vertex_, key));
+	}
+	//@}
+	
+	/**
+	 * @name Returns an iterator pointing to the smallest item that has a key larger than given key.
+	 * If there's no such item in the tree, returns end().
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	//@{
+	iterator upper_bound (const key_type & key)
+	{
+		return do_upper_bound<iterator>(key);
+	}
+	
+	const_iterator upper_bound (const key_type & key) const
+	{
+		return do_upper_bound<const_iterator>(key);
+	}
+	//@}
+	
+	/**
+	 * @name Find the items with keys from a batch, like calling find() for each of them, but faster.
+	 * The lookups are interleaved, so the memory accesses of different lookups overlap (see do_batch()).
+	 * A batch sorted by keys is faster still, as neighbouring lookups share the upper parts of their paths.
+	 * @param first, last The range of keys
+	 * @param out An output iterator the resulting iterators are written to (pointing to the items or end()),
+	 * one for each key in the order of the keys
+	 * @return The output iterator past the last result
+	 */
+	//@{
+	template <typename InputIterator, typename OutputIterator>
+	OutputIterator find_batch (InputIterator first, InputIterator last, OutputIterator out)
+	{
+		return do_batch<iterator>(first, last, out, false);
+	}
+	
+	template <typename InputIterator, typename OutputIterator>
+	OutputIterator find_batch (InputIterator first, InputIterator last, OutputIterator out) const
+	{
+		return do_batch<const_iterator>(first, last, out, false);
+	}
+	//@}
+	
+	/**
+	 * @name Find the lower bounds of keys from a batch, like calling lower_bound() for each of them
+	 * (see find_batch())
+	 * @param first, last The range of keys
+	 * @param out An output iterator the resulting iterators are written to, one for each key in the order of the keys
+	 * @return The output iterator past the last result
+	 */
+	//@{
+	template <typename InputIterator, typename OutputIterator>
+	OutputIterator lower_bound_batch (InputIterator first, InputIterator last, OutputIterator out)
+	{
+		return do_batch<iterator>(first, last, out, true);
+	}
+	
+	template <typename InputIterator, typename OutputIterator>
+	OutputIterator lower_bound_batch (InputIterator first, InputIterator last, OutputIterator out) const
+	{
+		return do_batch<const_iterator>(first, last, out, true);
+	}
+	//@}
+	
+	/**
+	 * Count the items whose keys are smaller than given key, that is, the position of lower_bound(key).
+	 * Every vertex knows the number of items in its subtree, so it takes a single descent.
+	 * @param key The key
+	 * @return The number of smaller keys in the tree
+	 */
+	size_t rank (const key_type & key) const
+	{
+		size_t count = 0;
+		auto cursor = root;
+		while (true) {
+			size_t i = cursor->search(key);
+			count += i;
+			if (cursor->leaf) {
+				return count;
+			}
+			for (size_t j = 0; j < i; j++) {
+				count += cursor->children[j]->subtree_size;
+			}
+			if (i < cursor->item_count && cursor->keys[i] == key) {
+				return count + cursor->children[i]->subtree_size;
+			}
+			cursor = cursor->children[i];
+		}
+	}
+	
+	/**
+	 * Get the position of the item an iterator points to in the order of the tree
+	 * (the position of end() is size()). Takes O(log n), unlike counting the steps from begin().
+	 * @param it An iterator pointing to an item of this tree (or end())
+	 * @return The number of items that precede the item
+	 */
+	size_t rank (const_iterator it) const
+	{
+		return items_before(it.vertex_, it.position_);
+	}
+	
+	/**
+	 * @name Return an iterator pointing to the item at given position in the order of the tree
+	 * (the index-th smallest item, counting from 0). If the index is out of range, returns end().
+	 * @param index The position of the item
+	 * @return An iterator pointing to desired item or end()
+	 */
+	//@{
+	iterator select (size_t index)
+	{
+		return do_select<iterator>(index);
+	}
+	
+	const_iterator select (size_t index) const
+	{
+		return do_select<const_iterator>(index);
+	}
+	//@}
+	
+	/**
+	 * Count the items whose keys lie in the range [lo, hi) in O(log n)
+	 * @param lo The lower bound of the range (inclusive)
+	 * @param hi The upper bound of the range (exclusive)
+	 * @return The number of items in the range (0 if hi isn't larger than lo)
+	 */
+	size_t count_range (const key_type & lo, const key_type & hi) const
+	{
+		if (!(lo < hi)) {
+			return 0;
+		}
+		return rank(hi) - rank(lo);
+	}
+	
+	/**
+	 * Get the aggregate of all items in the tree (see the Aggregate template parameter) in O(1)
+	 */
+	aggregate_type reduce () const
+	{
+		return root->aggregate;
+	}
+	
+	/**
+	 * Get the aggregate of the items whose keys lie in the range [lo, hi) (see the Aggregate template parameter).
+	 * Only O(log n) vertices are visited, the subtrees between them contribute their cached aggregates.
+	 * @param lo The lower bound of the range (inclusive)
+	 * @param hi The upper bound of the range (exclusive)
+	 * @return The aggregate of the range (the identity if hi isn't larger than lo)
+	 */
+	aggregate_type reduce (const key_type & lo, const key_type & hi) const
+	{
+		if (!(lo < hi)) {
+			return Aggregate::identity();
+		}
+		return reduce_subtree(root, &lo, &hi);
+	}
+	
+	/**
+	 * The number of increments needed to get from one iterator to another, like std::distance(),
+	 * which has to walk the items because the iterators aren't random access. This takes O(log n).
+	 * @param first, last Iterators pointing to items of this tree (or end())
+	 * @return The distance, negative if last precedes first
+	 */
+	std::ptrdiff_t distance (const_iterator first, const_iterator last) const
+	{
+		return std::ptrdiff_t(rank(last)) - std::ptrdiff_t(rank(first));
+	}
+	
+	/**
+	 * @name Call a function on every item whose key lies in the range [lo, hi), using more threads.
+	 * The range is divided into parts of about the same number of items, one for each thread. The borders
+	 * of the parts are found by their positions (see select()), which only takes O(log n) steps each,
+	 * since every vertex knows the size of its subtree. A border that falls into a leaf is moved back
+	 * to the start of the leaf, so that every leaf is walked by a single thread and no two threads
+	 * write values to the same vertex. Each thread then walks its part with an iterator.
+	 * The calls run concurrently, so the function has to be safe to call from more threads at once.
+	 * It may change the values of the items (unless the tree has an aggregate), but not the tree itself.
+	 * @param lo The lower bound of the range (inclusive)
+	 * @param hi The upper bound of the range (exclusive)
+	 * @param f A function that takes a const key_type & and a mapped_type & (a const one for a const tree
+	 * or a tree with an aggregate)
+	 * @param threads The number of threads, 0 for the number of hardware threads
+	 */
+	//@{
+	template <typename F>
+	void parallel_for_each (const key_type & lo, const key_type & hi, F f, size_t threads = 0)
+	{
+		do_parallel_for_each<iterator>(lo, hi, f, threads);
+	}
+	
+	template <typename F>
+	void parallel_for_each (const key_type & lo, const key_type & hi, F f, size_t threads = 0) const
+	{
+		do_parallel_for_each<const_iterator>(lo, hi, f, threads);
+	}
+	//@}
+	
+	/**
+	 * @name Inserts a new item into the tree. If there's already an item with the same key in the tree,
+	 * its value gets replaced by the value of the new item.
+	 * @param pair The item that gets copied (or moved) into the tree
+	 * @return An iterator pointing to the inserted item and whether a new item has been added
+	 */
+	//@{
+	std::pair<iterator, bool> insert (const value_type & pair)
+	{
+		vertex * finger;
+		return assign_from(root, finger, pair.first, pair.second);
+	}
+	
+	std::pair<iterator, bool> insert (value_type && pair)
+	{
+		vertex * finger;
+		return assign_from(root, finger, pair.first, std::move(pair.second));
+	}
+	//@}
+	
+	/**
+	 * @name Insert a new item like insert(), but start the search for its position at given hint.
+	 * If the hint points close to the position (e.g. to the item that will follow the new one),
+	 * the insertion takes amortized constant time (splits aside) instead of a descent from the root.
+	 * A poor hint only makes the search longer.
+	 * @param hint An iterator pointing to an item of this tree (or end())
+	 * @param pair The item that gets copied (or moved) into the tree
+	 * @return An iterator pointing to the inserted item
+	 */
+	//@{
+	iterator insert (const_iterator hint, const value_type & pair)
+	{
+		vertex * finger;
+		return assign_from(climb(hint.vertex_, pair.first), finger, pair.first, pair.second).first;
+	}
+	
+	iterator insert (const_iterator hint, value_type && pair)
+	{
+		vertex * finger;
+		return assign_from(climb(hint.vertex_, pair.first), finger, pair.first, std::move(pair.second)).first;
+	}
+	//@}
+	
+	/**
+	 * Construct an item from given arguments and insert it (see insert()).
+	 * The key and the value are constructed once and then moved into the tree.
+	 * @param args The arguments passed to the constructor of value_type
+	 * @return An iterator pointing to the inserted item and whether a new item has been added
+	 */
+	template <typename... Args>
+	std::pair<iterator, bool> emplace (Args &&... args)
+	{
+		std::pair<key_type, mapped_type> item(std::forward<Args>(args)...);
+		vertex * finger;
+		return assign_from(root, finger, std::move(item.first), std::move(item.second));
+	}
+	
+	/**
+	 * Construct an item from given arguments and insert it using a hint (see the insert() variant with a hint)
+	 * @param hint An iterator pointing to an item of this tree (or end())
+	 * @param args The arguments passed to the constructor of value_type
+	 * @return An iterator pointing to the inserted item
+	 */
+	template <typename... Args>
+	iterator emplace_hint (const_iterator hint, Args &&... args)
+	{
+		std::pair<key_type, mapped_type> item(std::forward<Args>(args)...);
+		vertex * finger;
+		return assign_from(climb(hint.vertex_, item.first), finger, std::move(item.first), std::move(item.second)).first;
+	}
+	
+	/**
+	 * @name If there's no item with given key in the tree, insert one whose value is constructed in place
+	 * from given arguments. Otherwise, nothing happens (the arguments aren't moved from).
+	 * @param key The key of the item
+	 * @param args The arguments passed to the constructor of mapped_type
+	 * @return An iterator pointing to the item with given key and whether it has been inserted
+	 */
+	//@{
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace (const key_type & key, Args &&... args)
+	{
+		vertex * finger;
+		return emplace_from(root, finger, key, std::forward<Args>(args)...);
+	}
+	
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace (key_type && key, Args &&... args)
+	{
+		vertex * finger;
+		return emplace_from(root, finger, std::move(key), std::forward<Args>(args)...);
+	}
+	//@}
+	
+	/**
+	 * @name Insert an item with given key and value, or assign the value to the item if the key is already present
+	 * @param key The key of the item
+	 * @param value The value of the item
+	 * @return An iterator pointing to the item with given key and whether it has been inserted
+	 */
+	//@{
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign (const key_type & key, M && value)
+	{
+		vertex * finger;
+		return assign_from(root, finger, key, std::forward<M>(value));
+	}
+	
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign (key_type && key, M && value)
+	{
+		vertex * finger;
+		return assign_from(root, finger, std::move(key), std::forward<M>(value));
+	}
+	//@}
+	
+	/**
+	 * @name Return a reference to the value of the item with given key.
+	 * If it isn't present in the tree, an item with a value-initialized value is inserted first.
+	 * Not available in a tree with an aggregate, which couldn't follow changes made through the reference.
+	 * @param key The key of the item
+	 * @return a reference to the value with specified key
+	 */
+	//@{
+	mapped_type & operator[] (const key_type & key)
+	{
+		static_assert(!has_aggregate, "values of a tree with an aggregate can only be changed by insert_or_assign() or update()");
+		return try_emplace(key).first->second;
+	}
+	
+	mapped_type & operator[] (key_type && key)
+	{
+		static_assert(!has_aggregate, "values of a tree with an aggregate can only be changed by insert_or_assign() or update()");
+		return try_emplace(std::move(key)).first->second;
+	}
+	//@}
+	
+	/**
+	 * Change the value of an item in place and recompute the aggregates of the subtrees that contain it
+	 * in O(log n) time. This is how values are changed in place in a tree with an aggregate.
+	 * @param it An iterator pointing to the item
+	 * @param f A function that takes a mapped_type &
+	 */
+	template <typename F>
+	void update (const_iterator it, F f)
+	{
+		f(it.vertex_->values[it.position_]);
+		update_aggregates(it.vertex_);
+	}
+	
+	/**
+	 * Insert a batch of items sorted by their keys. Instead of starting each search at the root,
+	 * it starts at the lowest vertex on the path to the previous item that covers the next key,
+	 * so consecutive items that land in the same or neighbouring leaves are inserted without
+	 * a full descent. All the items that belong to the same leaf are merged into it at once and
+	 * the leaf is split into as many leaves as needed in one go, instead of one split per b / 2 items.
+	 * Items with equal keys replace each other like with insert().
+	 * Items out of order are still inserted correctly, they just need a longer climb.
+	 * @param first, last The range of items
+	 */
+	template <typename InputIterator>
+	void insert_sorted (InputIterator first, InputIterator last)
+	{
+		vertex * finger = root;
+		std::vector<std::pair<key_type, mapped_type> > batch;
+		std::vector<vertex *> leaves;
+		while (first != last) {
+			vertex * cursor = climb(finger, first->first);
+			// Keys in inner vertices are replaced on the way down
+			size_t i = cursor->search(first->first);
+			while (!cursor->leaf && !(i < cursor->item_count && cursor->keys[i] == first->first)) {
+				cursor = cursor->children[i];
+				cursor->prefetch(b);
+				i = cursor->search(first->first);
+			}
+			if (cursor->leaf) {
+				finger = insert_group(cursor, first, last, batch, leaves);
+			} else {
+				cursor->values[i] = first->second;
+				update_aggregates(cursor);
+				finger = cursor;
+				++first;
+			}
+		}
+	}
+	
+	/**
+	 * Replace the contents of the tree with a range of items. The tree is built bottom-up in linear time,
+	 * which is much faster than inserting the items one by one.
+	 * If the keys in the range aren't strictly increasing (or the range can only be traversed once),
+	 * the items are copied and sorted first. When more items have the same key, the last one is kept.
+	 * @param first, last The range of items (pairs of a key and a value)
+	 * @param fill The desired fill factor of the vertices, between 0 (exclusive) and 1.
+	 * Vertices get (b - 1) * fill items, but never less than the (a, b)-tree conditions require.
+	 * A lower value leaves room for subsequent insertions without splitting.
+	 * @throws std::invalid_argument if fill is out of range
+	 */
+	template <typename InputIterator>
+	void assign (InputIterator first, InputIterator last, double fill = 1.0)
+	{
+		build_range(first, last, fill_items(fill), typename std::iterator_traits<InputIterator>::iterator_category());
+	}
+	
+	/**
+	 * Replace the contents of the tree with a range of items like assign(), using more threads.
+	 * Unless the keys in the range are strictly increasing, the items are copied and sorted in parallel first.
+	 * Then the upper levels of the tree are built and the subtrees below them are built by the threads at once.
+	 * The result is the same tree that assign() builds.
+	 * The allocator has to be safe to use from more threads at once (see abtree_concurrent_allocator).
+	 * The default one is, abtree_pool_allocator isn't and is rejected at compile time.
+	 * @param first, last The range of items (pairs of a key and a value)
+	 * @param threads The number of threads, 0 for the number of hardware threads
+	 * @param fill The desired fill factor of the vertices (see assign())
+	 * @throws std::invalid_argument if fill is out of range
+	 */
+	template <typename RandomAccessIterator>
+	void assign_parallel (RandomAccessIterator first, RandomAccessIterator last, size_t threads = 0, double fill = 1.0)
+	{
+		static_assert(abtree_concurrent_allocator<Allocator>::value, "assign_parallel() needs an allocator that can be used from more threads at once");
+		typedef typename std::iterator_traits<RandomAccessIterator>::value_type item_type;
+		size_t items = fill_items(fill);
+		threads = abtree_thread_count(threads);
+		size_t count = std::distance(first, last);
+		
+		// Every thread checks a part of the range, including the pair of items across its end
+		std::vector<char> sorted(threads);
+		abtree_run_parallel(threads, [first, count, threads, &sorted] (size_t i) {
+			RandomAccessIterator begin = first + count * i / threads;
+			RandomAccessIterator end = first + std::min(count * (i + 1) / threads + 1, count);
+			sorted[i] = std::adjacent_find(begin, end, [] (const item_type & x, const item_type & y) {
+				return !(x.first < y.first);
+			}) == end;
+		});
+		
+		if (std::find(sorted.begin(), sorted.end(), false) == sorted.end()) {
+			build_parallel(first, count, items, threads);
+		} else {
+			build_unsorted_parallel(first, last, items, threads);
+		}
+	}
+	
+	/**
+	 * @name Replace the contents of the tree with the union, the intersection or the difference of two trees
+	 * in O(m + n) time. Both trees are walked in the order of keys at once and the result is built bottom-up
+	 * like in assign(), instead of inserting the items of one tree into the other one by one.
+	 * Items whose keys are present in both trees are copied from the first tree.
+	 * Either of the trees may be this tree.
+	 * @param x, y The trees
+	 * @param fill The desired fill factor of the vertices (see assign())
+	 * @throws std::invalid_argument if fill is out of range
+	 */
+	//@{
+	void assign_union (const abtree & x, const abtree & y, double fill = 1.0)
+	{
+		assign_merged(abtree_union, x, y, fill);
+	}
+	
+	void assign_intersection (const abtree & x, const abtree & y, double fill = 1.0)
+	{
+		assign_merged(abtree_intersection, x, y, fill);
+	}
+	
+	void assign_difference (const abtree & x, const abtree & y, double fill = 1.0)
+	{
+		assign_merged(abtree_difference, x, y, fill);
+	}
+	//@}
+	
+	/**
+	 * @name Replace the contents of the tree with the union, the intersection or the difference of two trees
+	 * like assign_union() and the others, using more threads. The key range is cut into one part per thread,
+	 * the threads merge their parts into separate trees at once and the trees are joined (see join()).
+	 * The result has the same items as the serial variant, the vertices along the joins may be less full.
+	 * The allocator has to be safe to use from more threads at once (see assign_parallel()).
+	 * @param x, y The trees
+	 * @param threads The number of threads, 0 for the number of hardware threads
+	 * @param fill The desired fill factor of the vertices (see assign())
+	 * @throws std::invalid_argument if fill is out of range
+	 */
+	//@{
+	void assign_union_parallel (const abtree & x, const abtree & y, size_t threads = 0, double fill = 1.0)
+	{
+		static_assert(abtree_concurrent_allocator<Allocator>::value, "assign_union_parallel() needs an allocator that can be used from more threads at once");
+		assign_merged_parallel(abtree_union, x, y, fill, threads);
+	}
+	
+	void assign_intersection_parallel (const abtree & x, const abtree & y, size_t threads = 0, double fill = 1.0)
+	{
+		static_assert(abtree_concurrent_allocator<Allocator>::value, "assign_intersection_parallel() needs an allocator that can be used from more threads at once");
+		assign_merged_parallel(abtree_intersection, x, y, fill, threads);
+	}
+	
+	void assign_difference_parallel (const abtree & x, const abtree & y, size_t threads = 0, double fill = 1.0)
+	{
+		static_assert(abtree_concurrent_allocator<Allocator>::value, "assign_difference_parallel() needs an allocator that can be used from more threads at once");
+		assign_merged_parallel(abtree_difference, x, y, fill, threads);
+	}
+	//@}
+	
+	/**
+	 * Erase the item with given key from the tree. If such item isn't present in the tree, don't do anything.
+	 * If the deletion causes a vertex to have less than a children, refill_vertex is called on it.
+	 * @param key The key of the item to be erased
+	 */
+	void erase (const TKey & key)
+	{
+		erase_from(root, key);
+	}
+	
+	/**
+	 * Erase the items with keys from lo (inclusive) to hi (exclusive). The range is cut out of the tree
+	 * by two splits and the rest is joined back (see split() and join()), so whole subtrees are detached
+	 * at once and only the vertices along the borders of the range are rebalanced. Apart from destroying
+	 * the erased items, it takes O(log n) time.
+	 * @param lo, hi The range of keys
+	 */
+	void erase_range (const key_type & lo, const key_type & hi)
+	{
+		if (!(lo < hi)) {
+			return;
+		}
+		abtree middle = split(lo);
+		abtree rest = middle.split(hi);
+		join(rest);
+	}
+	
+	/**
+	 * Erase the items in the range [first, last) (see erase_range())
+	 * @param first, last The range of items
+	 * @return an iterator pointing to the item that followed the erased range
+	 */
+	iterator erase (const_iterator first, const_iterator last)
+	{
+		// The keys are copied, the items they belong to are moved around by the splits
+		if (last == cend()) {
+			if (first != last) {
+				key_type lo = first->first;
+				abtree rest = split(lo);
+			}
+			return end();
+		}
+		key_type hi = last->first;
+		if (first != last) {
+			key_type lo = first->first;
+			erase_range(lo, hi);
+		}
+		return find(hi);
+	}
+	
+	/**
+	 * Erase the items with keys from a sorted batch (see insert_sorted()).
+	 * All the keys that belong to the same leaf are removed in a single pass over it and the leaf
+	 * is refilled at most once. Keys in inner vertices are erased one by one.
+	 * Keys that aren't present in the tree are skipped.
+	 * @param first, last The range of keys
+	 */
+	template <typename InputIterator>
+	void erase_sorted (InputIterator first, InputIterator last)
+	{
+		vertex * finger = root;
+		while (first != last) {
+			const key_type & key = *first;
+			vertex * cursor = climb(finger, key);
+			size_t i = cursor->search(key);
+			while (!cursor->leaf && !(i < cursor->item_count && cursor->keys[i] == key)) {
+				cursor = cursor->children[i];
+				i = cursor->search(key);
+			}
+			if (cursor->leaf) {
+				finger = erase_group(cursor, first, last);
+			} else {
+				finger = erase_from(cursor, key);
+				++first;
+			}
+		}
+	}
+	
+	/**
+	 * Split the tree in two in O(log n) time. The items with keys larger than or equal to given key
+	 * are moved to a new tree, the smaller ones stay in this tree. Only the vertices along the search path
+	 * for the key are divided, the subtrees hanging off the path are moved as they are.
+	 * @param key The key where the tree is split
+	 * @return the tree with the larger keys, which has the parameters and the allocator of this tree
+	 */
+	abtree split (const key_type & key)
+	{
+		abtree upper(static_cast<const params &>(*this), alloc_);
+		if (size_ == 0) {
+			return upper;
+		}
+		
+		// In case no items are left, this tree will need an empty root
+		vertex * empty = create_vertex(true);
+		vertex * lower_root;
+		vertex * upper_root;
+		size_t lower_height;
+		size_t upper_height;
+		split_subtree(root, height(root), key, lower_root, lower_height, upper_root, upper_height);
+		
+		if (upper_root != nullptr) {
+			upper.destroy_vertex(upper.root);
+			upper.root = upper_root;
+			upper.size_ = upper_root->subtree_size;
+		}
+		if (lower_root != nullptr) {
+			destroy_vertex(empty);
+		} else {
+			lower_root = empty;
+		}
+		root = lower_root;
+		size_ = lower_root->subtree_size;
+		return upper;
+	}
+	
+	/**
+	 * Move all items of another tree to the end of this tree in O(log n) time. The smallest item
+	 * of the other tree separates the two trees, whose roots are joined at the level where their
+	 * heights match (see split()). The other tree is left empty.
+	 * @param other The other tree. All of its keys have to be larger than the keys in this tree,
+	 * it has to have the same (a, b) parameters and an allocator equal to the allocator of this tree.
+	 * @throws std::invalid_argument if the keys of the trees overlap or the trees aren't compatible
+	 */
+	void join (abtree & other)
+	{
+		if (other.size_ == 0) {
+			return;
+		}
+		if (a != other.a || b != other.b || !(alloc_ == other.alloc_) || &other == this) {
+			throw std::invalid_argument("other");
+		}
+		
+		vertex * first = other.root;
+		while (!first->leaf) {
+			first = first->children[0];
+		}
+		if (size_ > 0) {
+			vertex * last = root;
+			while (!last->leaf) {
+				last = last->children[last->item_count];
+			}
+			if (!(last->keys[last->item_count - 1] < first->keys[0])) {
+				throw std::invalid_argument("other");
+			}
+		}
+		
+		vertex * empty = create_vertex(true);
+		
+		// Take the smallest item out of the other tree, it will separate the trees
+		key_type key(std::move(first->keys[0]));
+		mapped_type value(std::move(first->values[0]));
+		first->destroy_item(0);
+		for (size_t j = 1; j < first->item_count; j++) {
+			first->move_item(j, first, j - 1);
+		}
+		first->item_count--;
+		other.shrink_subtree_sizes(first);
+		if (first != other.root && first->item_count < a - 1) {
+			other.refill_vertex(first->parent, first->index);
+		}
+		
+		vertex * right = other.root;
+		if (right->item_count == 0) {
+			destroy_vertex(right);
+			right = nullptr;
+		}
+		other.root = empty;
+		other.size_ = 0;
+		
+		vertex * left = root;
+		if (size_ == 0) {
+			destroy_vertex(left);
+			left = nullptr;
+		}
+		size_t joined_height;
+		root = join_subtrees(left, left != nullptr ? height(left) : 0, std::move(key), std::move(value), right, right != nullptr ? height(right) : 0, joined_height);
+		size_ = root->subtree_size;
+	}
+	
+	/**
+	 * Get a copy of the allocator the tree was constructed with
+	 */
+	allocator_type get_allocator () const
+	{
+		return allocator_type(alloc_);
 	}
 	
 	/**
@@ -574,23 +2677,23 @@ public:
 		}
 		size_t i;
 		for (i = 0; i < cursor->item_count; i++) {
-			if (cursor->children[i] != nullptr) {
+			if (!cursor->leaf) {
 				dump(cursor->children[i], indent + 1);
 			}
 			for (size_t j = 0; j < 4 * indent; j++) {
 				std::cout << " ";
 			}
-			std::cout << "*Key: " << cursor->items[i]->first << std::endl;
+			std::cout << "*Key: " << cursor->keys[i] << std::endl;
 			
 		}
-		if (cursor->children[i] != nullptr) {
+		if (!cursor->leaf) {
 			dump(cursor->children[cursor->item_count], indent + 1);
 		}
 	}
 	
 	TKey get_root_key ()
 	{
-		return root->items[0]->first;
+		return root->keys[0];
 	}
 };
 
@@ -0,0 +1,118 @@
+#ifndef _ABTREE_AGGREGATE_HPP_
+#define _ABTREE_AGGREGATE_HPP_
+
+#include <limits>
+#include <algorithm>
+
+/**
+ * Aggregates that abtree can maintain for every subtree (see abtree::reduce()).
+ * An aggregate is a monoid over the items of the tree, described by a class with static members:
+ * - value_type, the type of the aggregated values
+ * - identity(), the neutral element
+ * - from_item(key, value), the aggregate of a single item
+ * - combine(x, y), which has to be associative (x comes from smaller keys than y, so it doesn't have
+ *   to be commutative)
+ */
+
+/**
+ * The default aggregate, which doesn't compute anything. Vertices don't spend any time on it
+ * and its value doesn't take any space beyond padding.
+ */
+struct abtree_no_aggregate
+{
+	struct value_type
+	{};
+	
+	static value_type identity ()
+	{
+		return value_type();
+	}
+	
+	template <typename K, typename V>
+	static value_type from_item (const K &, const V &)
+	{
+		return value_type();
+	}
+	
+	static value_type combine (const value_type &, const value_type &)
+	{
+		return value_type();
+	}
+};
+
+/**
+ * The sum of the values
+ */
+template <typename T>
+struct abtree_sum
+{
+	typedef T value_type;
+	
+	static T identity ()
+	{
+		return T();
+	}
+	
+	template <typename K, typename V>
+	static T from_item (const K &, const V & value)
+	{
+		return value;
+	}
+	
+	static T combine (const T & x, const T & y)
+	{
+		return x + y;
+	}
+};
+
+/**
+ * The smallest value (the identity is the largest value of T)
+ */
+template <typename T>
+struct abtree_min
+{
+	typedef T value_type;
+	
+	static T identity ()
+	{
+		return std::numeric_limits<T>::max();
+	}
+	
+	template <typename K, typename V>
+	static T from_item (const K &, const V & value)
+	{
+		return value;
+	}
+	
+	static T combine (const T & x, const T & y)
+	{
+		return std::min(x, y);
+	}
+};
+
+/**
+ * The largest value (the identity is the lowest value of T)
+ */
+template <typename T>
+struct abtree_max
+{
+	typedef T value_type;
+	
+	static T identity ()
+	{
+		return std::numeric_limits<T>::lowest();
+	}
+	
+	template <typename K, typename V>
+	static T from_item (const K &, const V & value)
+	{
+		return value;
+	}
+	
+	static T combine (const T & x, const T & y)
+	{
+		return std::max(x, y);
+	}
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef _ABTREE_ALLOCATOR_HPP_
+#define _ABTREE_ALLOCATOR_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+#include <type_traits>
+
+/**
+ * The default allocator of the abtree container. It behaves like std::allocator, except that
+ * it honours the alignment of over-aligned types (such as the cache-line-sized blocks vertices
+ * are allocated in) even before C++17.
+ */
+template <typename T>
+class abtree_aligned_allocator
+{
+public:
+	typedef T value_type;
+	
+	abtree_aligned_allocator ()
+	{}
+	
+	template <typename U>
+	abtree_aligned_allocator (const abtree_aligned_allocator<U> &)
+	{}
+	
+	/**
+	 * Allocate memory for n objects
+	 * @throws std::bad_alloc if the memory can't be allocated
+	 */
+	T * allocate (size_t n)
+	{
+		if (alignof(T) <= alignof(std::max_align_t)) {
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+		
+		void * block;
+		if (posix_memalign(&block, alignof(T), n * sizeof(T)) != 0) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T *>(block);
+	}
+	
+	/**
+	 * Release memory obtained from allocate()
+	 */
+	void deallocate (T * p, size_t)
+	{
+		if (alignof(T) <= alignof(std::max_align_t)) {
+			::operator delete(p);
+		} else {
+			free(p);
+		}
+	}
+};
+
+template <typename T, typename U>
+bool operator== (const abtree_aligned_allocator<T> &, const abtree_aligned_allocator<U> &)
+{
+	return true;
+}
+
+template <typename T, typename U>
+bool operator!= (const abtree_aligned_allocator<T> &, const abtree_aligned_allocator<U> &)
+{
+	return false;
+}
+
+/**
+ * A pool of memory blocks shared by all copies (and rebinds) of an abtree_pool_allocator.
+ * Blocks of each size are carved from larger slabs. Released blocks are kept on a free list
+ * for their size, so that vertices freed by merges are reused by later splits without going
+ * through the global heap. The slabs are only returned when the pool is destroyed.
+ * The pool isn't thread-safe, just like the containers that use it.
+ */
+class abtree_pool
+{
+public:
+	/**
+	 * The size of a slab (unless a single block is larger)
+	 */
+	static const size_t slab_size = 64 * 1024;
+	
+	/**
+	 * The alignment of slabs. Blocks whose size is a multiple of this are aligned to it as well.
+	 */
+	static const size_t slab_alignment = 64;
+	
+	/**
+	 * Block sizes are rounded up to a multiple of this
+	 */
+	static const size_t granularity = 16;
+	
+	abtree_pool ()
+	{}
+	
+	abtree_pool (const abtree_pool &) = delete;
+	abtree_pool & operator= (const abtree_pool &) = delete;
+	
+	/**
+	 * The destructor. Releases all slabs, the blocks carved from them mustn't be used anymore.
+	 */
+	~abtree_pool ()
+	{
+		for (void * slab: slabs_) {
+			free(slab);
+		}
+	}
+	
+	/**
+	 * Get a block of given size, either from the free list or from a new slab
+	 * @throws std::bad_alloc if a new slab can't be allocated
+	 */
+	void * allocate (size_t size)
+	{
+		size_class & c = get_class(size);
+		if (c.free == nullptr) {
+			refill(c);
+		}
+		free_block * block = c.free;
+		c.free = block->next;
+		return block;
+	}
+	
+	/**
+	 * Put a block obtained from allocate() on the free list for its size
+	 */
+	void deallocate (void * p, size_t size)
+	{
+		size_class & c = get_class(size);
+		free_block * block = static_cast<free_block *>(p);
+		block->next = c.free;
+		c.free = block;
+	}
+	
+private:
+	struct free_block
+	{
+		free_block * next;
+	};
+	
+	struct size_class
+	{
+		size_t size;
+		free_block * free;
+	};
+	
+	/**
+	 * The size classes in use. A tree only uses a couple of block sizes, so a linear search is enough.
+	 */
+	std::vector<size_class> classes_;
+	std::vector<void *> slabs_;
+	
+	/**
+	 * Find (or create) the size class for blocks of given size.
+	 * Empty blocks get the smallest class, they still need room for the free list link.
+	 */
+	size_class & get_class (size_t size)
+	{
+		size = size == 0 ? granularity : (size + granularity - 1) / granularity * granularity;
+		for (size_class & c: classes_) {
+			if (c.size == size) {
+				return c;
+			}
+		}
+		classes_.push_back(size_class{size, nullptr});
+		return classes_.back();
+	}
+	
+	/**
+	 * Allocate a new slab and put all the blocks it consists of on the free list
+	 */
+	void refill (size_class & c)
+	{
+		size_t count = c.size < slab_size ? slab_size / c.size : 1;
+		void * slab;
+		if (posix_memalign(&slab, slab_alignment, count * c.size) != 0) {
+			throw std::bad_alloc();
+		}
+		slabs_.push_back(slab);
+		
+		char * block = static_cast<char *>(slab);
+		for (size_t i = 0; i < count; i++, block += c.size) {
+			free_block * head = reinterpret_cast<free_block *>(block);
+			head->next = c.free;
+			c.free = head;
+		}
+	}
+};
+
+/**
+ * An allocator that serves memory from an abtree_pool. It's meant for containers that allocate
+ * and free many objects of a few fixed sizes, such as the vertices of an abtree (or the nodes of std::map).
+ * A default-constructed allocator creates a new pool, copies and rebinds share it.
+ */
+template <typename T>
+class abtree_pool_allocator
+{
+public:
+	typedef T value_type;
+	
+	abtree_pool_allocator (): pool_(std::make_shared<abtree_pool>())
+	{}
+	
+	template <typename U>
+	abtree_pool_allocator (const abtree_pool_allocator<U> & other): pool_(other.pool_)
+	{}
+	
+	T * allocate (size_t n)
+	{
+		return static_cast<T *>(pool_->allocate(n * sizeof(T)));
+	}
+	
+	void deallocate (T * p, size_t n)
+	{
+		pool_->deallocate(p, n * sizeof(T));
+	}
+	
+	/**
+	 * Two allocators are equal when they share the same pool
+	 */
+	template <typename U>
+	bool operator== (const abtree_pool_allocator<U> & other) const
+	{
+		return pool_ == other.pool_;
+	}
+	
+	template <typename U>
+	bool operator!= (const abtree_pool_allocator<U> & other) const
+	{
+		return pool_ != other.pool_;
+	}
+	
+private:
+	template <typename U>
+	friend class abtree_pool_allocator;
+	
+	std::shared_ptr<abtree_pool> pool_;
+};
+
+/**
+ * Whether an allocator can be used from more threads at once (see abtree::assign_parallel()).
+ * Allocators are expected to be, except for abtree_pool_allocator, whose pool isn't locked.
+ */
+template <typename Allocator>
+struct abtree_concurrent_allocator: std::true_type
+{};
+
+template <typename T>
+struct abtree_concurrent_allocator<abtree_pool_allocator<T> >: std::false_type
+{};
+
+#endif
@@ -3,8 +3,17 @@
 #include <map>
 #include <algorithm>
 #include <cstdlib>
+#include <cstdio>
 
 #include "abtree.hpp"
+#include "bplus.hpp"
+#include "persistent.hpp"
+#include "mapped.hpp"
+
+/**
+ * Results of the measured operations are stored here so that the compiler can't optimize them away
+ */
+volatile size_t sink;
 
 template <typename F>
 double measure_time(F f)
@@ -33,19 +42,34 @@ void run_test (C & container, const std::vector<T> & data)
 	print_result("Insert", t);
 	
 	t = measure_time([&container, &data] () {
+		size_t found = 0;
 		for (T i: data) {
-			container.find(i);
+			found += container.find(i) != container.end();
 		}
+		sink = found;
 	});
 	print_result("Find", t);
 	
 	t = measure_time([&container] () {
+		size_t visited = 0;
 		for (auto it = container.begin(); it != container.end(); ++it) {
-			
+			visited += it->second;
 		}
+		sink = visited;
 	});
 	print_result("Traversal", t);
 	
+	t = measure_time([&container, &data] () {
+		size_t half = data.size() / 2;
+		for (size_t i = 0; i < half; i++) {
+			container.erase(data[i]);
+		}
+		for (size_t i = 0; i < half; i++) {
+			container.insert(std::make_pair(data[i], true));
+		}
+	});
+	print_result("Churn", t);
+	
 	t = measure_time([&container, &data] () {
 		for (T i: data) {
 			container.erase(i);
@@ -54,12 +78,259 @@ void run_test (C & container, const std::vector<T> & data)
 	print_result("Delete", t);
 }
 
+/**
+ * Measure building a tree from sorted data at once
+ */
+template <typename T, typename C>
+void run_bulk_load (C & container, const std::vector<T> & data)
+{
+	std::vector<std::pair<T, bool> > items;
+	for (T i: data) {
+		items.push_back(std::make_pair(i, true));
+	}
+	std::sort(items.begin(), items.end());
+	items.erase(std::unique(items.begin(), items.end()), items.end());
+	
+	double t = measure_time([&container, &items] () {
+		container.assign(items.begin(), items.end());
+	});
+	print_result("Bulk load", t);
+	
+	std::vector<std::pair<T, bool> > batch;
+	std::vector<T> keys;
+	for (size_t i = 0; i < items.size(); i += 2) {
+		batch.push_back(items[i]);
+		keys.push_back(items[i].first);
+	}
+	
+	t = measure_time([&container, &batch, &keys] () {
+		container.erase_sorted(keys.begin(), keys.end());
+		container.insert_sorted(batch.begin(), batch.end());
+	});
+	print_result("Sorted churn", t);
+	
+	container.erase_sorted(keys.begin(), keys.end());
+	t = measure_time([&container, &batch] () {
+		auto hint = container.begin();
+		for (auto & item: batch) {
+			hint = container.insert(hint, item);
+		}
+	});
+	print_result("Hinted insert", t);
+}
+
+/**
+ * Measure looking up the items one by one and in batches of 256 keys, as they come and sorted
+ */
+template <typename T, typename C>
+void run_batch_find (C & container, const std::vector<T> & data)
+{
+	const size_t batch = 256;
+	std::vector<T> sorted(data);
+	for (size_t i = 0; i < sorted.size(); i += batch) {
+		std::sort(sorted.begin() + i, sorted.begin() + std::min(i + batch, sorted.size()));
+	}
+	
+	double t = measure_time([&container, &data] () {
+		size_t found = 0;
+		for (T i: data) {
+			found += container.find(i) != container.end();
+		}
+		sink = found;
+	});
+	print_result("Find", t);
+	
+	std::vector<typename C::iterator> results(batch);
+	const std::vector<T> * inputs[] = {&data, &sorted};
+	for (const std::vector<T> * keys: inputs) {
+		t = measure_time([&container, &results, keys, batch] () {
+			size_t found = 0;
+			for (size_t i = 0; i < keys->size(); i += batch) {
+				size_t count = std::min(batch, keys->size() - i);
+				container.find_batch(keys->begin() + i, keys->begin() + i + count, results.begin());
+				for (size_t j = 0; j < count; j++) {
+					found += results[j] != container.end();
+				}
+			}
+			sink = found;
+		});
+		print_result(keys == &data ? "Batched find" : "Sorted batched find", t);
+	}
+	
+	t = measure_time([&container, &results, &sorted, batch] () {
+		size_t found = 0;
+		for (size_t i = 0; i < sorted.size(); i += batch) {
+			size_t count = std::min(batch, sorted.size() - i);
+			container.lower_bound_batch(sorted.begin() + i, sorted.begin() + i + count, results.begin());
+			for (size_t j = 0; j < count; j++) {
+				found += results[j] != container.end();
+			}
+		}
+		sink = found;
+	});
+	print_result("Sorted batched lower bound", t);
+}
+
+/**
+ * Measure merging two overlapping trees by inserting the items of one into the other
+ * and by the linear set operations
+ */
+template <typename T, typename C>
+void run_set_operations (C & x, C & y, C & result, const std::vector<T> & data)
+{
+	std::vector<std::pair<T, bool> > items;
+	for (T i: data) {
+		items.push_back(std::make_pair(i, true));
+	}
+	std::sort(items.begin(), items.end());
+	items.erase(std::unique(items.begin(), items.end()), items.end());
+	
+	std::vector<std::pair<T, bool> > x_items, y_items;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (i % 2 == 0) {
+			x_items.push_back(items[i]);
+		}
+		if (i % 3 == 0) {
+			y_items.push_back(items[i]);
+		}
+	}
+	x.assign(x_items.begin(), x_items.end());
+	y.assign(y_items.begin(), y_items.end());
+	
+	result.assign(x_items.begin(), x_items.end());
+	double t = measure_time([&y, &result] () {
+		for (auto it = y.begin(); it != y.end(); ++it) {
+			result.insert(std::make_pair(it->first, it->second));
+		}
+	});
+	print_result("Union by insertion", t);
+	
+	t = measure_time([&x, &y, &result] () {
+		result.assign_union(x, y);
+	});
+	print_result("Union", t);
+	
+	t = measure_time([&x, &y, &result] () {
+		result.assign_intersection(x, y);
+	});
+	print_result("Intersection", t);
+	
+	t = measure_time([&x, &y, &result] () {
+		result.assign_difference(x, y);
+	});
+	print_result("Difference", t);
+}
+
 template <typename T>
 void test_tree (size_t a, size_t b, const std::vector<T> & data)
 {
 	std::cout << "* (" << a << ", " << b << ") Tree" << std::endl;
 	abtree<T, bool> tree(a, b);
 	run_test<T>(tree, data);
+	run_bulk_load<T>(tree, data);
+	run_batch_find<T>(tree, data);
+	
+	abtree<T, bool> x(a, b), y(a, b), result(a, b);
+	run_set_operations<T>(x, y, result, data);
+}
+
+template <typename T, size_t A, size_t B>
+void test_static_tree (const std::vector<T> & data)
+{
+	std::cout << "* (" << A << ", " << B << ") Tree, compile-time parameters" << std::endl;
+	abtree<T, bool, A, B> tree;
+	run_test<T>(tree, data);
+	run_bulk_load<T>(tree, data);
+	run_batch_find<T>(tree, data);
+}
+
+template <typename T>
+void test_pool_tree (size_t a, size_t b, const std::vector<T> & data)
+{
+	std::cout << "* (" << a << ", " << b << ") Tree, pool allocator" << std::endl;
+	abtree<T, bool, 0, 0, abtree_pool_allocator<std::pair<const T, bool> > > tree(a, b);
+	run_test<T>(tree, data);
+	run_bulk_load<T>(tree, data);
+	run_batch_find<T>(tree, data);
+}
+
+template <typename T>
+void test_bplus_tree (size_t a, size_t b, const std::vector<T> & data)
+{
+	std::cout << "* (" << a << ", " << b << ") B+ Tree" << std::endl;
+	abtree_bplus<T, bool> tree(a, b);
+	run_test<T>(tree, data);
+}
+
+template <typename T, size_t A, size_t B>
+void test_static_bplus_tree (const std::vector<T> & data)
+{
+	std::cout << "* (" << A << ", " << B << ") B+ Tree, compile-time parameters" << std::endl;
+	abtree_bplus<T, bool, A, B> tree;
+	run_test<T>(tree, data);
+}
+
+template <typename T>
+void test_persistent_tree (size_t a, size_t b, const std::vector<T> & data)
+{
+	std::cout << "* (" << a << ", " << b << ") Persistent tree" << std::endl;
+	abtree_persistent<T, bool> tree(a, b);
+	run_test<T>(tree, data);
+}
+
+/**
+ * Measure the startup of a tree stored in a file: rebuilding it by insertion compared to mapping it,
+ * and searching and traversing the mapped tree (only for trivially copyable types)
+ */
+template <typename T>
+void test_mapped_tree (const std::vector<T> & data)
+{
+	std::cout << "* Mapped file" << std::endl;
+	const char * path = "abtree_benchmark.map";
+	abtree<T, bool> tree(128, 255);
+	for (T i: data) {
+		tree.insert(std::make_pair(i, true));
+	}
+	
+	double t = measure_time([&tree, path] () {
+		abtree_write_mapped(path, tree);
+	});
+	print_result("Write", t);
+	
+	t = measure_time([&data] () {
+		abtree<T, bool> rebuilt(128, 255);
+		for (T i: data) {
+			rebuilt.insert(std::make_pair(i, true));
+		}
+		sink = rebuilt.size();
+	});
+	print_result("Rebuild by insertion", t);
+	
+	t = measure_time([path] () {
+		abtree_mapped<T, bool> mapped(path);
+		sink = mapped.size();
+	});
+	print_result("Open", t);
+	
+	abtree_mapped<T, bool> mapped(path);
+	t = measure_time([&mapped, &data] () {
+		size_t found = 0;
+		for (T i: data) {
+			found += mapped.find(i) != mapped.end();
+		}
+		sink = found;
+	});
+	print_result("Find", t);
+	
+	t = measure_time([&mapped] () {
+		size_t visited = 0;
+		for (auto it = mapped.begin(); it != mapped.end(); ++it) {
+			visited += it->second;
+		}
+		sink = visited;
+	});
+	print_result("Traversal", t);
+	std::remove(path);
 }
 
 template <typename T>
@@ -68,16 +339,29 @@ void test_set (const std::vector<T> & data)
 	test_tree<T>(2, 3, data);
 	
 	test_tree<T>(2, 4, data);
+	test_static_tree<T, 2, 4>(data);
+	test_pool_tree<T>(2, 4, data);
 	
 	test_tree<T>(3, 5, data);
 	
 	test_tree<T>(128, 255, data);
+	test_static_tree<T, 128, 255>(data);
+	test_pool_tree<T>(128, 255, data);
+	test_bplus_tree<T>(128, 255, data);
+	test_static_bplus_tree<T, 128, 255>(data);
+	test_persistent_tree<T>(128, 256, data);
 	
 	test_tree<T>(512, 1023, data);
+	test_static_tree<T, 512, 1023>(data);
+	test_bplus_tree<T>(512, 1023, data);
 	
 	std::cout << "* Map" << std::endl;
 	std::map<T, bool> map;
 	run_test<T>(map, data);
+	
+	std::cout << "* Map, pool allocator" << std::endl;
+	std::map<T, bool, std::less<T>, abtree_pool_allocator<std::pair<const T, bool> > > pool_map;
+	run_test<T>(pool_map, data);
 }
 
 int main (int argc, char ** argv)
@@ -87,6 +371,7 @@ int main (int argc, char ** argv)
 	
 	std::cout << "== Testing int ==" << std::endl;
 	test_set<int>(int_data);
+	test_mapped_tree<int>(int_data);
 	
 	auto rand_string = [] () {
 		size_t len = 20;
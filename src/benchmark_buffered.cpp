@@ -0,0 +1,123 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdlib>
+
+#include "bplus.hpp"
+#include "buffered.hpp"
+
+/**
+ * Results of the measured operations are stored here so that the compiler can't optimize them away
+ */
+volatile size_t sink;
+
+template <typename F>
+double measure_time(F f)
+{
+	auto tb = std::chrono::steady_clock::now();
+	f();
+	auto te = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>( te - tb).count() / 1000000.0;
+}
+
+void print_result (std::string label, double t)
+{
+	std::cout << label.c_str() << ": " << t << "s" << std::endl;
+}
+
+/**
+ * A B+ tree behind the interface of the buffered tree, the baseline it's compared with
+ */
+class bplus_tree
+{
+	abtree_bplus<int, int> tree;
+	
+public:
+	bplus_tree (size_t a, size_t b): tree(a, b)
+	{
+	}
+	
+	void insert_or_assign (int key, int value)
+	{
+		tree.insert_or_assign(key, value);
+	}
+	
+	bool find (int key, int & value) const
+	{
+		auto it = tree.find(key);
+		if (it == tree.cend()) {
+			return false;
+		}
+		value = it->second;
+		return true;
+	}
+	
+	void flush ()
+	{
+	}
+};
+
+/**
+ * Insert given keys in random order, then look up as many random keys (half of them present)
+ */
+template <typename T>
+void run_test (T & tree, const std::vector<int> & keys)
+{
+	print_result("Insert", measure_time([&tree, &keys] () {
+		for (size_t i = 0; i < keys.size(); i++) {
+			tree.insert_or_assign(keys[i], int(i));
+		}
+	}));
+	
+	std::mt19937 random(2);
+	print_result("Find with full buffers", measure_time([&tree, &keys, &random] () {
+		size_t found = 0;
+		int value;
+		for (size_t i = 0; i < keys.size() / 10; i++) {
+			found += tree.find(random() % (2 * keys.size()), value);
+		}
+		sink = found;
+	}));
+	
+	print_result("Flush", measure_time([&tree] () {
+		tree.flush();
+	}));
+	
+	print_result("Find after flush", measure_time([&tree, &keys, &random] () {
+		size_t found = 0;
+		int value;
+		for (size_t i = 0; i < keys.size() / 10; i++) {
+			found += tree.find(random() % (2 * keys.size()), value);
+		}
+		sink = found;
+	}));
+}
+
+int main (int argc, char ** argv)
+{
+	size_t items = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20 * 1000 * 1000;
+	
+	std::vector<int> keys(items);
+	std::mt19937 random(1);
+	for (size_t i = 0; i < items; i++) {
+		keys[i] = random() % (2 * items);
+	}
+	
+	std::cout << "== " << items << " random inserts ==" << std::endl;
+	{
+		std::cout << "* (64, 128) B+ tree" << std::endl;
+		bplus_tree tree(64, 128);
+		run_test(tree, keys);
+	}
+	// A batch only pays off if it's much larger than the fan-out, so the buffered tree has small inner vertices
+	for (size_t buffer_size: {64, 128, 256}) {
+		std::cout << "* (4, 8) Buffered tree, leaves of 128, buffers of " << buffer_size << " messages" << std::endl;
+		abtree_buffered_options options;
+		options.buffer_size = buffer_size;
+		abtree_buffered<int, int> tree(4, 8, options);
+		run_test(tree, keys);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include "abtree.hpp"
+#include "concurrent.hpp"
+
+/**
+ * Results of the measured operations are stored here so that the compiler can't optimize them away
+ */
+volatile size_t sink;
+
+template <typename F>
+double measure_time(F f)
+{
+	auto tb = std::chrono::steady_clock::now();
+	f();
+	auto te = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>( te - tb).count() / 1000000.0;
+}
+
+void print_result (std::string label, size_t threads, double t)
+{
+	std::cout << label.c_str() << ", " << threads << " threads: " << t << "s" << std::endl;
+}
+
+/**
+ * An ordinary tree behind a single mutex, the baseline the concurrent tree is compared with
+ */
+template <typename T>
+class locked_tree
+{
+	abtree<T, T> tree;
+	std::mutex mutex;
+	
+public:
+	locked_tree (size_t a, size_t b): tree(a, b)
+	{
+	}
+	
+	bool find (T key, T & value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = tree.find(key);
+		if (it == tree.end()) {
+			return false;
+		}
+		value = it->second;
+		return true;
+	}
+	
+	bool insert (const std::pair<T, T> & item)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return tree.insert_or_assign(item.first, item.second).second;
+	}
+	
+	bool erase (T key)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tree.find(key) == tree.end()) {
+			return false;
+		}
+		tree.erase(key);
+		return true;
+	}
+};
+
+/**
+ * Run a mix of operations on random keys from given range in several threads
+ * @param reads the percentage of finds, the rest is split evenly between inserts and erases
+ * @param ops the total number of operations, divided between the threads
+ */
+template <typename C>
+double run_mix (C & container, size_t threads, int reads, int range, size_t ops)
+{
+	return measure_time([&container, threads, reads, range, ops] () {
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; t++) {
+			workers.emplace_back([&container, t, threads, reads, range, ops] () {
+				std::mt19937 random(t);
+				size_t found = 0;
+				for (size_t i = 0; i < ops / threads; i++) {
+					int key = random() % range;
+					int op = random() % 100;
+					int value;
+					if (op < reads) {
+						found += container.find(key, value);
+					} else if (op < reads + (100 - reads) / 2) {
+						found += container.insert(std::make_pair(key, key));
+					} else {
+						found += container.erase(key);
+					}
+				}
+				sink = found;
+			});
+		}
+		for (auto & worker: workers) {
+			worker.join();
+		}
+	});
+}
+
+template <typename C>
+void run_test (C & container, const std::vector<size_t> & thread_counts, int range, size_t ops)
+{
+	for (int i = 0; i < range; i += 2) {
+		container.insert(std::make_pair(i, i));
+	}
+	for (size_t threads: thread_counts) {
+		print_result("Read-mostly (90/5/5)", threads, run_mix(container, threads, 90, range, ops));
+	}
+	for (size_t threads: thread_counts) {
+		print_result("Mixed (50/25/25)", threads, run_mix(container, threads, 50, range, ops));
+	}
+	for (size_t threads: thread_counts) {
+		print_result("Write-heavy (10/45/45)", threads, run_mix(container, threads, 10, range, ops));
+	}
+}
+
+void test_set (size_t a, size_t b, const std::vector<size_t> & thread_counts, int range, size_t ops)
+{
+	std::cout << "* (" << a << ", " << b << ") Concurrent tree" << std::endl;
+	abtree_concurrent<int, int> tree(a, b);
+	run_test(tree, thread_counts, range, ops);
+	
+	std::cout << "* (" << a << ", " << b << ") Tree behind a mutex" << std::endl;
+	locked_tree<int> locked(a, b);
+	run_test(locked, thread_counts, range, ops);
+}
+
+int main (int argc, char ** argv)
+{
+	std::vector<size_t> thread_counts;
+	size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		thread_counts.push_back(threads);
+	}
+	
+	int range = 1024 * 1024;
+	size_t ops = 2 * 1024 * 1024;
+	
+	std::cout << "== Testing int ==" << std::endl;
+	test_set(8, 16, thread_counts, range, ops);
+	test_set(64, 128, thread_counts, range, ops);
+	
+	return 0;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "durable.hpp"
+
+/**
+ * Results of the measured operations are stored here so that the compiler can't optimize them away
+ */
+volatile size_t sink;
+
+template <typename F>
+double measure_time(F f)
+{
+	auto tb = std::chrono::steady_clock::now();
+	f();
+	auto te = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>( te - tb).count() / 1000000.0;
+}
+
+void print_result (std::string label, double t)
+{
+	std::cout << label.c_str() << ": " << t << "s" << std::endl;
+}
+
+const std::string path = "abtree_benchmark";
+
+void remove_files ()
+{
+	std::remove((path + ".log").c_str());
+	std::remove((path + ".checkpoint").c_str());
+}
+
+/**
+ * Measure the latency of single inserts with given commit interval. An insert that happens to commit
+ * the group waits for the fsync, the others only append to the buffer.
+ */
+void run_latency (std::chrono::milliseconds interval, size_t ops)
+{
+	remove_files();
+	abtree_durable_options options;
+	options.commit_interval = interval;
+	options.checkpoint_size = 0;
+	abtree_durable<int, int> tree(path, 64, 128, options);
+	
+	std::mt19937 random(1);
+	std::vector<double> latencies;
+	latencies.reserve(ops);
+	double total = measure_time([&tree, &random, &latencies, ops] () {
+		for (size_t i = 0; i < ops; i++) {
+			int key = random();
+			auto tb = std::chrono::steady_clock::now();
+			tree.insert_or_assign(key, key);
+			auto te = std::chrono::steady_clock::now();
+			latencies.push_back(std::chrono::duration<double, std::micro>(te - tb).count());
+		}
+		tree.sync();
+	});
+	std::sort(latencies.begin(), latencies.end());
+	
+	std::cout << "Commit interval " << interval.count() << "ms, " << ops << " inserts: " << total << "s, latency "
+		<< "median " << latencies[ops / 2] << "us, "
+		<< "99% " << latencies[ops * 99 / 100] << "us, "
+		<< "max " << latencies.back() << "us" << std::endl;
+}
+
+/**
+ * Measure a checkpoint of given number of items and the recovery from it (with a log of given length),
+ * compared to rebuilding the tree by inserting the items one by one
+ */
+void run_recovery (size_t items, size_t log_records)
+{
+	remove_files();
+	abtree_durable_options options;
+	options.checkpoint_size = 0;
+	std::vector<int> keys(items);
+	for (size_t i = 0; i < items; i++) {
+		keys[i] = int(i * 2);
+	}
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(2));
+	
+	{
+		abtree_durable<int, int> tree(path, 64, 128, options);
+		for (size_t i = 0; i < items; i++) {
+			tree.insert_or_assign(keys[i], int(i));
+			if (i + log_records == items) {
+				print_result("Checkpoint of " + std::to_string(i) + " items", measure_time([&tree] () {
+					tree.checkpoint();
+				}));
+			}
+		}
+	}
+	
+	double t = measure_time([&options] () {
+		abtree_durable<int, int> tree(path, 64, 128, options);
+		sink = tree.size();
+	});
+	print_result("Recovery of " + std::to_string(items) + " items (" + std::to_string(log_records) + " from the log)", t);
+	
+	t = measure_time([&keys] () {
+		abtree<int, int> tree(64, 128);
+		for (size_t i = 0; i < keys.size(); i++) {
+			tree.insert_or_assign(keys[i], int(i));
+		}
+		sink = tree.size();
+	});
+	print_result("Rebuild by insertion", t);
+	remove_files();
+}
+
+int main (int argc, char ** argv)
+{
+	size_t items = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10 * 1000 * 1000;
+	
+	std::cout << "== Write latency ==" << std::endl;
+	run_latency(std::chrono::milliseconds(0), 2000);
+	run_latency(std::chrono::milliseconds(1), 1000 * 1000);
+	run_latency(std::chrono::milliseconds(10), 1000 * 1000);
+	run_latency(std::chrono::milliseconds(100), 1000 * 1000);
+	
+	std::cout << "== Recovery ==" << std::endl;
+	run_recovery(items, items / 10);
+	
+	return 0;
+}
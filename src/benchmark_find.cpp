@@ -0,0 +1,137 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include "abtree.hpp"
+
+/**
+ * Searches in trees much larger than the last level cache, where almost every vertex on a search path
+ * is a cache miss. The benchmark is built twice, once with ABTREE_NO_PREFETCH, to see what prefetching
+ * the vertices saves.
+ */
+
+/**
+ * Results of the measured operations are stored here so that the compiler can't optimize them away
+ */
+volatile size_t sink;
+
+template <typename F>
+double measure_time(F f)
+{
+	auto tb = std::chrono::steady_clock::now();
+	f();
+	auto te = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>( te - tb).count() / 1000000.0;
+}
+
+void print_result (std::string label, double t)
+{
+	std::cout << label.c_str() << ": " << t << "s" << std::endl;
+}
+
+/**
+ * The number of keys looked up at once by the batched searches
+ */
+const size_t batch = 256;
+
+template <typename C>
+void run_test (C & tree, const std::vector<std::pair<int, int> > & items, const std::vector<int> & queries)
+{
+	tree.assign(items.begin(), items.end());
+	
+	double t = measure_time([&tree, &queries] () {
+		size_t found = 0;
+		for (int key: queries) {
+			found += tree.find(key) != tree.end();
+		}
+		sink = found;
+	});
+	print_result("Find", t);
+	
+	std::vector<typename C::iterator> results(batch);
+	t = measure_time([&tree, &queries, &results] () {
+		size_t found = 0;
+		for (size_t i = 0; i < queries.size(); i += batch) {
+			size_t count = std::min(batch, queries.size() - i);
+			tree.find_batch(queries.begin() + i, queries.begin() + i + count, results.begin());
+			for (size_t j = 0; j < count; j++) {
+				found += results[j] != tree.end();
+			}
+		}
+		sink = found;
+	});
+	print_result("Batched find", t);
+	
+	t = measure_time([&tree, &queries] () {
+		size_t sum = 0;
+		for (int key: queries) {
+			sum += tree.lower_bound(key)->second;
+		}
+		sink = sum;
+	});
+	print_result("Lower bound", t);
+	
+	t = measure_time([&tree, &queries] () {
+		for (int key: queries) {
+			tree.insert(std::make_pair(key, key));
+		}
+	});
+	print_result("Insert", t);
+	
+	t = measure_time([&tree] () {
+		size_t sum = 0;
+		for (auto it = tree.begin(); it != tree.end(); ++it) {
+			sum += it->second;
+		}
+		sink = sum;
+	});
+	print_result("Traversal", t);
+}
+
+int main (int argc, char ** argv)
+{
+	size_t items = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 40 * 1000 * 1000;
+	size_t queries = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5 * 1000 * 1000;
+#ifdef ABTREE_NO_PREFETCH
+	std::cout << "== Without prefetching, " << items << " items ==" << std::endl;
+#else
+	std::cout << "== With prefetching, " << items << " items ==" << std::endl;
+#endif
+
+	// Even keys are present, so that half of the queries and the inserts miss
+	std::vector<std::pair<int, int> > data(items);
+	for (size_t i = 0; i < items; i++) {
+		data[i] = std::make_pair(int(2 * i), int(i));
+	}
+	std::mt19937 random(1);
+	std::vector<int> query_data(queries);
+	for (int & key: query_data) {
+		key = random() % (2 * items);
+	}
+	
+	{
+		std::cout << "* (8, 16) Tree" << std::endl;
+		abtree<int, int> tree(8, 16);
+		run_test(tree, data, query_data);
+	}
+	{
+		std::cout << "* (64, 128) Tree" << std::endl;
+		abtree<int, int> tree(64, 128);
+		run_test(tree, data, query_data);
+	}
+	{
+		std::cout << "* (64, 128) Tree, compile-time parameters" << std::endl;
+		abtree<int, int, 64, 128> tree;
+		run_test(tree, data, query_data);
+	}
+	{
+		std::cout << "* (128, 255) Tree" << std::endl;
+		abtree<int, int> tree(128, 255);
+		run_test(tree, data, query_data);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+
+#include "abtree.hpp"
+
+/**
+ * Results of the measured operations are stored here so that the compiler can't optimize them away
+ */
+volatile size_t sink;
+
+template <typename F>
+double measure_time(F f)
+{
+	auto tb = std::chrono::steady_clock::now();
+	f();
+	auto te = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>( te - tb).count() / 1000000.0;
+}
+
+/**
+ * Measure an operation with 1, 2, 4, ... threads and print the times along with the speedups
+ * over a single thread
+ * @param label the name of the operation
+ * @param max_threads the largest number of threads
+ * @param f the operation, it gets the number of threads
+ */
+template <typename F>
+void run_curve (std::string label, size_t max_threads, F f)
+{
+	double base = 0;
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		double t = measure_time([&f, threads] () {
+			f(threads);
+		});
+		if (threads == 1) {
+			base = t;
+		}
+		std::cout << label.c_str() << ", " << threads << " threads: " << t << "s, speedup " << base / t << std::endl;
+	}
+}
+
+int main (int argc, char ** argv)
+{
+	size_t items = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10 * 1000 * 1000;
+	size_t max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+	std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+	
+	std::vector<std::pair<int, int> > sorted(items);
+	for (size_t i = 0; i < items; i++) {
+		sorted[i] = std::make_pair(int(i * 2), int(i));
+	}
+	std::vector<std::pair<int, int> > shuffled(sorted);
+	std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+	
+	for (size_t b: {16, 128}) {
+		std::cout << "* (" << b / 2 << ", " << b << ") Tree, " << items << " items" << std::endl;
+		abtree<int, int> tree(b / 2, b);
+		
+		run_curve("Bulk load, sorted", max_threads, [&tree, &sorted] (size_t threads) {
+			tree.assign_parallel(sorted.begin(), sorted.end(), threads);
+		});
+		run_curve("Bulk load, shuffled", max_threads, [&tree, &shuffled] (size_t threads) {
+			tree.assign_parallel(shuffled.begin(), shuffled.end(), threads);
+		});
+		run_curve("Range walk", max_threads, [&tree, items] (size_t threads) {
+			tree.parallel_for_each(0, int(2 * items), [] (const int & key, int & value) {
+				value += key;
+			}, threads);
+			sink = tree.select(items / 2)->second;
+		});
+		
+		// Every other key of the second tree is also in the first one
+		std::vector<std::pair<int, int> > multiples(items);
+		for (size_t i = 0; i < items; i++) {
+			multiples[i] = std::make_pair(int(i * 3), int(i));
+		}
+		abtree<int, int> other(multiples.begin(), multiples.end(), b / 2, b);
+		abtree<int, int> result(b / 2, b);
+		run_curve("Union", max_threads, [&tree, &other, &result] (size_t threads) {
+			result.assign_union_parallel(tree, other, threads);
+		});
+	}
+	
+	return 0;
+}
@@ -0,0 +1,717 @@
+#ifndef _ABTREE_BPLUS_HPP_
+#define _ABTREE_BPLUS_HPP_
+
+#include <stdexcept>
+#include <queue>
+#include "abtree.hpp"
+#include "bplus_vertex.hpp"
+#include "bplus_iterator.hpp"
+
+/**
+ * A generic associative container that uses the B+ variant of (a, b)-trees to store data.
+ * All items are stored in the leaves, which are linked together, and inner vertices only hold
+ * separator keys that guide the search. Iterating over the items therefore doesn't need to visit
+ * inner vertices at all, which makes range scans and full traversals much faster than with abtree.
+ * The interface mirrors the one of abtree.
+ * @tparam A, B The (a, b) parameters of the tree if they should be fixed at compile time.
+ * If both of them are 0 (the default), the parameters are passed to the constructor instead.
+ * Every vertex (including leaves) holds at most b - 1 keys, every non-root vertex at least a - 1 keys.
+ * @tparam Allocator A std::allocator-compatible allocator (see abtree)
+ */
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >
+>
+class abtree_bplus: private abtree_params<A, B> {
+	typedef abtree_bplus_vertex<TKey, TVal, B> vertex;
+	typedef abtree_params<A, B> params;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<abtree_cache_line> block_allocator;
+	
+public:
+	typedef abtree_bplus_iterator<vertex, TVal> iterator;
+	typedef abtree_bplus_iterator<vertex, TVal const> const_iterator;
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+	typedef Allocator allocator_type;
+	
+private:
+	using params::a;
+	using params::b;
+	
+	vertex * root;
+	vertex * head; // The first leaf
+	vertex * tail; // The last leaf
+	size_t size_;
+	block_allocator alloc_;
+	
+	/**
+	 * Allocate a new vertex using the allocator of the tree
+	 * @param leaf whether the vertex is a leaf
+	 */
+	vertex * create_vertex (bool leaf)
+	{
+		return vertex::create(alloc_, b, leaf);
+	}
+	
+	/**
+	 * Destroy a vertex and return its memory to the allocator of the tree
+	 */
+	void destroy_vertex (vertex * v)
+	{
+		vertex::destroy(alloc_, v, b);
+	}
+	
+	/**
+	 * Make the tree consist of a single empty leaf
+	 */
+	void init ()
+	{
+		root = head = tail = create_vertex(true);
+	}
+	
+	/**
+	 * Destroy all the vertices of the tree (using BFS), leaving the root pointer dangling
+	 */
+	void destroy_tree ()
+	{
+		std::queue<vertex *> queue;
+		queue.push(root);
+		
+		while (queue.size() > 0) {
+			vertex * cursor = queue.front();
+			if (!cursor->leaf) {
+				for (size_t i = 0; i <= cursor->item_count; i++) {
+					queue.push(cursor->children[i]);
+				}
+			}
+			destroy_vertex(cursor);
+			queue.pop();
+		}
+	}
+	
+	/**
+	 * Find the leaf whose range covers given key
+	 */
+	vertex * find_leaf (const key_type & key) const
+	{
+		vertex * cursor = root;
+		while (!cursor->leaf) {
+			cursor = cursor->children[cursor->child_index(key)];
+		}
+		return cursor;
+	}
+	
+	/**
+	 * Insert a separator and a new child to the right of given vertex into its parent.
+	 * If the parent overflows, it gets split as well. If the vertex is the root, a new root is created
+	 * and the tree's depth is increased by one.
+	 * @param left the vertex that has been split
+	 * @param separator the smallest key that belongs to the new vertex
+	 * @param right the new vertex
+	 */
+	template <typename K>
+	void add_child (vertex * left, K && separator, vertex * right)
+	{
+		if (left == root) {
+			root = create_vertex(false);
+			new (&root->keys[0]) TKey(std::forward<K>(separator));
+			root->set_child(0, left);
+			root->set_child(1, right);
+			root->item_count = 1;
+			return;
+		}
+		
+		vertex * parent = left->parent;
+		size_t pos = left->index;
+		for (size_t i = parent->item_count; i > pos; i--) {
+			parent->move_key(i - 1, parent, i);
+		}
+		for (size_t i = parent->item_count + 1; i > pos + 1; i--) {
+			parent->set_child(i, parent->children[i - 1]);
+		}
+		
+		new (&parent->keys[pos]) TKey(std::forward<K>(separator));
+		parent->set_child(pos + 1, right);
+		parent->item_count++;
+		
+		if (parent->item_count == b) {
+			split_inner(parent);
+		}
+	}
+	
+	/**
+	 * Split an overflowing leaf in half. The new leaf is linked after the old one
+	 * and a copy of its first key becomes the separator in the parent.
+	 * @param leaf the leaf to be split
+	 * @param item the position of an item in the leaf that should be followed.
+	 * It's updated to the position of the item in the returned leaf.
+	 * @return the leaf that holds the followed item after the split
+	 */
+	vertex * split_leaf (vertex * leaf, size_t & item)
+	{
+		size_t middle = b / 2;
+		vertex * new_leaf = create_vertex(true);
+		
+		for (size_t i = middle; i < b; i++) {
+			leaf->move_item(i, new_leaf, i - middle);
+		}
+		new_leaf->item_count = b - middle;
+		leaf->item_count = middle;
+		
+		new_leaf->prev = leaf;
+		new_leaf->next = leaf->next;
+		if (leaf->next != nullptr) {
+			leaf->next->prev = new_leaf;
+		} else {
+			tail = new_leaf;
+		}
+		leaf->next = new_leaf;
+		
+		add_child(leaf, new_leaf->keys[0], new_leaf);
+		
+		if (item >= middle) {
+			item -= middle;
+			return new_leaf;
+		}
+		return leaf;
+	}
+	
+	/**
+	 * Split an overflowing inner vertex in half. The middle separator moves to the parent.
+	 * @param cursor the vertex to be split
+	 */
+	void split_inner (vertex * cursor)
+	{
+		size_t middle = b / 2;
+		vertex * new_vertex = create_vertex(false);
+		
+		for (size_t i = middle + 1; i < b; i++) {
+			cursor->move_key(i, new_vertex, i - (middle + 1));
+		}
+		for (size_t i = middle + 1; i <= b; i++) {
+			new_vertex->set_child(i - (middle + 1), cursor->children[i]);
+		}
+		new_vertex->item_count = b - (middle + 1);
+		cursor->item_count = middle;
+		
+		TKey separator(std::move(cursor->keys[middle]));
+		cursor->keys[middle].~TKey();
+		add_child(cursor, std::move(separator), new_vertex);
+	}
+	
+	/**
+	 * Refill the i-th child of given vertex, so that it has at least a - 1 keys.
+	 * An item (or a child) is borrowed from a neighbour that can spare it, otherwise the vertex
+	 * gets merged with a neighbour.
+	 * @param parent The parent of the vertex to be refilled
+	 * @param i The position of the vertex in the parent's children
+	 */
+	void refill_vertex (vertex * parent, size_t i)
+	{
+		if (i > 0 && parent->children[i - 1]->item_count >= a) {
+			borrow_from_left(parent, i);
+		} else if (i < parent->item_count && parent->children[i + 1]->item_count >= a) {
+			borrow_from_right(parent, i);
+		} else if (i > 0) {
+			merge_vertices(parent, i - 1);
+		} else {
+			merge_vertices(parent, 0);
+		}
+	}
+	
+	/**
+	 * Move the last item (or child) of the left neighbour of the i-th child of parent to that child
+	 */
+	void borrow_from_left (vertex * parent, size_t i)
+	{
+		vertex * cursor = parent->children[i];
+		vertex * neighbour = parent->children[i - 1];
+		
+		if (cursor->leaf) {
+			for (size_t j = cursor->item_count; j > 0; j--) {
+				cursor->move_item(j - 1, cursor, j);
+			}
+			neighbour->move_item(neighbour->item_count - 1, cursor, 0);
+			parent->keys[i - 1] = cursor->keys[0];
+		} else {
+			for (size_t j = cursor->item_count; j > 0; j--) {
+				cursor->move_key(j - 1, cursor, j);
+			}
+			for (size_t j = cursor->item_count + 1; j > 0; j--) {
+				cursor->set_child(j, cursor->children[j - 1]);
+			}
+			parent->move_key(i - 1, cursor, 0);
+			cursor->set_child(0, neighbour->children[neighbour->item_count]);
+			neighbour->move_key(neighbour->item_count - 1, parent, i - 1);
+		}
+		
+		cursor->item_count++;
+		neighbour->item_count--;
+	}
+	
+	/**
+	 * Move the first item (or child) of the right neighbour of the i-th child of parent to that child
+	 */
+	void borrow_from_right (vertex * parent, size_t i)
+	{
+		vertex * cursor = parent->children[i];
+		vertex * neighbour = parent->children[i + 1];
+		
+		if (cursor->leaf) {
+			neighbour->move_item(0, cursor, cursor->item_count);
+			for (size_t j = 1; j < neighbour->item_count; j++) {
+				neighbour->move_item(j, neighbour, j - 1);
+			}
+			parent->keys[i] = neighbour->keys[0];
+		} else {
+			parent->move_key(i, cursor, cursor->item_count);
+			cursor->set_child(cursor->item_count + 1, neighbour->children[0]);
+			neighbour->move_key(0, parent, i);
+			for (size_t j = 1; j < neighbour->item_count; j++) {
+				neighbour->move_key(j, neighbour, j - 1);
+			}
+			for (size_t j = 0; j < neighbour->item_count; j++) {
+				neighbour->set_child(j, neighbour->children[j + 1]);
+			}
+		}
+		
+		cursor->item_count++;
+		neighbour->item_count--;
+	}
+	
+	/**
+	 * Merge the k-th and (k + 1)-th child of given vertex. The separator between them is dropped
+	 * (in case of leaves) or moved down (in case of inner vertices). After this, it might be
+	 * necessary to refill the parent recursively.
+	 * If the last two children of the root vertex get merged this way, the resulting vertex becomes the
+	 * new root and the tree's height decreases by one.
+	 * @param parent The parent of the merged vertices
+	 * @param k The position of the separator between them
+	 */
+	void merge_vertices (vertex * parent, size_t k)
+	{
+		vertex * left = parent->children[k];
+		vertex * right = parent->children[k + 1];
+		
+		if (left->leaf) {
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->move_item(j, left, left->item_count + j);
+			}
+			left->next = right->next;
+			if (right->next != nullptr) {
+				right->next->prev = left;
+			} else {
+				tail = left;
+			}
+			parent->keys[k].~TKey();
+		} else {
+			parent->move_key(k, left, left->item_count);
+			left->item_count++;
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->move_key(j, left, left->item_count + j);
+			}
+			for (size_t j = 0; j <= right->item_count; j++) {
+				left->set_child(left->item_count + j, right->children[j]);
+			}
+		}
+		left->item_count += right->item_count;
+		right->item_count = 0;
+		destroy_vertex(right);
+		
+		for (size_t j = k + 1; j < parent->item_count; j++) {
+			parent->move_key(j, parent, j - 1);
+			parent->set_child(j, parent->children[j + 1]);
+		}
+		parent->item_count--;
+		
+		if (parent == root && parent->item_count == 0) {
+			root = left;
+			left->parent = nullptr;
+			left->index = 0;
+			destroy_vertex(parent);
+		} else if (parent != root && parent->item_count < a - 1) {
+			refill_vertex(parent->parent, parent->index);
+		}
+	}
+	
+	/**
+	 * Insert an item with given key, unless the key is already present.
+	 * The value is constructed in place, the arguments are left untouched if the key is present.
+	 * @param key the key of the item
+	 * @param args the arguments passed to the constructor of the value
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	template <typename K, typename... Args>
+	std::pair<iterator, bool> emplace_item (K && key, Args &&... args)
+	{
+		vertex * leaf = find_leaf(key);
+		size_t i = leaf->search(key);
+		if (i < leaf->item_count && leaf->keys[i] == key) {
+			return std::make_pair(iterator(leaf, i), false);
+		}
+		
+		for (size_t j = leaf->item_count; j > i; j--) {
+			leaf->move_item(j - 1, leaf, j);
+		}
+		leaf->construct_item(i, std::forward<K>(key), std::forward<Args>(args)...);
+		leaf->item_count++;
+		size_++;
+		
+		if (leaf->item_count == b) {
+			leaf = split_leaf(leaf, i);
+		}
+		
+		return std::make_pair(iterator(leaf, i), true);
+	}
+	
+	/**
+	 * Insert an item, or replace the value of the item with the same key
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	template <typename K, typename V>
+	std::pair<iterator, bool> assign_item (K && key, V && value)
+	{
+		auto result = emplace_item(std::forward<K>(key), std::forward<V>(value));
+		if (!result.second) {
+			// The value hasn't been consumed by emplace_item()
+			result.first->second = std::forward<V>(value);
+		}
+		return result;
+	}
+	
+	/**
+	 * A function template for the find() method (this method can return an iterator or a const_iterator)
+	 */
+	template <typename iterator>
+	iterator do_find (const key_type & key) const
+	{
+		vertex * leaf = find_leaf(key);
+		size_t i = leaf->search(key);
+		if (i < leaf->item_count && leaf->keys[i] == key) {
+			return iterator(leaf, i);
+		}
+		return iterator(tail, tail->item_count);
+	}
+	
+	/**
+	 * A function template for the lower_bound() and upper_bound() methods
+	 * @param key the key to search for
+	 * @param strict whether an item with a key equal to given key should be skipped
+	 */
+	template <typename iterator>
+	iterator do_bound (const key_type & key, bool strict) const
+	{
+		vertex * leaf = find_leaf(key);
+		size_t i = leaf->search(key);
+		if (strict && i < leaf->item_count && leaf->keys[i] == key) {
+			i++;
+		}
+		if (i == leaf->item_count && leaf->next != nullptr) {
+			leaf = leaf->next;
+			i = 0;
+		}
+		return iterator(leaf, i);
+	}
+	
+public:
+	/**
+	 * The basic constructor
+	 * @param a The minimum number of children for all non-root vertices (has to be at least 2)
+	 * @param b The maximum number of children for all vertices (has to be at least (2 * a) - 1)
+	 * @param alloc The allocator used for the vertices of the tree
+	 * @throws std::invalid_argument if a and b don't meet (a, b)-tree conditions
+	 */
+	abtree_bplus (size_t a, size_t b, const Allocator & alloc = Allocator()): params(a, b), size_(0), alloc_(alloc)
+	{
+		init();
+	}
+	
+	/**
+	 * The constructor of a tree whose (a, b) parameters are given as template arguments
+	 * @param alloc The allocator used for the vertices of the tree
+	 */
+	explicit abtree_bplus (const Allocator & alloc = Allocator()): size_(0), alloc_(alloc)
+	{
+		init();
+	}
+	
+	/**
+	 * The move constructor. The other tree is left empty.
+	 */
+	abtree_bplus (abtree_bplus && other)
+		: params(other), root(other.root), head(other.head), tail(other.tail), size_(other.size_), alloc_(other.alloc_)
+	{
+		other.init();
+		other.size_ = 0;
+	}
+	
+	abtree_bplus (const abtree_bplus &) = delete;
+	abtree_bplus & operator= (const abtree_bplus &) = delete;
+	
+	/**
+	 * The destructor
+	 */
+	~abtree_bplus ()
+	{
+		destroy_tree();
+	}
+	
+	/**
+	 * @name Return an iterator to the first (and smallest) item in the tree
+	 */
+	//@{
+	iterator begin ()
+	{
+		return iterator(head, 0);
+	}
+	
+	const_iterator cbegin () const
+	{
+		return const_iterator(head, 0);
+	}
+	//@}
+	
+	/**
+	 * @name Return an iterator pointing to the item that would follow the last (and largest) item in the tree
+	 */
+	//@{
+	iterator end ()
+	{
+		return iterator(tail, tail->item_count);
+	}
+	
+	const_iterator cend () const
+	{
+		return const_iterator(tail, tail->item_count);
+	}
+	//@}
+	
+	/**
+	 * @name If an item with specified key is present in the tree, return an iterator pointing to it.
+	 * If it is not, return end().
+	 * @param key The key to search for
+	 * @return an iterator pointing to given item or past the end
+	 */
+	//@{
+	iterator find (const key_type & key)
+	{
+		return do_find<iterator>(key);
+	}
+	
+	const_iterator find (const key_type & key) const
+	{
+		return do_find<const_iterator>(key);
+	}
+	//@}
+	
+	/**
+	 * @name Return a reference to the value of the item with given key if it is present in the tree,
+	 * throw an exception otherwise.
+	 * @return a reference to the value with specified key
+	 * @throws std::out_of_range if given key is not found
+	 */
+	//@{
+	mapped_type & at (const key_type & key)
+	{
+		iterator it = find(key);
+		if (it != end()) {
+			return it->second;
+		}
+		throw std::out_of_range("abtree_bplus::at");
+	}
+	
+	const mapped_type & at (const key_type & key) const
+	{
+		const_iterator it = find(key);
+		if (it != cend()) {
+			return it->second;
+		}
+		throw std::out_of_range("abtree_bplus::at");
+	}
+	//@}
+	
+	/**
+	 * @name Returns an iterator pointing to the smallest item that has a key larger or equal to given key.
+	 * If there's no such item in the tree, returns end().
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	//@{
+	iterator lower_bound (const key_type & key)
+	{
+		return do_bound<iterator>(key, false);
+	}
+	
+	const_iterator lower_bound (const key_type & key) const
+	{
+		return do_bound<const_iterator>(key, false);
+	}
+	//@}
+	
+	/**
+	 * @name Returns an iterator pointing to the smallest item that has a key larger than given key.
+	 * If there's no such item in the tree, returns end().
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	//@{
+	iterator upper_bound (const key_type & key)
+	{
+		return do_bound<iterator>(key, true);
+	}
+	
+	const_iterator upper_bound (const key_type & key) const
+	{
+		return do_bound<const_iterator>(key, true);
+	}
+	//@}
+	
+	/**
+	 * @name Inserts a new item into the tree. If there's already an item with the same key in the tree,
+	 * its value gets replaced by the value of the new item.
+	 * @param pair The item that gets copied (or moved) into the tree
+	 * @return An iterator pointing to the inserted item and whether a new item has been added
+	 */
+	//@{
+	std::pair<iterator, bool> insert (const value_type & pair)
+	{
+		return assign_item(pair.first, pair.second);
+	}
+	
+	std::pair<iterator, bool> insert (value_type && pair)
+	{
+		return assign_item(pair.first, std::move(pair.second));
+	}
+	//@}
+	
+	/**
+	 * Construct an item from given arguments and insert it (see insert())
+	 * @param args The arguments passed to the constructor of value_type
+	 * @return An iterator pointing to the inserted item and whether a new item has been added
+	 */
+	template <typename... Args>
+	std::pair<iterator, bool> emplace (Args &&... args)
+	{
+		std::pair<key_type, mapped_type> item(std::forward<Args>(args)...);
+		return assign_item(std::move(item.first), std::move(item.second));
+	}
+	
+	/**
+	 * @name If there's no item with given key in the tree, insert one whose value is constructed in place
+	 * from given arguments. Otherwise, nothing happens (the arguments aren't moved from).
+	 * @param key The key of the item
+	 * @param args The arguments passed to the constructor of mapped_type
+	 * @return An iterator pointing to the item with given key and whether it has been inserted
+	 */
+	//@{
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace (const key_type & key, Args &&... args)
+	{
+		return emplace_item(key, std::forward<Args>(args)...);
+	}
+	
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace (key_type && key, Args &&... args)
+	{
+		return emplace_item(std::move(key), std::forward<Args>(args)...);
+	}
+	//@}
+	
+	/**
+	 * @name Insert an item with given key and value, or assign the value to the item if the key is already present
+	 * @param key The key of the item
+	 * @param value The value of the item
+	 * @return An iterator pointing to the item with given key and whether it has been inserted
+	 */
+	//@{
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign (const key_type & key, M && value)
+	{
+		return assign_item(key, std::forward<M>(value));
+	}
+	
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign (key_type && key, M && value)
+	{
+		return assign_item(std::move(key), std::forward<M>(value));
+	}
+	//@}
+	
+	/**
+	 * @name Return a reference to the value of the item with given key.
+	 * If it isn't present in the tree, an item with a value-initialized value is inserted first.
+	 * @param key The key of the item
+	 * @return a reference to the value with specified key
+	 */
+	//@{
+	mapped_type & operator[] (const key_type & key)
+	{
+		return try_emplace(key).first->second;
+	}
+	
+	mapped_type & operator[] (key_type && key)
+	{
+		return try_emplace(std::move(key)).first->second;
+	}
+	//@}
+	
+	/**
+	 * Erase the item with given key from the tree. If such item isn't present in the tree, don't do anything.
+	 * If the deletion causes a leaf to have less than a - 1 items, refill_vertex is called on it.
+	 * The separators in inner vertices are left alone, they still divide the keys correctly.
+	 * @param key The key of the item to be erased
+	 */
+	void erase (const key_type & key)
+	{
+		vertex * cursor = find_leaf(key);
+		
+		size_t i = cursor->search(key);
+		if (i == cursor->item_count || !(cursor->keys[i] == key)) {
+			return;
+		}
+		
+		cursor->keys[i].~TKey();
+		cursor->values[i].~TVal();
+		for (size_t j = i + 1; j < cursor->item_count; j++) {
+			cursor->move_item(j, cursor, j - 1);
+		}
+		cursor->item_count--;
+		size_--;
+		
+		if (cursor != root && cursor->item_count < a - 1) {
+			refill_vertex(cursor->parent, cursor->index);
+		}
+	}
+	
+	/**
+	 * Get a copy of the allocator the tree was constructed with
+	 */
+	allocator_type get_allocator () const
+	{
+		return allocator_type(alloc_);
+	}
+	
+	/**
+	 * Get the total number of items in the tree
+	 * @return the number of items
+	 */
+	size_t size () const
+	{
+		return size_;
+	}
+	
+	/**
+	 * Find out whether the tree is empty
+	 * @return True if the tree is empty, false otherwise
+	 */
+	bool empty () const
+	{
+		return size_ == 0;
+	}
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef _ABTREE_BPLUS_ITERATOR_HPP_
+#define _ABTREE_BPLUS_ITERATOR_HPP_
+
+#include <iterator>
+#include <type_traits>
+#include "iterator.hpp"
+#include "bplus_vertex.hpp"
+
+/**
+ * An iterator of the B+ variant of an (a, b)-tree. It only ever points into leaves,
+ * so moving to a neighbouring item never needs more than following a link to the next (or previous) leaf.
+ * A const_iterator is obtained by using a const-qualified value type.
+ * The past-the-end iterator points behind the last item of the last leaf.
+ * @tparam TVertex The vertex type of the tree
+ * @tparam TVal The value type of the tree (possibly const-qualified)
+ */
+template <typename TVertex, typename TVal>
+class abtree_bplus_iterator: public std::iterator<
+	std::bidirectional_iterator_tag,
+	std::pair<const typename TVertex::key_type, typename std::remove_const<TVal>::type>,
+	std::ptrdiff_t,
+	abtree_arrow_proxy<std::pair<const typename TVertex::key_type &, TVal &> >,
+	std::pair<const typename TVertex::key_type &, TVal &>
+> {
+public:
+	typedef TVertex vertex;
+	typedef typename TVertex::key_type key_type;
+	typedef std::pair<const key_type &, TVal &> reference;
+	typedef abtree_arrow_proxy<reference> pointer;
+	
+	/**
+	 * Parameterless constructor (used only for variable declarations)
+	 */
+	abtree_bplus_iterator ()
+	{}
+	
+	/**
+	 * Move the iterator one item forward (prefix version)
+	 */
+	abtree_bplus_iterator & operator++ ()
+	{
+		position_++;
+		if (position_ == vertex_->item_count && vertex_->next != nullptr) {
+			vertex_ = vertex_->next;
+			position_ = 0;
+		}
+		return *this;
+	}
+	
+	/**
+	 * Move the iterator one item forward (postfix version)
+	 */
+	abtree_bplus_iterator operator++ (int)
+	{
+		auto old = *this;
+		this->operator++();
+		return old;
+	}
+	
+	/**
+	 * Move the iterator one item backward (prefix version)
+	 */
+	abtree_bplus_iterator & operator-- ()
+	{
+		if (position_ == 0 && vertex_->prev != nullptr) {
+			vertex_ = vertex_->prev;
+			position_ = vertex_->item_count;
+		}
+		position_--;
+		return *this;
+	}
+	
+	/**
+	 * Move the iterator one item backward (postfix version)
+	 */
+	abtree_bplus_iterator operator-- (int)
+	{
+		auto old = *this;
+		this->operator--();
+		return old;
+	}
+	
+	reference operator* () const
+	{
+		return reference(vertex_->keys[position_], vertex_->values[position_]);
+	}
+	
+	pointer operator-> () const
+	{
+		return pointer{**this};
+	}
+	
+	/**
+	 * Two iterators are considered equal when they point to the same leaf and position
+	 */
+	bool operator== (const abtree_bplus_iterator & it)
+	{
+		return (
+			position_ == it.position_ &&
+			vertex_ == it.vertex_
+		);
+	}
+	
+	bool operator!= (const abtree_bplus_iterator & it)
+	{
+		return !operator==(it);
+	}
+	
+	/**
+	 * An iterator can always be converted to a const_iterator pointing to the same item
+	 */
+	operator abtree_bplus_iterator<TVertex, TVal const> () const
+	{
+		return abtree_bplus_iterator<TVertex, TVal const>(vertex_, position_);
+	}
+private:
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_bplus;
+	friend class abtree_bplus_iterator<TVertex, typename std::remove_const<TVal>::type>;
+	
+	/**
+	 * Construct an iterator pointing to given position in given leaf
+	 * (Only the abtree_bplus container can construct an iterator this way)
+	 * @param current_vertex the leaf the iterator should point to
+	 * @param position the position of the item the iterator should point to
+	 */
+	abtree_bplus_iterator (vertex * current_vertex, size_t position): vertex_(current_vertex), position_(position)
+	{}
+	
+	vertex * vertex_;
+	size_t position_;
+};
+
+#endif
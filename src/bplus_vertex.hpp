@@ -0,0 +1,125 @@
+#ifndef _ABTREE_BPLUS_VERTEX_HPP_
+#define _ABTREE_BPLUS_VERTEX_HPP_
+
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <memory>
+#include "search.hpp"
+#include "vertex.hpp"
+
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator>
+class abtree_bplus;
+
+/**
+ * A vertex of a B+ variant of an (a, b)-tree.
+ * Leaves hold the items, with keys and values in separate arrays, and they are linked to their
+ * neighbours in both directions. Inner vertices only hold separator keys and pointers to children,
+ * so they don't need any room for values.
+ * Just like abtree_vertex, the header and the arrays live in a single cache-line-aligned block of memory.
+ * @tparam B The maximum number of children if it's known at compile time, 0 otherwise
+ */
+template <typename TKey, typename TVal, size_t B = 0>
+struct abtree_bplus_vertex: private abtree_block_layout<abtree_bplus_vertex<TKey, TVal, B>, TKey, TVal>
+{
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	
+	abtree_bplus_vertex * parent;
+	size_t index; // The position of the vertex among the children of its parent
+	size_t item_count;
+	bool leaf;
+	TKey * keys;
+	TVal * values; // Leaves only
+	abtree_bplus_vertex ** children; // Inner vertices only
+	abtree_bplus_vertex * prev; // Leaves only
+	abtree_bplus_vertex * next; // Leaves only
+	
+	/**
+	 * The destructor. Destroys the keys (and values) that are still stored in the vertex.
+	 */
+	~abtree_bplus_vertex ()
+	{
+		for (size_t i = 0; i < item_count; i++) {
+			keys[i].~TKey();
+			if (leaf) {
+				values[i].~TVal();
+			}
+		}
+	}
+	
+	/**
+	 * Returns the index of the first key that is larger than or equal than given key
+	 * @param key the key to search for
+	 * @return the index of the desired key
+	 */
+	size_t search (const TKey & key) const
+	{
+		return abtree_search<B>(keys, item_count, key);
+	}
+	
+	/**
+	 * Returns the index of the child of an inner vertex whose subtree covers given key.
+	 * A separator is equal to the smallest key of the subtree on its right (at the time it was created),
+	 * so keys equal to a separator belong to the right.
+	 * @param key the key to search for
+	 * @return the index of the child
+	 */
+	size_t child_index (const TKey & key) const
+	{
+		size_t i = search(key);
+		return i < item_count && !(key < keys[i]) ? i + 1 : i;
+	}
+	
+private:
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_bplus;
+	
+	typedef abtree_block_layout<abtree_bplus_vertex, TKey, TVal> layout;
+	friend layout;
+	using layout::cache_line_size;
+	using layout::align;
+	using layout::keys_offset;
+	using layout::values_offset;
+	using layout::children_offset;
+	
+	/**
+	 * Compute the size of the memory block of a vertex (see abtree_block_layout).
+	 * Room is reserved for one more key (and child) than allowed to simplify splitting.
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf (which has values instead of children)
+	 */
+	static size_t block_size (size_t max_children, bool leaf)
+	{
+		size_t size = leaf ? layout::values_end(max_children) : layout::children_end(max_children, max_children + 1);
+		return align(size, cache_line_size);
+	}
+	
+	/**
+	 * Set up the arrays inside the memory block
+	 * @param block the memory block the vertex is placed in
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf
+	 */
+	abtree_bplus_vertex (char * block, size_t max_children, bool leaf)
+		: parent(nullptr), index(0), item_count(0), leaf(leaf), prev(nullptr), next(nullptr)
+	{
+		keys = reinterpret_cast<TKey *>(block + keys_offset());
+		values = leaf ? reinterpret_cast<TVal *>(block + values_offset(max_children)) : nullptr;
+		children = leaf ? nullptr : reinterpret_cast<abtree_bplus_vertex **>(block + children_offset(max_children));
+	}
+	
+	/**
+	 * Place a child at given position of an inner vertex and let the child know where it is
+	 * @param i the position of the child
+	 * @param child the child
+	 */
+	void set_child (size_t i, abtree_bplus_vertex * child)
+	{
+		children[i] = child;
+		child->parent = this;
+		child->index = i;
+	}
+};
+
+#endif
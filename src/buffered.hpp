@@ -0,0 +1,930 @@
+#ifndef _ABTREE_BUFFERED_HPP_
+#define _ABTREE_BUFFERED_HPP_
+
+#include <stdexcept>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include "abtree.hpp"
+#include "buffered_vertex.hpp"
+
+/**
+ * The options of abtree_buffered
+ */
+struct abtree_buffered_options
+{
+	/**
+	 * The number of messages an inner vertex collects before they're moved down
+	 */
+	size_t buffer_size;
+	
+	/**
+	 * Leaves hold less than this many items (and at least about half of that)
+	 */
+	size_t leaf_size;
+	
+	abtree_buffered_options (): buffer_size(128), leaf_size(128)
+	{}
+};
+
+/**
+ * A generic associative container for write-heavy workloads that uses a buffered (B-epsilon) variant
+ * of (a, b)-trees. Items are stored in the leaves, like in abtree_bplus, but changes don't go to the leaves
+ * right away. Each one becomes a message in the buffer of the root, and when a buffer fills up, the messages
+ * for the child that has the most of them are moved down in one batch. A change therefore only touches
+ * the few vertices near the root, which stay in the cache, and the cost of reaching a leaf is shared by
+ * a whole batch of changes.
+ * Lookups check the buffers on their way down, a newer message for a key overrides the older ones below it.
+ * Changes are blind: they don't report whether the key has been present, as that would need a lookup.
+ * There are no iterators, as the items of a range may be scattered over the buffers. Use for_each() and
+ * lower_bound() to read them in order instead.
+ * A batch only saves work if it's much larger than the number of children, so inner vertices should
+ * be small (like (4, 8)), while leaves have a size of their own and can be as large as in abtree_bplus.
+ * @tparam A, B The (a, b) parameters of the inner vertices if they should be fixed at compile time.
+ * If both of them are 0 (the default), the parameters are passed to the constructor instead.
+ * Every inner vertex holds at most b - 1 keys, every non-root inner vertex at least a - 1 keys.
+ * @tparam Allocator A std::allocator-compatible allocator (see abtree)
+ */
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >
+>
+class abtree_buffered: private abtree_params<A, B> {
+	typedef abtree_buffered_vertex<TKey, TVal, B> vertex;
+	typedef abtree_params<A, B> params;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<abtree_cache_line> block_allocator;
+	
+public:
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+	typedef Allocator allocator_type;
+	
+private:
+	using params::a;
+	using params::b;
+	
+	vertex * root;
+	size_t buffer_size_; // A buffer with this many messages gets flushed
+	size_t leaf_size_; // A leaf with this many items gets split
+	size_t size_; // The number of items in the leaves
+	size_t pending_; // The number of messages in the buffers
+	block_allocator alloc_;
+	
+	/**
+	 * Allocate a new vertex using the allocator of the tree.
+	 * A buffer can hold twice as many messages as the flushing limit, so that a batch always fits in.
+	 * @param leaf whether the vertex is a leaf
+	 */
+	vertex * create_vertex (bool leaf)
+	{
+		return vertex::create(alloc_, leaf ? leaf_size_ : b, 2 * buffer_size_, leaf);
+	}
+	
+	/**
+	 * Destroy a vertex and return its memory to the allocator of the tree
+	 */
+	void destroy_vertex (vertex * v)
+	{
+		vertex::destroy(alloc_, v, v->leaf ? leaf_size_ : b, 2 * buffer_size_);
+	}
+	
+	/**
+	 * The smallest number of keys a non-root vertex may hold
+	 */
+	size_t min_keys (const vertex * v) const
+	{
+		return v->leaf ? (leaf_size_ + 1) / 2 - 1 : a - 1;
+	}
+	
+	/**
+	 * Whether a vertex holds too many keys and has to be split
+	 */
+	bool overflows (const vertex * v) const
+	{
+		return v->item_count >= (v->leaf ? leaf_size_ : b);
+	}
+	
+	/**
+	 * Whether a non-root vertex holds too few keys and has to be refilled
+	 */
+	bool underflows (const vertex * v) const
+	{
+		return v->item_count < min_keys(v);
+	}
+	
+	/**
+	 * Check the options given to the constructor
+	 * @throws std::invalid_argument if the buffer size is 0 or the leaf size is less than 3
+	 */
+	void check_options () const
+	{
+		if (buffer_size_ == 0) {
+			throw std::invalid_argument("buffer_size");
+		}
+		if (leaf_size_ < 3) {
+			throw std::invalid_argument("leaf_size");
+		}
+	}
+	
+	/**
+	 * Make the tree consist of a single empty leaf
+	 */
+	void init ()
+	{
+		root = create_vertex(true);
+		size_ = 0;
+		pending_ = 0;
+	}
+	
+	/**
+	 * Destroy all the vertices of the tree (using BFS), leaving the root pointer dangling
+	 */
+	void destroy_tree ()
+	{
+		std::queue<vertex *> queue;
+		queue.push(root);
+		
+		while (queue.size() > 0) {
+			vertex * cursor = queue.front();
+			if (!cursor->leaf) {
+				for (size_t i = 0; i <= cursor->item_count; i++) {
+					queue.push(cursor->children[i]);
+				}
+			}
+			destroy_vertex(cursor);
+			queue.pop();
+		}
+	}
+	
+	/**
+	 * Apply a message to the leaf whose range covers its key
+	 * @param leaf the leaf
+	 * @param key the key of the message
+	 * @param type the type of the message
+	 * @param value the value of the message (moved from if needed), nullptr for an erase
+	 */
+	template <typename K>
+	void apply_message (vertex * leaf, K && key, unsigned char type, TVal * value)
+	{
+		size_t i = leaf->search(key);
+		bool present = i < leaf->item_count && leaf->keys[i] == key;
+		
+		if (type == abtree_message_erase) {
+			if (present) {
+				leaf->keys[i].~TKey();
+				leaf->values[i].~TVal();
+				for (size_t j = i + 1; j < leaf->item_count; j++) {
+					leaf->move_item(j, leaf, j - 1);
+				}
+				leaf->item_count--;
+				size_--;
+			}
+		} else if (present) {
+			if (type == abtree_message_assign) {
+				leaf->values[i] = std::move(*value);
+			}
+		} else {
+			for (size_t j = leaf->item_count; j > i; j--) {
+				leaf->move_item(j - 1, leaf, j);
+			}
+			leaf->construct_item(i, std::forward<K>(key), std::move(*value));
+			leaf->item_count++;
+			size_++;
+		}
+	}
+	
+	/**
+	 * Split an overflowing child of given vertex in half. The new vertex is inserted right after it.
+	 * A copy of the first key of a new leaf becomes the separator, an inner vertex gives its middle key
+	 * to the parent, together with the messages that belong to the new vertex.
+	 * @param parent the parent of the vertex to be split, which must have room for another key
+	 * @param i the position of the vertex in the parent's children
+	 */
+	void split_child (vertex * parent, size_t i)
+	{
+		vertex * child = parent->children[i];
+		vertex * sibling = create_vertex(child->leaf);
+		size_t middle = child->item_count / 2;
+		
+		for (size_t j = parent->item_count; j > i; j--) {
+			parent->move_key(j - 1, parent, j);
+		}
+		for (size_t j = parent->item_count + 1; j > i + 1; j--) {
+			parent->children[j] = parent->children[j - 1];
+		}
+		
+		if (child->leaf) {
+			for (size_t j = middle; j < child->item_count; j++) {
+				child->move_item(j, sibling, j - middle);
+			}
+			sibling->item_count = child->item_count - middle;
+			new (&parent->keys[i]) TKey(sibling->keys[0]);
+		} else {
+			size_t first = child->message_search(child->keys[middle]);
+			for (size_t j = first; j < child->message_count; j++) {
+				child->move_message(j, sibling, j - first);
+			}
+			sibling->message_count = child->message_count - first;
+			child->message_count = first;
+			
+			for (size_t j = middle + 1; j < child->item_count; j++) {
+				child->move_key(j, sibling, j - (middle + 1));
+			}
+			for (size_t j = middle + 1; j <= child->item_count; j++) {
+				sibling->children[j - (middle + 1)] = child->children[j];
+			}
+			sibling->item_count = child->item_count - (middle + 1);
+			child->move_key(middle, parent, i);
+		}
+		
+		child->item_count = middle;
+		parent->children[i + 1] = sibling;
+		parent->item_count++;
+	}
+	
+	/**
+	 * Refill the i-th child of given vertex, so that it has enough keys again.
+	 * An item (or a child) is borrowed from a neighbour that can spare it, otherwise the vertex
+	 * gets merged with a neighbour. The parent itself may be left with too few keys.
+	 * @param parent The parent of the vertex to be refilled, it must have at least two children
+	 * @param i The position of the vertex in the parent's children
+	 * @return the position of the refilled vertex afterwards
+	 */
+	size_t refill_child (vertex * parent, size_t i)
+	{
+		if (i > 0 && parent->children[i - 1]->item_count > min_keys(parent->children[i - 1])) {
+			borrow_from_left(parent, i);
+		} else if (i < parent->item_count && parent->children[i + 1]->item_count > min_keys(parent->children[i + 1])) {
+			borrow_from_right(parent, i);
+		} else if (i > 0) {
+			merge_children(parent, --i);
+		} else {
+			merge_children(parent, 0);
+		}
+		return i;
+	}
+	
+	/**
+	 * Move the last item (or child) of the left neighbour of the i-th child of parent to that child.
+	 * The messages for a moved child move along with it.
+	 */
+	void borrow_from_left (vertex * parent, size_t i)
+	{
+		vertex * cursor = parent->children[i];
+		vertex * neighbour = parent->children[i - 1];
+		
+		if (cursor->leaf) {
+			for (size_t j = cursor->item_count; j > 0; j--) {
+				cursor->move_item(j - 1, cursor, j);
+			}
+			neighbour->move_item(neighbour->item_count - 1, cursor, 0);
+			parent->keys[i - 1] = cursor->keys[0];
+		} else {
+			size_t first = neighbour->message_search(neighbour->keys[neighbour->item_count - 1]);
+			size_t count = neighbour->message_count - first;
+			for (size_t j = cursor->message_count; j > 0 && count > 0; j--) {
+				cursor->move_message(j - 1, cursor, j + count - 1);
+			}
+			for (size_t j = 0; j < count; j++) {
+				neighbour->move_message(first + j, cursor, j);
+			}
+			cursor->message_count += count;
+			neighbour->message_count = first;
+			
+			for (size_t j = cursor->item_count; j > 0; j--) {
+				cursor->move_key(j - 1, cursor, j);
+			}
+			for (size_t j = cursor->item_count + 1; j > 0; j--) {
+				cursor->children[j] = cursor->children[j - 1];
+			}
+			parent->move_key(i - 1, cursor, 0);
+			cursor->children[0] = neighbour->children[neighbour->item_count];
+			neighbour->move_key(neighbour->item_count - 1, parent, i - 1);
+		}
+		
+		cursor->item_count++;
+		neighbour->item_count--;
+	}
+	
+	/**
+	 * Move the first item (or child) of the right neighbour of the i-th child of parent to that child.
+	 * The messages for a moved child move along with it.
+	 */
+	void borrow_from_right (vertex * parent, size_t i)
+	{
+		vertex * cursor = parent->children[i];
+		vertex * neighbour = parent->children[i + 1];
+		
+		if (cursor->leaf) {
+			neighbour->move_item(0, cursor, cursor->item_count);
+			for (size_t j = 1; j < neighbour->item_count; j++) {
+				neighbour->move_item(j, neighbour, j - 1);
+			}
+			parent->keys[i] = neighbour->keys[0];
+		} else {
+			size_t count = neighbour->message_search(neighbour->keys[0]);
+			for (size_t j = 0; j < count; j++) {
+				neighbour->move_message(j, cursor, cursor->message_count + j);
+			}
+			cursor->message_count += count;
+			neighbour->close_messages(0, count);
+			
+			parent->move_key(i, cursor, cursor->item_count);
+			cursor->children[cursor->item_count + 1] = neighbour->children[0];
+			neighbour->move_key(0, parent, i);
+			for (size_t j = 1; j < neighbour->item_count; j++) {
+				neighbour->move_key(j, neighbour, j - 1);
+			}
+			for (size_t j = 0; j < neighbour->item_count; j++) {
+				neighbour->children[j] = neighbour->children[j + 1];
+			}
+		}
+		
+		cursor->item_count++;
+		neighbour->item_count--;
+	}
+	
+	/**
+	 * Merge the k-th and (k + 1)-th child of given vertex, together with their buffers.
+	 * The separator between them is dropped (in case of leaves) or moved down (in case of inner vertices).
+	 * The parent itself may be left with too few keys.
+	 * @param parent The parent of the merged vertices
+	 * @param k The position of the separator between them
+	 */
+	void merge_children (vertex * parent, size_t k)
+	{
+		vertex * left = parent->children[k];
+		vertex * right = parent->children[k + 1];
+		
+		if (left->leaf) {
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->move_item(j, left, left->item_count + j);
+			}
+			parent->keys[k].~TKey();
+		} else {
+			for (size_t j = 0; j < right->message_count; j++) {
+				right->move_message(j, left, left->message_count + j);
+			}
+			left->message_count += right->message_count;
+			right->message_count = 0;
+			
+			parent->move_key(k, left, left->item_count);
+			left->item_count++;
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->move_key(j, left, left->item_count + j);
+			}
+			for (size_t j = 0; j <= right->item_count; j++) {
+				left->children[left->item_count + j] = right->children[j];
+			}
+		}
+		left->item_count += right->item_count;
+		right->item_count = 0;
+		destroy_vertex(right);
+		
+		for (size_t j = k + 1; j < parent->item_count; j++) {
+			parent->move_key(j, parent, j - 1);
+			parent->children[j] = parent->children[j + 1];
+		}
+		parent->item_count--;
+	}
+	
+	/**
+	 * Bring all the children of given vertex back into shape: split the ones that overflow, flush the full
+	 * buffers and refill the ones with too few keys. The vertex itself may end up with too many or too few
+	 * keys, which is left to its parent. If it gets full, the remaining children are left for later as well.
+	 * Full buffers are flushed before any vertices get merged, so a merged buffer always has enough room.
+	 * @param v an inner vertex
+	 */
+	void settle (vertex * v)
+	{
+		const size_t none = size_t(-1);
+		while (v->item_count < b) {
+			size_t overflowing = none, flushing = none, underflowing = none;
+			for (size_t i = 0; i <= v->item_count && overflowing == none; i++) {
+				vertex * child = v->children[i];
+				if (overflows(child)) {
+					overflowing = i;
+				} else if (!child->leaf && child->message_count >= buffer_size_ && flushing == none) {
+					flushing = i;
+				} else if (underflows(child) && underflowing == none) {
+					underflowing = i;
+				}
+			}
+			
+			if (overflowing != none) {
+				split_child(v, overflowing);
+				if (!v->children[overflowing]->leaf) {
+					settle(v->children[overflowing]);
+					settle(v->children[overflowing + 1]);
+				}
+			} else if (flushing != none) {
+				flush_vertex(v->children[flushing], buffer_size_ - 1);
+			} else if (underflowing != none && v->item_count > 0) {
+				// A vertex with a single child couldn't refill that child, it may be able to do so now
+				vertex * child = v->children[refill_child(v, underflowing)];
+				if (!child->leaf) {
+					settle(child);
+				}
+			} else {
+				return;
+			}
+		}
+	}
+	
+	/**
+	 * Move messages from the buffer of given vertex down to its children until at most limit messages
+	 * are left. Each time, all the messages for the child that has the most of them are moved at once:
+	 * a leaf gets them applied, an inner vertex gets them merged into its buffer (which may be flushed
+	 * in turn). The vertices below are kept in shape, but the vertex itself may end up with too many
+	 * or too few keys. If it gets full, the flushing stops early and is left to its parent.
+	 * @param v an inner vertex
+	 * @param limit the number of messages that may remain
+	 */
+	void flush_vertex (vertex * v, size_t limit)
+	{
+		while (v->message_count > limit && v->item_count < b) {
+			size_t best = 0, best_from = 0, best_count = 0;
+			for (size_t i = 0, from = 0; i <= v->item_count; i++) {
+				size_t to = i < v->item_count ? v->message_search(v->keys[i]) : v->message_count;
+				if (to - from > best_count) {
+					best = i;
+					best_from = from;
+					best_count = to - from;
+				}
+				from = to;
+			}
+			
+			vertex * child = v->children[best];
+			if (child->leaf) {
+				// The leaf may split or merge on the way, so each message looks its leaf up again
+				size_t applied = 0;
+				while (applied < best_count && v->item_count < b) {
+					size_t k = best_from + applied;
+					size_t i = v->child_index(v->message_keys[k]);
+					vertex * leaf = v->children[i];
+					unsigned char type = v->message_types[k];
+					apply_message(leaf, std::move(v->message_keys[k]), type, type == abtree_message_erase ? nullptr : &v->message_values[k]);
+					v->destroy_message(k);
+					applied++;
+					
+					if (overflows(leaf)) {
+						split_child(v, i);
+					} else if (underflows(leaf) && v->item_count > 0) {
+						refill_child(v, i);
+					}
+				}
+				v->close_messages(best_from, applied);
+				pending_ -= applied;
+			} else {
+				size_t count = std::min(best_count, 2 * buffer_size_ - child->message_count);
+				pending_ -= child->merge_messages(v, best_from, count);
+				v->close_messages(best_from, count);
+				settle(v);
+			}
+		}
+	}
+	
+	/**
+	 * Flush all the buffers in the subtree of given vertex. If the vertex gets full on the way,
+	 * it stops early and its parent has to split it and drain both halves again.
+	 * @param v a vertex
+	 * @return false if it has stopped early
+	 */
+	bool drain (vertex * v)
+	{
+		if (v->leaf) {
+			return true;
+		}
+		flush_vertex(v, 0);
+		if (v->item_count >= b) {
+			return false;
+		}
+		
+		for (size_t i = 0; i <= v->item_count; ) {
+			if (drain(v->children[i])) {
+				i++;
+				continue;
+			}
+			split_child(v, i);
+			if (v->item_count >= b) {
+				return false;
+			}
+		}
+		settle(v);
+		return v->item_count < b;
+	}
+	
+	/**
+	 * Bring the root back into shape after a change: grow the tree if the root overflows, flush
+	 * its buffer if it's full and shrink the tree if the root has a single child and no messages
+	 */
+	void fix_root ()
+	{
+		for (;;) {
+			if (overflows(root)) {
+				vertex * new_root = create_vertex(false);
+				new_root->children[0] = root;
+				root = new_root;
+				settle(root);
+			} else if (root->leaf) {
+				return;
+			} else if (root->message_count >= buffer_size_) {
+				flush_vertex(root, buffer_size_ - 1);
+			} else if (root->item_count == 0 && root->message_count > 0) {
+				flush_vertex(root, 0);
+			} else if (root->item_count == 0) {
+				vertex * old_root = root;
+				root = root->children[0];
+				destroy_vertex(old_root);
+			} else {
+				return;
+			}
+		}
+	}
+	
+	/**
+	 * Add a message to the buffer of the root (or apply it right away if the root is a leaf)
+	 * @param key the key of the message
+	 * @param type the type of the message
+	 * @param value the value of the message (moved from), nullptr for an erase
+	 */
+	template <typename K>
+	void put (K && key, unsigned char type, TVal * value)
+	{
+		if (root->leaf) {
+			apply_message(root, std::forward<K>(key), type, value);
+		} else if (root->put_message(std::forward<K>(key), type, value)) {
+			pending_++;
+		}
+		fix_root();
+	}
+	
+	/**
+	 * Take a message for the key being looked up into account. Lookups meet the messages
+	 * from the newest to the oldest one.
+	 * @param v the vertex that holds the message
+	 * @param i the position of the message
+	 * @param emplaced the value of the oldest emplace met so far, which is used if the key turns out
+	 * to be absent below
+	 * @param result set to the value of the item, or nullptr if it's absent, when the message decides it
+	 * @return whether the message decides the result of the lookup
+	 */
+	static bool resolve (const vertex * v, size_t i, const TVal *& emplaced, const TVal *& result)
+	{
+		switch (v->message_types[i]) {
+			case abtree_message_assign:
+				result = &v->message_values[i];
+				return true;
+			case abtree_message_erase:
+				result = emplaced;
+				return true;
+			default:
+				emplaced = &v->message_values[i];
+				return false;
+		}
+	}
+	
+	/**
+	 * Visit the items of a subtree in the order of their keys, with all the pending messages applied.
+	 * The messages for a leaf are spread over the buffers of its ancestors, so a leaf is merged with
+	 * the parts of those buffers that fall into its range.
+	 * @param v the root of the subtree
+	 * @param lo, hi the range of keys covered by the subtree (nullptr if unbounded)
+	 * @param from the smallest key to visit (nullptr to visit all)
+	 * @param path the ancestors of the subtree, from the root down
+	 * @param heads scratch space for the positions in the buffers of the ancestors
+	 * @param f called with the key and the value of each item, returns false to stop the visit
+	 * @return false if the visit has been stopped
+	 */
+	template <typename F>
+	bool visit (const vertex * v, const TKey * lo, const TKey * hi, const TKey * from, std::vector<const vertex *> & path, std::vector<size_t> & heads, F & f) const
+	{
+		if (!v->leaf) {
+			path.push_back(v);
+			for (size_t i = from != nullptr ? v->child_index(*from) : 0; i <= v->item_count; i++) {
+				const TKey * child_lo = i > 0 ? &v->keys[i - 1] : lo;
+				const TKey * child_hi = i < v->item_count ? &v->keys[i] : hi;
+				if (!visit(v->children[i], child_lo, child_hi, from, path, heads, f)) {
+					path.pop_back();
+					return false;
+				}
+			}
+			path.pop_back();
+			return true;
+		}
+		
+		// Messages for keys before the range of the leaf belong to the leaves before it
+		const TKey * start = from != nullptr && (lo == nullptr || !(*from < *lo)) ? from : lo;
+		size_t depth = path.size();
+		heads.resize(2 * depth);
+		for (size_t p = 0; p < depth; p++) {
+			heads[2 * p] = start != nullptr ? path[p]->message_search(*start) : 0;
+			heads[2 * p + 1] = hi != nullptr ? path[p]->message_search(*hi) : path[p]->message_count;
+		}
+		size_t j = from != nullptr ? v->search(*from) : 0;
+		
+		for (;;) {
+			const TKey * key = j < v->item_count ? &v->keys[j] : nullptr;
+			for (size_t p = 0; p < depth; p++) {
+				if (heads[2 * p] < heads[2 * p + 1] && (key == nullptr || path[p]->message_keys[heads[2 * p]] < *key)) {
+					key = &path[p]->message_keys[heads[2 * p]];
+				}
+			}
+			if (key == nullptr) {
+				return true;
+			}
+			
+			const TVal * emplaced = nullptr;
+			const TVal * result = nullptr;
+			bool known = false;
+			for (size_t p = 0; p < depth && !known; p++) {
+				if (heads[2 * p] < heads[2 * p + 1] && path[p]->message_keys[heads[2 * p]] == *key) {
+					known = resolve(path[p], heads[2 * p], emplaced, result);
+				}
+			}
+			bool present = j < v->item_count && v->keys[j] == *key;
+			if (!known) {
+				result = present ? &v->values[j] : emplaced;
+			}
+			if (result != nullptr && !f(*key, *result)) {
+				return false;
+			}
+			
+			for (size_t p = 0; p < depth; p++) {
+				if (heads[2 * p] < heads[2 * p + 1] && path[p]->message_keys[heads[2 * p]] == *key) {
+					heads[2 * p]++;
+				}
+			}
+			if (present) {
+				j++;
+			}
+		}
+	}
+	
+	/**
+	 * Visit the items of the tree from given key on (see visit())
+	 */
+	template <typename F>
+	void visit_from (const TKey * from, F & f) const
+	{
+		std::vector<const vertex *> path;
+		std::vector<size_t> heads;
+		visit(root, nullptr, nullptr, from, path, heads, f);
+	}
+	
+public:
+	/**
+	 * The basic constructor
+	 * @param a The minimum number of children for all non-root inner vertices (has to be at least 2)
+	 * @param b The maximum number of children for all inner vertices (has to be at least (2 * a) - 1)
+	 * @param options The sizes of the buffers and of the leaves
+	 * @param alloc The allocator used for the vertices of the tree
+	 * @throws std::invalid_argument if a and b don't meet (a, b)-tree conditions, the buffer size is 0
+	 * or the leaf size is less than 3
+	 */
+	abtree_buffered (size_t a, size_t b, const abtree_buffered_options & options = abtree_buffered_options(), const Allocator & alloc = Allocator())
+		: params(a, b), buffer_size_(options.buffer_size), leaf_size_(options.leaf_size), alloc_(alloc)
+	{
+		check_options();
+		init();
+	}
+	
+	/**
+	 * The constructor of a tree whose (a, b) parameters are given as template arguments
+	 * @param options The sizes of the buffers and of the leaves
+	 * @param alloc The allocator used for the vertices of the tree
+	 * @throws std::invalid_argument if the buffer size is 0 or the leaf size is less than 3
+	 */
+	explicit abtree_buffered (const abtree_buffered_options & options = abtree_buffered_options(), const Allocator & alloc = Allocator())
+		: buffer_size_(options.buffer_size), leaf_size_(options.leaf_size), alloc_(alloc)
+	{
+		check_options();
+		init();
+	}
+	
+	/**
+	 * The move constructor. The other tree is left empty.
+	 */
+	abtree_buffered (abtree_buffered && other)
+		: params(other), root(other.root), buffer_size_(other.buffer_size_), leaf_size_(other.leaf_size_), size_(other.size_), pending_(other.pending_), alloc_(other.alloc_)
+	{
+		other.init();
+	}
+	
+	abtree_buffered (const abtree_buffered &) = delete;
+	abtree_buffered & operator= (const abtree_buffered &) = delete;
+	
+	/**
+	 * The destructor
+	 */
+	~abtree_buffered ()
+	{
+		destroy_tree();
+	}
+	
+	/**
+	 * Find the value associated with given key. The buffers on the way down are checked first.
+	 * @param key the key to search for
+	 * @param value set to a copy of the value if the key is present, left untouched otherwise
+	 * @return whether the key is present
+	 */
+	bool find (const key_type & key, mapped_type & value) const
+	{
+		const TVal * emplaced = nullptr;
+		const TVal * result = nullptr;
+		bool known = false;
+		
+		const vertex * cursor = root;
+		while (!cursor->leaf && !known) {
+			size_t i = cursor->message_search(key);
+			if (i < cursor->message_count && cursor->message_keys[i] == key) {
+				known = resolve(cursor, i, emplaced, result);
+			}
+			cursor = cursor->children[cursor->child_index(key)];
+		}
+		
+		if (!known) {
+			while (!cursor->leaf) {
+				cursor = cursor->children[cursor->child_index(key)];
+			}
+			size_t i = cursor->search(key);
+			result = i < cursor->item_count && cursor->keys[i] == key ? &cursor->values[i] : emplaced;
+		}
+		
+		if (result == nullptr) {
+			return false;
+		}
+		value = *result;
+		return true;
+	}
+	
+	/**
+	 * Check whether given key is present
+	 */
+	bool contains (const key_type & key) const
+	{
+		mapped_type value;
+		return find(key, value);
+	}
+	
+	/**
+	 * Find the item with the smallest key that is larger than or equal to given key
+	 * @param key the key to search for
+	 * @param found_key set to a copy of the key of the item if there's one, left untouched otherwise
+	 * @param value set to a copy of the value of the item if there's one, left untouched otherwise
+	 * @return whether there's such an item
+	 */
+	bool lower_bound (const key_type & key, key_type & found_key, mapped_type & value) const
+	{
+		bool found = false;
+		auto f = [&found, &found_key, &value] (const key_type & k, const mapped_type & v) {
+			found_key = k;
+			value = v;
+			found = true;
+			return false;
+		};
+		visit_from(&key, f);
+		return found;
+	}
+	
+	/**
+	 * Call given function with the key and the value of every item, in the order of the keys
+	 * @param f a function that takes a const key_type & and a const mapped_type &
+	 */
+	template <typename F>
+	void for_each (F f) const
+	{
+		auto g = [&f] (const key_type & k, const mapped_type & v) {
+			f(k, v);
+			return true;
+		};
+		visit_from(nullptr, g);
+	}
+	
+	/**
+	 * @name Insert an item into the tree. If there's already an item with the same key in the tree,
+	 * its value gets replaced by the value of the new item.
+	 * @param pair The item that gets copied (or moved) into the tree
+	 */
+	//@{
+	void insert (const value_type & pair)
+	{
+		mapped_type value(pair.second);
+		put(pair.first, abtree_message_assign, &value);
+	}
+	
+	void insert (value_type && pair)
+	{
+		mapped_type value(std::move(pair.second));
+		put(pair.first, abtree_message_assign, &value);
+	}
+	//@}
+	
+	/**
+	 * @name If there's no item with given key in the tree, insert one whose value is constructed
+	 * from given arguments. Otherwise, nothing happens. Unlike abtree::try_emplace(), the value is
+	 * always constructed, as it isn't known yet whether the key is present.
+	 * @param key The key of the item
+	 * @param args The arguments passed to the constructor of mapped_type
+	 */
+	//@{
+	template <typename... Args>
+	void try_emplace (const key_type & key, Args &&... args)
+	{
+		mapped_type value(std::forward<Args>(args)...);
+		put(key, abtree_message_emplace, &value);
+	}
+	
+	template <typename... Args>
+	void try_emplace (key_type && key, Args &&... args)
+	{
+		mapped_type value(std::forward<Args>(args)...);
+		put(std::move(key), abtree_message_emplace, &value);
+	}
+	//@}
+	
+	/**
+	 * @name Insert an item with given key and value, or assign the value to the item if the key is already present
+	 * @param key The key of the item
+	 * @param value The value of the item
+	 */
+	//@{
+	template <typename M>
+	void insert_or_assign (const key_type & key, M && value)
+	{
+		mapped_type v(std::forward<M>(value));
+		put(key, abtree_message_assign, &v);
+	}
+	
+	template <typename M>
+	void insert_or_assign (key_type && key, M && value)
+	{
+		mapped_type v(std::forward<M>(value));
+		put(std::move(key), abtree_message_assign, &v);
+	}
+	//@}
+	
+	/**
+	 * Erase the item with given key from the tree. If such item isn't present in the tree, don't do anything.
+	 * @param key The key of the item to be erased
+	 */
+	void erase (const key_type & key)
+	{
+		put(key, abtree_message_erase, nullptr);
+	}
+	
+	/**
+	 * Move all the messages down to the leaves. Lookups are then as fast as in abtree_bplus,
+	 * until the buffers fill up again.
+	 */
+	void flush ()
+	{
+		if (pending_ == 0) {
+			return;
+		}
+		while (!drain(root)) {
+			fix_root();
+		}
+		fix_root();
+	}
+	
+	/**
+	 * Get a copy of the allocator the tree was constructed with
+	 */
+	allocator_type get_allocator () const
+	{
+		return allocator_type(alloc_);
+	}
+	
+	/**
+	 * Get the total number of items in the tree. The number isn't known while some messages are pending,
+	 * so the buffers are flushed first.
+	 * @return the number of items
+	 */
+	size_t size ()
+	{
+		flush();
+		return size_;
+	}
+	
+	/**
+	 * Find out whether the tree is empty
+	 * @return True if the tree is empty, false otherwise
+	 */
+	bool empty () const
+	{
+		bool found = false;
+		auto f = [&found] (const key_type &, const mapped_type &) {
+			found = true;
+			return false;
+		};
+		visit_from(nullptr, f);
+		return !found;
+	}
+};
+
+#endif
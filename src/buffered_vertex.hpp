@@ -0,0 +1,309 @@
+#ifndef _ABTREE_BUFFERED_VERTEX_HPP_
+#define _ABTREE_BUFFERED_VERTEX_HPP_
+
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <memory>
+#include "search.hpp"
+#include "vertex.hpp"
+
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator>
+class abtree_buffered;
+
+/**
+ * The kinds of changes that wait in the buffers of abtree_buffered
+ */
+enum abtree_message_type
+{
+	abtree_message_assign, // Insert the item or replace its value
+	abtree_message_emplace, // Insert the item unless the key is present
+	abtree_message_erase // Erase the item if it's present
+};
+
+/**
+ * A vertex of a buffered (B-epsilon) variant of an (a, b)-tree.
+ * Leaves hold the items, inner vertices hold separator keys, pointers to children and a buffer
+ * of messages (changes that haven't reached the leaves yet). The buffer is sorted by key and holds
+ * at most one message per key, so a newer message for the same key is combined with the older one.
+ * A message only has a value if it isn't an erase.
+ * Just like abtree_vertex, the header and the arrays live in a single cache-line-aligned block of memory.
+ * @tparam B The maximum number of children of an inner vertex if it's known at compile time, 0 otherwise
+ */
+template <typename TKey, typename TVal, size_t B = 0>
+struct abtree_buffered_vertex: private abtree_block_layout<abtree_buffered_vertex<TKey, TVal, B>, TKey, TVal>
+{
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	
+	size_t item_count;
+	size_t message_count; // Inner vertices only
+	bool leaf;
+	TKey * keys;
+	TVal * values; // Leaves only
+	abtree_buffered_vertex ** children; // Inner vertices only
+	TKey * message_keys; // Inner vertices only
+	TVal * message_values; // Inner vertices only
+	unsigned char * message_types; // Inner vertices only
+	
+	/**
+	 * The destructor. Destroys the keys, values and messages that are still stored in the vertex.
+	 */
+	~abtree_buffered_vertex ()
+	{
+		for (size_t i = 0; i < item_count; i++) {
+			keys[i].~TKey();
+			if (leaf) {
+				values[i].~TVal();
+			}
+		}
+		for (size_t i = 0; i < message_count; i++) {
+			destroy_message(i);
+		}
+	}
+	
+	/**
+	 * Returns the index of the first key that is larger than or equal than given key.
+	 * Leaves have a capacity of their own, so the compile-time bound only applies to inner vertices.
+	 * @param key the key to search for
+	 * @return the index of the desired key
+	 */
+	size_t search (const TKey & key) const
+	{
+		return leaf ? abtree_search<0>(keys, item_count, key) : abtree_search<B>(keys, item_count, key);
+	}
+	
+	/**
+	 * Returns the index of the child of an inner vertex whose subtree covers given key.
+	 * Keys equal to a separator belong to the right (see abtree_bplus_vertex).
+	 * @param key the key to search for
+	 * @return the index of the child
+	 */
+	size_t child_index (const TKey & key) const
+	{
+		size_t i = search(key);
+		return i < item_count && !(key < keys[i]) ? i + 1 : i;
+	}
+	
+	/**
+	 * Returns the index of the first message whose key is larger than or equal to given key
+	 */
+	size_t message_search (const TKey & key) const
+	{
+		return abtree_search<0>(message_keys, message_count, key);
+	}
+	
+private:
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_buffered;
+	
+	typedef abtree_block_layout<abtree_buffered_vertex, TKey, TVal> layout;
+	friend layout;
+	using layout::cache_line_size;
+	using layout::align;
+	using layout::keys_offset;
+	using layout::values_offset;
+	using layout::children_offset;
+	
+	/**
+	 * @name Offsets of the buffer in the memory block of an inner vertex, behind its children
+	 * (see abtree_block_layout for the other arrays)
+	 */
+	//@{
+	static size_t message_keys_offset (size_t max_children)
+	{
+		return align(layout::children_end(max_children, max_children + 1), alignof(TKey));
+	}
+	
+	static size_t message_values_offset (size_t max_children, size_t max_messages)
+	{
+		return align(message_keys_offset(max_children) + max_messages * sizeof(TKey), alignof(TVal));
+	}
+	
+	static size_t message_types_offset (size_t max_children, size_t max_messages)
+	{
+		return message_values_offset(max_children, max_messages) + max_messages * sizeof(TVal);
+	}
+	//@}
+	
+	/**
+	 * Compute the size of the memory block of a vertex.
+	 * Room is reserved for one more key (and child) than allowed to simplify splitting.
+	 * @param max_children specifies the maximum amount of children
+	 * @param max_messages specifies the room for messages of an inner vertex
+	 * @param leaf whether the vertex is a leaf (which has values instead of children and messages)
+	 */
+	static size_t block_size (size_t max_children, size_t max_messages, bool leaf)
+	{
+		size_t size = leaf ? layout::values_end(max_children) : message_types_offset(max_children, max_messages) + max_messages;
+		return align(size, cache_line_size);
+	}
+	
+	/**
+	 * Set up the arrays inside the memory block
+	 * @param block the memory block the vertex is placed in
+	 * @param max_children specifies the maximum amount of children
+	 * @param max_messages specifies the room for messages of an inner vertex
+	 * @param leaf whether the vertex is a leaf
+	 */
+	abtree_buffered_vertex (char * block, size_t max_children, size_t max_messages, bool leaf)
+		: item_count(0), message_count(0), leaf(leaf)
+	{
+		keys = reinterpret_cast<TKey *>(block + keys_offset());
+		if (leaf) {
+			values = reinterpret_cast<TVal *>(block + values_offset(max_children));
+			children = nullptr;
+			message_keys = nullptr;
+			message_values = nullptr;
+			message_types = nullptr;
+		} else {
+			values = nullptr;
+			children = reinterpret_cast<abtree_buffered_vertex **>(block + children_offset(max_children));
+			message_keys = reinterpret_cast<TKey *>(block + message_keys_offset(max_children));
+			message_values = reinterpret_cast<TVal *>(block + message_values_offset(max_children, max_messages));
+			message_types = reinterpret_cast<unsigned char *>(block + message_types_offset(max_children, max_messages));
+		}
+	}
+	
+	/**
+	 * Move the message at position from to position to of the target vertex (which might be this vertex).
+	 * The target position must be unoccupied, the source position is left unoccupied.
+	 * The message counts aren't changed.
+	 */
+	void move_message (size_t from, abtree_buffered_vertex * target, size_t to)
+	{
+		new (&target->message_keys[to]) TKey(std::move(message_keys[from]));
+		target->message_types[to] = message_types[from];
+		if (message_types[from] != abtree_message_erase) {
+			new (&target->message_values[to]) TVal(std::move(message_values[from]));
+		}
+		destroy_message(from);
+	}
+	
+	/**
+	 * Destroy the key and the value of a message, leaving its position unoccupied
+	 */
+	void destroy_message (size_t i)
+	{
+		message_keys[i].~TKey();
+		if (message_types[i] != abtree_message_erase) {
+			message_values[i].~TVal();
+		}
+	}
+	
+	/**
+	 * Apply a newer message for the same key to the message at given position, so that the result
+	 * has the same effect as both messages applied one after another
+	 * @param i the position of the older message
+	 * @param type the type of the newer message
+	 * @param value the value of the newer message (moved from if needed), nullptr for an erase
+	 */
+	void combine_message (size_t i, unsigned char type, TVal * value)
+	{
+		if (type == abtree_message_erase) {
+			if (message_types[i] != abtree_message_erase) {
+				message_values[i].~TVal();
+			}
+			message_types[i] = abtree_message_erase;
+		} else if (message_types[i] == abtree_message_erase) {
+			// The key is surely absent after the erase, so both kinds of insertion just assign
+			new (&message_values[i]) TVal(std::move(*value));
+			message_types[i] = abtree_message_assign;
+		} else if (type == abtree_message_assign) {
+			message_values[i] = std::move(*value);
+			message_types[i] = abtree_message_assign;
+		}
+		// An emplace after an emplace or an assign doesn't change anything
+	}
+	
+	/**
+	 * Add a message to the buffer, combining it with an older message for the same key
+	 * @param key the key of the message
+	 * @param type the type of the message
+	 * @param value the value of the message (moved from if needed), nullptr for an erase
+	 * @return whether the buffer has grown
+	 */
+	template <typename K>
+	bool put_message (K && key, unsigned char type, TVal * value)
+	{
+		size_t i = message_search(key);
+		if (i < message_count && message_keys[i] == key) {
+			combine_message(i, type, value);
+			return false;
+		}
+		
+		for (size_t j = message_count; j > i; j--) {
+			move_message(j - 1, this, j);
+		}
+		new (&message_keys[i]) TKey(std::forward<K>(key));
+		message_types[i] = type;
+		if (type != abtree_message_erase) {
+			new (&message_values[i]) TVal(std::move(*value));
+		}
+		message_count++;
+		return true;
+	}
+	
+	/**
+	 * Move a range of messages of another vertex into this buffer. They are newer than the messages
+	 * in this buffer, so they get combined with them. The messages are merged from the back, so the
+	 * buffer needs room for all of them, and the range is left unoccupied in the source.
+	 * @param source the vertex the messages come from
+	 * @param from the position of the first message
+	 * @param count the number of messages
+	 * @return the number of messages that have been combined with an older one
+	 */
+	size_t merge_messages (abtree_buffered_vertex * source, size_t from, size_t count)
+	{
+		size_t i = message_count; // One past the next older message
+		size_t j = count; // One past the next newer message
+		size_t to = message_count + count; // One past the next free position
+		
+		while (j > 0) {
+			size_t k = from + j - 1;
+			if (i > 0 && source->message_keys[k] < message_keys[i - 1]) {
+				move_message(i - 1, this, to - 1);
+				i--;
+			} else if (i > 0 && source->message_keys[k] == message_keys[i - 1]) {
+				bool erase = source->message_types[k] == abtree_message_erase;
+				combine_message(i - 1, source->message_types[k], erase ? nullptr : &source->message_values[k]);
+				source->destroy_message(k);
+				move_message(i - 1, this, to - 1);
+				i--;
+				j--;
+			} else {
+				source->move_message(k, this, to - 1);
+				j--;
+			}
+			to--;
+		}
+		
+		// Close the gap left by the combined messages
+		size_t combined = to - i;
+		if (combined > 0) {
+			for (size_t k = to; k < message_count + count; k++) {
+				move_message(k, this, k - combined);
+			}
+		}
+		message_count += count - combined;
+		return combined;
+	}
+	
+	/**
+	 * Remove a range of unoccupied positions from the buffer by moving the following messages down
+	 * @param from the first unoccupied position
+	 * @param count the number of unoccupied positions
+	 */
+	void close_messages (size_t from, size_t count)
+	{
+		if (count == 0) {
+			return;
+		}
+		for (size_t i = from + count; i < message_count; i++) {
+			move_message(i, this, i - count);
+		}
+		message_count -= count;
+	}
+};
+
+#endif
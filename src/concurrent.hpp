@@ -0,0 +1,847 @@
+#ifndef _ABTREE_CONCURRENT_HPP_
+#define _ABTREE_CONCURRENT_HPP_
+
+#include <stdexcept>
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+#include "abtree.hpp"
+#include "concurrent_vertex.hpp"
+
+/**
+ * Assigns a small index to every thread that uses a concurrent tree.
+ * The indices of finished threads are handed out again.
+ */
+class abtree_thread_registry
+{
+public:
+	/**
+	 * The index of the calling thread
+	 */
+	static size_t index ()
+	{
+		thread_local slot current;
+		return current.index;
+	}
+
+private:
+	struct slot
+	{
+		size_t index;
+		
+		slot ()
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			if (free_indices().empty()) {
+				index = next_index()++;
+			} else {
+				index = free_indices().back();
+				free_indices().pop_back();
+			}
+		}
+		
+		~slot ()
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			free_indices().push_back(index);
+		}
+	};
+	
+	static std::mutex & mutex ()
+	{
+		static std::mutex m;
+		return m;
+	}
+	
+	static std::vector<size_t> & free_indices ()
+	{
+		static std::vector<size_t> indices;
+		return indices;
+	}
+	
+	static size_t & next_index ()
+	{
+		static size_t next = 0;
+		return next;
+	}
+};
+
+/**
+ * Epoch-based reclamation of vertices removed from a concurrent tree.
+ * Every operation announces the epoch in which it started. A vertex removed in some epoch may still be
+ * looked at by operations that started before, so it's only freed once all of them have finished.
+ */
+class abtree_epoch
+{
+public:
+	/**
+	 * The maximum number of threads that can use the tree at the same time
+	 */
+	static const size_t max_threads = 256;
+	
+	/**
+	 * Announces the epoch of an operation for as long as it lives
+	 */
+	class guard
+	{
+	public:
+		/**
+		 * @throws std::length_error if there are more than max_threads threads
+		 */
+		explicit guard (abtree_epoch & epoch): slot_(epoch.slot())
+		{
+			slot_.store(epoch.global_.load());
+		}
+		
+		~guard ()
+		{
+			slot_.store(idle);
+		}
+		
+		guard (const guard &) = delete;
+		guard & operator= (const guard &) = delete;
+	private:
+		std::atomic<uint64_t> & slot_;
+	};
+	
+	abtree_epoch (): global_(1), slots_(new padded_slot[max_threads])
+	{}
+	
+	/**
+	 * Advance the global epoch because a vertex has been removed from the tree
+	 * @return the epoch the vertex has been removed in
+	 */
+	uint64_t advance ()
+	{
+		return global_.fetch_add(1);
+	}
+	
+	/**
+	 * Returns the oldest epoch of a running operation. Everything removed in an older epoch can be freed.
+	 */
+	uint64_t oldest () const
+	{
+		uint64_t result = idle;
+		for (size_t i = 0; i < max_threads; i++) {
+			result = std::min(result, slots_[i].epoch.load());
+		}
+		return result;
+	}
+
+private:
+	static const uint64_t idle = UINT64_MAX;
+	
+	/**
+	 * The epoch of a thread, padded to a cache line so that threads don't fight over it
+	 */
+	struct padded_slot
+	{
+		std::atomic<uint64_t> epoch;
+		char padding[sizeof(abtree_cache_line) - sizeof(std::atomic<uint64_t>)];
+		
+		padded_slot (): epoch(idle)
+		{}
+	};
+	
+	std::atomic<uint64_t> & slot ()
+	{
+		size_t i = abtree_thread_registry::index();
+		if (i >= max_threads) {
+			throw std::length_error("abtree_epoch");
+		}
+		return slots_[i].epoch;
+	}
+	
+	std::atomic<uint64_t> global_;
+	std::unique_ptr<padded_slot[]> slots_;
+};
+
+/**
+ * An (a, b)-tree that can be used by many threads at the same time without any external locking.
+ * It uses optimistic lock coupling: readers don't write to shared memory at all, they remember the version
+ * of each vertex on the way down and start over if it changes before they're done. Writers lock only
+ * the vertices they change. Vertices are rebalanced on the way down (full vertices are split and vertices
+ * with a - 1 items are refilled before entering them), so a change never has to climb back up the tree.
+ * Items are only stored in the leaves, like in abtree_bplus.
+ * Readers may copy keys and values while they're being overwritten (the copy is thrown away if that happens),
+ * so both types have to be trivially copyable, and vertices keep them in relaxed atomics. There are no iterators, as there's no way to keep one valid
+ * while other threads change the tree.
+ * @tparam A, B The (a, b) parameters of the tree if they should be fixed at compile time.
+ * If both of them are 0 (the default), the parameters are passed to the constructor instead.
+ * Since vertices are split before they overflow, b has to be at least 2a.
+ * @tparam Allocator A std::allocator-compatible allocator (see abtree). Its calls are serialized by the tree.
+ */
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >
+>
+class abtree_concurrent: private abtree_params<A, B> {
+	static_assert(std::is_trivially_copyable<TKey>::value, "the key type has to be trivially copyable");
+	static_assert(std::is_trivially_copyable<TVal>::value, "the value type has to be trivially copyable");
+	static_assert(B == 0 || B >= 2 * A, "b has to be at least 2 * a");
+	
+	typedef abtree_concurrent_vertex<TKey, TVal, B> vertex;
+	typedef abtree_params<A, B> params;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<abtree_cache_line> block_allocator;
+
+public:
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+	typedef Allocator allocator_type;
+
+private:
+	using params::a;
+	using params::b;
+	
+	/**
+	 * The number of removed vertices collected before trying to free them
+	 */
+	static const size_t retire_batch = 64;
+	
+	std::atomic<vertex *> root;
+	std::atomic<size_t> size_;
+	block_allocator alloc_;
+	std::mutex alloc_mutex_;
+	mutable abtree_epoch epoch_;
+	std::mutex retired_mutex_;
+	std::vector<std::pair<uint64_t, vertex *> > retired_;
+	
+	/**
+	 * Allocate a new vertex using the allocator of the tree
+	 * @param leaf whether the vertex is a leaf
+	 */
+	vertex * create_vertex (bool leaf)
+	{
+		std::lock_guard<std::mutex> lock(alloc_mutex_);
+		return vertex::create(alloc_, b, leaf);
+	}
+	
+	/**
+	 * Destroy a vertex and return its memory to the allocator of the tree
+	 */
+	void destroy_vertex (vertex * v)
+	{
+		std::lock_guard<std::mutex> lock(alloc_mutex_);
+		vertex::destroy(alloc_, v, b);
+	}
+	
+	/**
+	 * Hand over a vertex that has been removed from the tree. It's freed as soon as no operation
+	 * can be looking at it.
+	 */
+	void retire_vertex (vertex * v)
+	{
+		std::lock_guard<std::mutex> lock(retired_mutex_);
+		retired_.push_back(std::make_pair(epoch_.advance(), v));
+		if (retired_.size() < retire_batch) {
+			return;
+		}
+		
+		uint64_t oldest = epoch_.oldest();
+		size_t kept = 0;
+		for (size_t i = 0; i < retired_.size(); i++) {
+			if (retired_[i].first < oldest) {
+				destroy_vertex(retired_[i].second);
+			} else {
+				retired_[kept++] = retired_[i];
+			}
+		}
+		retired_.resize(kept);
+	}
+	
+	/**
+	 * Destroy all the vertices of the tree (using BFS) and all the removed vertices.
+	 * Only safe when no other thread uses the tree.
+	 */
+	void destroy_tree ()
+	{
+		std::queue<vertex *> queue;
+		queue.push(root.load());
+		
+		while (queue.size() > 0) {
+			vertex * cursor = queue.front();
+			if (!cursor->leaf) {
+				for (size_t i = 0; i <= cursor->count(); i++) {
+					queue.push(cursor->child(i));
+				}
+			}
+			destroy_vertex(cursor);
+			queue.pop();
+		}
+		
+		for (auto & item: retired_) {
+			destroy_vertex(item.second);
+		}
+		retired_.clear();
+	}
+	
+	/**
+	 * Give other threads a chance to finish their changes after an operation had to restart many times
+	 */
+	static void back_off (size_t attempt)
+	{
+		if (attempt > 8) {
+			std::this_thread::yield();
+		}
+	}
+	
+	/**
+	 * @name Moving items inside and between locked vertices, with relaxed loads and stores
+	 * because optimistic readers may be looking at the arrays
+	 */
+	//@{
+	template <typename T>
+	static void relaxed_copy (const std::atomic<T> * first, const std::atomic<T> * last, std::atomic<T> * out)
+	{
+		for (; first != last; ++first, ++out) {
+			out->store(first->load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+	
+	template <typename T>
+	static void relaxed_copy_backward (const std::atomic<T> * first, const std::atomic<T> * last, std::atomic<T> * out)
+	{
+		while (last != first) {
+			(--out)->store((--last)->load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+	//@}
+	
+	/**
+	 * Start an optimistic descent at the root
+	 * @param v set to the version of the root
+	 * @return the root or nullptr if the operation has to restart
+	 */
+	vertex * read_root (uint64_t & v) const
+	{
+		vertex * cursor = root.load();
+		// The root might have been replaced after it was loaded
+		if (!cursor->read_lock(v) || cursor != root.load()) {
+			return nullptr;
+		}
+		return cursor;
+	}
+	
+	/**
+	 * Move an optimistic descent from an inner vertex to the child that covers given key.
+	 * The child is only touched after the parent has been validated, so it's never a stale pointer.
+	 * @param cursor the inner vertex
+	 * @param v the version of the inner vertex
+	 * @param key the key
+	 * @param i set to the position of the child
+	 * @param child_v set to the version of the child
+	 * @return the child or nullptr if the operation has to restart
+	 */
+	vertex * read_child (vertex * cursor, uint64_t v, const key_type & key, size_t & i, uint64_t & child_v) const
+	{
+		size_t count = cursor->count();
+		if (count >= b) {
+			return nullptr;
+		}
+		i = cursor->child_index(key, count);
+		vertex * child = cursor->child(i);
+		if (!cursor->validate(v) || !child->read_lock(child_v) || !cursor->validate(v)) {
+			return nullptr;
+		}
+		return child;
+	}
+	
+	/**
+	 * Split the full i-th child of given vertex in half. Both the vertex and the child have to be locked
+	 * and the vertex must not be full.
+	 * The new right half isn't reachable until the vertex is unlocked, so it can be locked right away.
+	 * Afterwards, only the half that covers given key stays locked.
+	 * @param parent the vertex
+	 * @param i the position of the child
+	 * @param sibling an empty vertex that receives the right half (allocated in advance,
+	 * so that nothing can throw while the vertices are locked)
+	 * @param key the key the descent is heading for
+	 * @return the half that covers the key (still locked)
+	 */
+	vertex * split_child (vertex * parent, size_t i, vertex * sibling, const key_type & key)
+	{
+		vertex * child = parent->child(i);
+		sibling->version.store(2);
+		
+		size_t count = child->count();
+		size_t middle = count / 2;
+		key_type separator = child->key(middle);
+		
+		if (child->leaf) {
+			relaxed_copy(child->keys + middle, child->keys + count, sibling->keys);
+			relaxed_copy(child->values + middle, child->values + count, sibling->values);
+			sibling->set_count(count - middle);
+		} else {
+			// The middle key moves up to the parent
+			relaxed_copy(child->keys + middle + 1, child->keys + count, sibling->keys);
+			relaxed_copy(child->children + middle + 1, child->children + count + 1, sibling->children);
+			sibling->set_count(count - middle - 1);
+		}
+		child->set_count(middle);
+		
+		size_t parent_count = parent->count();
+		relaxed_copy_backward(parent->keys + i, parent->keys + parent_count, parent->keys + parent_count + 1);
+		relaxed_copy_backward(parent->children + i + 1, parent->children + parent_count + 1, parent->children + parent_count + 2);
+		parent->set_key(i, separator);
+		parent->set_child(i + 1, sibling);
+		parent->set_count(parent_count + 1);
+		
+		vertex * target = key < separator ? child : sibling;
+		(target == child ? sibling : child)->write_unlock();
+		parent->write_unlock();
+		return target;
+	}
+	
+	/**
+	 * Split a full root under a new root, the tree gets higher by one level
+	 * @param v the version of the root
+	 * @param key the key the descent is heading for
+	 * @return the half of the old root that covers the key (locked)
+	 * or nullptr if the root has changed and the operation has to restart
+	 */
+	vertex * grow (vertex * old_root, uint64_t v, const key_type & key)
+	{
+		vertex * new_root = create_vertex(false);
+		vertex * sibling;
+		try {
+			sibling = create_vertex(old_root->leaf);
+		} catch (...) {
+			destroy_vertex(new_root);
+			throw;
+		}
+		if (!old_root->upgrade(v)) {
+			destroy_vertex(sibling);
+			destroy_vertex(new_root);
+			return nullptr;
+		}
+		
+		// Readers find the new root locked until the split is done
+		new_root->version.store(2);
+		new_root->set_child(0, old_root);
+		root.store(new_root);
+		return split_child(new_root, 0, sibling, key);
+	}
+	
+	/**
+	 * Move the last item (or child) of the k-th child of a locked vertex to the (k + 1)-th child
+	 */
+	void rotate_right (vertex * parent, size_t k)
+	{
+		vertex * left = parent->child(k);
+		vertex * right = parent->child(k + 1);
+		size_t left_count = left->count();
+		size_t right_count = right->count();
+		
+		relaxed_copy_backward(right->keys, right->keys + right_count, right->keys + right_count + 1);
+		if (right->leaf) {
+			relaxed_copy_backward(right->values, right->values + right_count, right->values + right_count + 1);
+			right->set_key(0, left->key(left_count - 1));
+			right->set_value(0, left->value(left_count - 1));
+			parent->set_key(k, right->key(0));
+		} else {
+			relaxed_copy_backward(right->children, right->children + right_count + 1, right->children + right_count + 2);
+			right->set_key(0, parent->key(k));
+			right->set_child(0, left->child(left_count));
+			parent->set_key(k, left->key(left_count - 1));
+		}
+		left->set_count(left_count - 1);
+		right->set_count(right_count + 1);
+	}
+	
+	/**
+	 * Move the first item (or child) of the (k + 1)-th child of a locked vertex to the k-th child
+	 */
+	void rotate_left (vertex * parent, size_t k)
+	{
+		vertex * left = parent->child(k);
+		vertex * right = parent->child(k + 1);
+		size_t left_count = left->count();
+		size_t right_count = right->count();
+		
+		if (left->leaf) {
+			left->set_key(left_count, right->key(0));
+			left->set_value(left_count, right->value(0));
+			relaxed_copy(right->keys + 1, right->keys + right_count, right->keys);
+			relaxed_copy(right->values + 1, right->values + right_count, right->values);
+			parent->set_key(k, right->key(0));
+		} else {
+			left->set_key(left_count, parent->key(k));
+			left->set_child(left_count + 1, right->child(0));
+			parent->set_key(k, right->key(0));
+			relaxed_copy(right->keys + 1, right->keys + right_count, right->keys);
+			relaxed_copy(right->children + 1, right->children + right_count + 1, right->children);
+		}
+		left->set_count(left_count + 1);
+		right->set_count(right_count - 1);
+	}
+	
+	/**
+	 * Move everything from the (k + 1)-th child of a locked vertex to the k-th child
+	 * and remove the (k + 1)-th child together with the separator from the vertex
+	 */
+	void merge_children (vertex * parent, size_t k)
+	{
+		vertex * left = parent->child(k);
+		vertex * right = parent->child(k + 1);
+		size_t left_count = left->count();
+		size_t right_count = right->count();
+		size_t parent_count = parent->count();
+		
+		if (left->leaf) {
+			relaxed_copy(right->keys, right->keys + right_count, left->keys + left_count);
+			relaxed_copy(right->values, right->values + right_count, left->values + left_count);
+			left->set_count(left_count + right_count);
+		} else {
+			left->set_key(left_count, parent->key(k));
+			relaxed_copy(right->keys, right->keys + right_count, left->keys + left_count + 1);
+			relaxed_copy(right->children, right->children + right_count + 1, left->children + left_count + 1);
+			left->set_count(left_count + right_count + 1);
+		}
+		
+		relaxed_copy(parent->keys + k + 1, parent->keys + parent_count, parent->keys + k);
+		relaxed_copy(parent->children + k + 2, parent->children + parent_count + 1, parent->children + k + 1);
+		parent->set_count(parent_count - 1);
+	}
+	
+	/**
+	 * Refill the i-th child of given vertex, which has a - 1 items, either by moving an item from a neighbour
+	 * or by merging it with the neighbour. Both the vertex and the child have to be locked and the vertex
+	 * must have at least a items, unless it's the root. The neighbour is locked as well,
+	 * if that fails, nothing happens and all locks are released.
+	 * @param parent the vertex
+	 * @param i the position of the child
+	 * @return the vertex that holds the items of the child afterwards (still locked)
+	 * or nullptr if the operation has to restart
+	 */
+	vertex * refill_child (vertex * parent, size_t i)
+	{
+		vertex * child = parent->child(i);
+		size_t k = i > 0 ? i - 1 : i;
+		vertex * neighbour = parent->child(i > 0 ? k : k + 1);
+		uint64_t neighbour_v;
+		if (!neighbour->read_lock(neighbour_v) || !neighbour->upgrade(neighbour_v)) {
+			child->write_unlock();
+			parent->write_unlock();
+			return nullptr;
+		}
+		
+		if (neighbour->count() >= a) {
+			if (i > 0) {
+				rotate_right(parent, k);
+			} else {
+				rotate_left(parent, k);
+			}
+			neighbour->write_unlock();
+			parent->write_unlock();
+			return child;
+		}
+		
+		vertex * left = parent->child(k);
+		vertex * right = parent->child(k + 1);
+		merge_children(parent, k);
+		right->write_unlock_obsolete();
+		
+		if (parent->count() == 0) {
+			// The last two children of the root have been merged, the tree gets lower by one level
+			root.store(left);
+			parent->write_unlock_obsolete();
+			retire_vertex(parent);
+		} else {
+			parent->write_unlock();
+		}
+		retire_vertex(right);
+		return left;
+	}
+	
+	/**
+	 * Descend to the leaf that covers given key and lock it. On the way down, full children (when inserting)
+	 * or children with a - 1 items (when erasing) are rebalanced before entering them, so that the leaf
+	 * can take the change without affecting any other vertex. The vertex that has just been rebalanced
+	 * stays locked until the descent leaves it, so other threads can't undo the rebalancing in the meantime.
+	 * @param key the key
+	 * @param inserting whether the leaf is about to gain an item (otherwise it's about to lose one)
+	 * @return the locked leaf or nullptr if the operation has to restart
+	 */
+	vertex * lock_leaf (const key_type & key, bool inserting)
+	{
+		uint64_t v;
+		vertex * cursor = read_root(v);
+		if (cursor == nullptr) {
+			return nullptr;
+		}
+		bool locked = false;
+		if (inserting && cursor->count() == b - 1) {
+			cursor = grow(cursor, v, key);
+			if (cursor == nullptr) {
+				return nullptr;
+			}
+			locked = true;
+		}
+		
+		size_t critical = inserting ? b - 1 : a - 1;
+		while (!cursor->leaf) {
+			size_t count = cursor->count();
+			size_t i = count < b ? cursor->child_index(key, count) : 0;
+			vertex * child = cursor->child(i);
+			uint64_t child_v;
+			// The child pointer is only followed once it's known to be valid
+			if (count >= b || !(locked || cursor->validate(v)) || !child->read_lock(child_v) || !(locked || cursor->validate(v))) {
+				if (locked) {
+					cursor->write_unlock();
+				}
+				return nullptr;
+			}
+			
+			if (child->count() == critical) {
+				vertex * sibling = nullptr;
+				if (inserting) {
+					try {
+						sibling = create_vertex(child->leaf);
+					} catch (...) {
+						if (locked) {
+							cursor->write_unlock();
+						}
+						throw;
+					}
+				}
+				bool acquired = locked || cursor->upgrade(v);
+				if (!acquired || !child->upgrade(child_v)) {
+					if (acquired) {
+						cursor->write_unlock();
+					}
+					if (sibling != nullptr) {
+						destroy_vertex(sibling);
+					}
+					return nullptr;
+				}
+				cursor = inserting ? split_child(cursor, i, sibling, key) : refill_child(cursor, i);
+				if (cursor == nullptr) {
+					return nullptr;
+				}
+				locked = true;
+				continue;
+			}
+			
+			if (locked) {
+				cursor->write_unlock();
+				locked = false;
+			}
+			cursor = child;
+			v = child_v;
+		}
+		
+		if (!locked && !cursor->upgrade(v)) {
+			return nullptr;
+		}
+		return cursor;
+	}
+	
+	/**
+	 * One attempt of find()
+	 * @return false if the attempt failed and has to be repeated
+	 */
+	bool try_find (const key_type & key, mapped_type & value, bool & found) const
+	{
+		uint64_t v;
+		vertex * cursor = read_root(v);
+		if (cursor == nullptr) {
+			return false;
+		}
+		while (!cursor->leaf) {
+			size_t i;
+			uint64_t child_v;
+			cursor = read_child(cursor, v, key, i, child_v);
+			if (cursor == nullptr) {
+				return false;
+			}
+			v = child_v;
+		}
+		
+		size_t count = cursor->count();
+		if (count >= b) {
+			return false;
+		}
+		size_t i = cursor->search(key, count);
+		found = i < count && cursor->key(i) == key;
+		mapped_type copy = found ? cursor->value(i) : value;
+		if (!cursor->validate(v)) {
+			return false;
+		}
+		value = copy;
+		return true;
+	}
+	
+	/**
+	 * One attempt of insert()
+	 * @return false if the attempt failed and has to be repeated
+	 */
+	bool try_insert (const key_type & key, const mapped_type & value, bool & inserted)
+	{
+		vertex * leaf = lock_leaf(key, true);
+		if (leaf == nullptr) {
+			return false;
+		}
+		
+		size_t count = leaf->count();
+		size_t i = leaf->search(key, count);
+		inserted = i == count || !(leaf->key(i) == key);
+		if (inserted) {
+			relaxed_copy_backward(leaf->keys + i, leaf->keys + count, leaf->keys + count + 1);
+			relaxed_copy_backward(leaf->values + i, leaf->values + count, leaf->values + count + 1);
+			leaf->set_key(i, key);
+			leaf->set_count(count + 1);
+			size_++;
+		}
+		leaf->set_value(i, value);
+		leaf->write_unlock();
+		return true;
+	}
+	
+	/**
+	 * One attempt of erase()
+	 * @return false if the attempt failed and has to be repeated
+	 */
+	bool try_erase (const key_type & key, bool & erased)
+	{
+		vertex * leaf = lock_leaf(key, false);
+		if (leaf == nullptr) {
+			return false;
+		}
+		
+		size_t count = leaf->count();
+		size_t i = leaf->search(key, count);
+		erased = i < count && leaf->key(i) == key;
+		if (erased) {
+			relaxed_copy(leaf->keys + i + 1, leaf->keys + count, leaf->keys + i);
+			relaxed_copy(leaf->values + i + 1, leaf->values + count, leaf->values + i);
+			leaf->set_count(count - 1);
+			size_--;
+		}
+		leaf->write_unlock();
+		return true;
+	}
+
+public:
+	/**
+	 * The basic constructor
+	 * @param a The minimum number of children for all non-root vertices (has to be at least 2)
+	 * @param b The maximum number of children for all vertices (has to be at least 2a)
+	 * @param alloc The allocator used for the vertices of the tree
+	 * @throws std::invalid_argument if a and b don't meet the conditions
+	 */
+	abtree_concurrent (size_t a, size_t b, const Allocator & alloc = Allocator()): params(a, b), size_(0), alloc_(alloc)
+	{
+		if (b < 2 * a) {
+			throw std::invalid_argument("b");
+		}
+		root = create_vertex(true);
+	}
+	
+	/**
+	 * The constructor of a tree whose (a, b) parameters are given as template arguments
+	 * @param alloc The allocator used for the vertices of the tree
+	 */
+	explicit abtree_concurrent (const Allocator & alloc = Allocator()): size_(0), alloc_(alloc)
+	{
+		root = create_vertex(true);
+	}
+	
+	abtree_concurrent (const abtree_concurrent &) = delete;
+	abtree_concurrent & operator= (const abtree_concurrent &) = delete;
+	
+	/**
+	 * The destructor. No other thread may use the tree anymore.
+	 */
+	~abtree_concurrent ()
+	{
+		destroy_tree();
+	}
+	
+	/**
+	 * Find the value associated with given key
+	 * @param key the key to search for
+	 * @param value set to a copy of the value if the key is present, left untouched otherwise
+	 * @return whether the key is present
+	 */
+	bool find (const key_type & key, mapped_type & value) const
+	{
+		abtree_epoch::guard guard(epoch_);
+		bool found = false;
+		for (size_t attempt = 0; !try_find(key, value, found); attempt++) {
+			back_off(attempt);
+		}
+		return found;
+	}
+	
+	/**
+	 * Check whether given key is present
+	 */
+	bool contains (const key_type & key) const
+	{
+		mapped_type value;
+		return find(key, value);
+	}
+	
+	/**
+	 * Insert an item into the tree. If the key is already present, its value gets replaced.
+	 * @param item the key and the value
+	 * @return whether the key has been inserted (it wasn't present before)
+	 */
+	bool insert (const value_type & item)
+	{
+		abtree_epoch::guard guard(epoch_);
+		bool inserted = false;
+		for (size_t attempt = 0; !try_insert(item.first, item.second, inserted); attempt++) {
+			back_off(attempt);
+		}
+		return inserted;
+	}
+	
+	/**
+	 * Erase the item with given key
+	 * @return whether the key has been present
+	 */
+	bool erase (const key_type & key)
+	{
+		abtree_epoch::guard guard(epoch_);
+		bool erased = false;
+		for (size_t attempt = 0; !try_erase(key, erased); attempt++) {
+			back_off(attempt);
+		}
+		return erased;
+	}
+	
+	/**
+	 * Returns the allocator used for the vertices of the tree
+	 */
+	allocator_type get_allocator () const
+	{
+		return allocator_type(alloc_);
+	}
+	
+	/**
+	 * Returns the number of items. It's exact as long as no other thread is changing the tree.
+	 */
+	size_t size () const
+	{
+		return size_.load();
+	}
+	
+	/**
+	 * Returns true if the tree is empty
+	 */
+	bool empty () const
+	{
+		return size() == 0;
+	}
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef _ABTREE_CONCURRENT_VERTEX_HPP_
+#define _ABTREE_CONCURRENT_VERTEX_HPP_
+
+#include <new>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "vertex.hpp"
+
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator>
+class abtree_concurrent;
+
+/**
+ * A vertex of a concurrent (a, b)-tree. The layout is the one of abtree_bplus_vertex (items live in the leaves,
+ * inner vertices only hold separators), without the links between leaves.
+ * Every vertex carries a version lock. Its lowest bit marks a vertex that has been removed from the tree,
+ * the second bit is set while a writer holds the lock, and the rest is a counter that's increased by every writer.
+ * Readers don't lock anything. They remember the version, read the vertex and check that the version
+ * hasn't changed in the meantime, otherwise they have to start over.
+ * Since readers may look at a vertex while a writer changes it, the item count and the arrays are atomic
+ * and accessed through relaxed loads and stores, the version lock orders them (like a seqlock).
+ * Keys and values that aren't lock-free as atomics (larger than 16 bytes or so) need libatomic.
+ * @tparam B The maximum number of children if it's known at compile time, 0 otherwise
+ */
+template <typename TKey, typename TVal, size_t B = 0>
+struct abtree_concurrent_vertex: private abtree_block_layout<abtree_concurrent_vertex<TKey, TVal, B>,
+	std::atomic<TKey>, std::atomic<TVal>, std::atomic<abtree_concurrent_vertex<TKey, TVal, B> *> >
+{
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	
+	std::atomic<uint64_t> version;
+	std::atomic<size_t> item_count;
+	bool leaf;
+	std::atomic<TKey> * keys;
+	std::atomic<TVal> * values; // Leaves only
+	std::atomic<abtree_concurrent_vertex *> * children; // Inner vertices only
+	
+	/**
+	 * @name Version lock
+	 */
+	//@{
+	/**
+	 * Read the current version before reading the vertex
+	 * @param v set to the version
+	 * @return false if the vertex is locked or obsolete (the operation has to restart)
+	 */
+	bool read_lock (uint64_t & v) const
+	{
+		v = version.load(std::memory_order_acquire);
+		return (v & 3) == 0;
+	}
+	
+	/**
+	 * Check that the vertex hasn't changed since given version was read.
+	 * The fence keeps the relaxed reads of the vertex from moving past the check.
+	 */
+	bool validate (uint64_t v) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return version.load(std::memory_order_relaxed) == v;
+	}
+	
+	/**
+	 * Acquire the lock, provided that the vertex hasn't changed since given version was read.
+	 * The fence makes sure that a reader who sees any of the following changes also sees the lock.
+	 * @return false if the vertex has changed (the operation has to restart)
+	 */
+	bool upgrade (uint64_t v)
+	{
+		if (!version.compare_exchange_strong(v, v + 2)) {
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+		return true;
+	}
+	
+	/**
+	 * Release the lock, announcing a new version
+	 */
+	void write_unlock ()
+	{
+		version.fetch_add(2);
+	}
+	
+	/**
+	 * Release the lock of a vertex that has been removed from the tree
+	 */
+	void write_unlock_obsolete ()
+	{
+		version.fetch_add(3);
+	}
+	//@}
+	
+	/**
+	 * @name Relaxed access to the item count and the arrays
+	 */
+	//@{
+	size_t count () const
+	{
+		return item_count.load(std::memory_order_relaxed);
+	}
+	
+	void set_count (size_t count)
+	{
+		item_count.store(count, std::memory_order_relaxed);
+	}
+	
+	TKey key (size_t i) const
+	{
+		return keys[i].load(std::memory_order_relaxed);
+	}
+	
+	void set_key (size_t i, const TKey & key)
+	{
+		keys[i].store(key, std::memory_order_relaxed);
+	}
+	
+	TVal value (size_t i) const
+	{
+		return values[i].load(std::memory_order_relaxed);
+	}
+	
+	void set_value (size_t i, const TVal & value)
+	{
+		values[i].store(value, std::memory_order_relaxed);
+	}
+	
+	abtree_concurrent_vertex * child (size_t i) const
+	{
+		return children[i].load(std::memory_order_relaxed);
+	}
+	
+	void set_child (size_t i, abtree_concurrent_vertex * child)
+	{
+		children[i].store(child, std::memory_order_relaxed);
+	}
+	//@}
+	
+	/**
+	 * Returns the index of the first key that is larger than or equal than given key.
+	 * The vectorized searches of search.hpp can't read the atomic keys, so this is a branchless binary search
+	 * like abtree_search_arithmetic() without the vectorized scan at the end.
+	 * @param key the key to search for
+	 * @param count the number of keys (read once, as it might be changing under an optimistic reader)
+	 */
+	size_t search (const TKey & key, size_t count) const
+	{
+		if (count == 0) {
+			return 0;
+		}
+		size_t first = 0;
+		while (count > 1) {
+			size_t half = count / 2;
+			first = this->key(first + half - 1) < key ? first + half : first;
+			count -= half;
+		}
+		return this->key(first) < key ? first + 1 : first;
+	}
+	
+	/**
+	 * Returns the index of the child of an inner vertex whose subtree covers given key
+	 * (see abtree_bplus_vertex::child_index())
+	 */
+	size_t child_index (const TKey & key, size_t count) const
+	{
+		size_t i = search(key, count);
+		return i < count && !(key < this->key(i)) ? i + 1 : i;
+	}
+
+private:
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_concurrent;
+	
+	typedef abtree_block_layout<abtree_concurrent_vertex, std::atomic<TKey>, std::atomic<TVal>,
+		std::atomic<abtree_concurrent_vertex *> > layout;
+	friend layout;
+	using layout::cache_line_size;
+	using layout::align;
+	using layout::keys_offset;
+	using layout::values_offset;
+	using layout::children_offset;
+	
+	/**
+	 * Compute the size of the memory block of a vertex (see abtree_block_layout)
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf (which has values instead of children)
+	 */
+	static size_t block_size (size_t max_children, bool leaf)
+	{
+		size_t size = leaf ? layout::values_end(max_children) : layout::children_end(max_children, max_children);
+		return align(size, cache_line_size);
+	}
+	
+	/**
+	 * Set up the arrays inside the memory block
+	 * @param block the memory block the vertex is placed in
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf
+	 */
+	abtree_concurrent_vertex (char * block, size_t max_children, bool leaf): version(0), item_count(0), leaf(leaf)
+	{
+		keys = construct_array<TKey>(block + keys_offset(), max_children);
+		values = leaf ? construct_array<TVal>(block + values_offset(max_children), max_children) : nullptr;
+		children = leaf ? nullptr : construct_array<abtree_concurrent_vertex *>(block + children_offset(max_children), max_children);
+	}
+	
+	/**
+	 * Construct an array of atomics (left uninitialized, just like the arrays of the other vertices).
+	 * Keys and values are trivially copyable, so the arrays never have to be destroyed.
+	 */
+	template <typename T>
+	static std::atomic<T> * construct_array (char * place, size_t n)
+	{
+		std::atomic<T> * array = reinterpret_cast<std::atomic<T> *>(place);
+		for (size_t i = 0; i < n; i++) {
+			new (array + i) std::atomic<T>;
+		}
+		return array;
+	}
+};
+
+#endif
@@ -0,0 +1,575 @@
+#ifndef _ABTREE_DURABLE_HPP_
+#define _ABTREE_DURABLE_HPP_
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "abtree.hpp"
+#include "mapped.hpp"
+
+/**
+ * The options of abtree_durable
+ */
+struct abtree_durable_options
+{
+	/**
+	 * The records of the changes made during this interval are committed to the log by a single fsync
+	 * (group commit). A background thread commits the records of an idle tree once the interval
+	 * has passed, so a crash loses at most the changes of the last interval. Zero commits every change.
+	 */
+	std::chrono::milliseconds commit_interval;
+	
+	/**
+	 * The size of the log (in bytes) that triggers a checkpoint. Zero leaves checkpoints to checkpoint().
+	 */
+	size_t checkpoint_size;
+	
+	abtree_durable_options (): commit_interval(10), checkpoint_size(64 * 1024 * 1024)
+	{}
+};
+
+/**
+ * An (a, b)-tree that survives restarts. Every change is appended to a write-ahead log before it's applied
+ * to the tree in memory, and the tree is periodically written to a checkpoint (in the format of
+ * abtree_write_mapped()), after which the log starts over. Opening the tree bulk-loads the checkpoint
+ * (see abtree::assign()) and replays the log written since then. A record torn by a crash at the end
+ * of the log is detected by its checksum and cut off.
+ * The tree itself can only be read through the wrapper, so that no change escapes the log.
+ * Like abtree, the wrapper is meant to be used by one thread at a time. The only other thread is its own
+ * committer, which only touches the log.
+ * The keys and the values are logged byte by byte, so they have to be trivially copyable.
+ * Files: path + ".checkpoint" and path + ".log" (and path + ".checkpoint.tmp" while writing a checkpoint).
+ * @tparam A, B, Allocator See abtree
+ */
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >
+>
+class abtree_durable
+{
+	static_assert(std::is_trivially_copyable<TKey>::value, "the keys have to be trivially copyable");
+	static_assert(std::is_trivially_copyable<TVal>::value, "the values have to be trivially copyable");
+
+public:
+	typedef abtree<TKey, TVal, A, B, Allocator> tree_type;
+	typedef typename tree_type::const_iterator const_iterator;
+	typedef const_iterator iterator;
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+
+private:
+	/**
+	 * The start of the log
+	 */
+	struct log_header
+	{
+		char magic[8];
+		uint32_t key_size;
+		uint32_t value_size;
+	};
+	
+	/**
+	 * A record of the log, followed by the key and the value (zeroed in case of an erase).
+	 * The checksum covers the type, the key and the value.
+	 */
+	struct record_header
+	{
+		uint32_t checksum;
+		uint32_t type;
+	};
+	
+	enum record_type
+	{
+		record_assign = 1,
+		record_erase = 2
+	};
+	
+	static const size_t record_size = sizeof(record_header) + sizeof(TKey) + sizeof(TVal);
+	
+	/**
+	 * The size of the buffer that makes the log written to the file even before a commit
+	 */
+	static const size_t buffer_limit = 1024 * 1024;
+	
+	tree_type tree_;
+	std::string path_;
+	abtree_durable_options options_;
+	int log_;
+	size_t log_size_;
+	std::vector<char> buffer_;
+	std::chrono::steady_clock::time_point last_commit_;
+	
+	std::mutex lock_; // Guards the log against the committer
+	std::condition_variable wake_;
+	bool stopping_;
+	std::exception_ptr error_; // The failure of the committer, reported by the next change
+	std::thread committer_;
+	
+	static const char * signature ()
+	{
+		return "abtlog\x01";
+	}
+	
+	/**
+	 * The 32-bit FNV-1a hash of a record (without its checksum)
+	 */
+	static uint32_t checksum (const char * record)
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = sizeof(uint32_t); i < record_size; i++) {
+			hash = (hash ^ static_cast<unsigned char>(record[i])) * 16777619u;
+		}
+		return hash;
+	}
+	
+	/**
+	 * Throw an exception describing a failed operation on one of the files
+	 */
+	[[noreturn]] void fail (const std::string & what) const
+	{
+		throw std::runtime_error("can't " + what + " " + path_);
+	}
+	
+	/**
+	 * Flush the changes of a file (or a directory) to the disk
+	 */
+	void sync_file (const std::string & path) const
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0 || fsync(fd) != 0) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			fail("sync");
+		}
+		close(fd);
+	}
+	
+	/**
+	 * The directory of the files, whose entries have to be synced after a checkpoint is renamed
+	 */
+	std::string directory () const
+	{
+		size_t slash = path_.rfind('/');
+		return slash == std::string::npos ? std::string(".") : path_.substr(0, slash + 1);
+	}
+	
+	/**
+	 * Write all buffered records to the log (without syncing it)
+	 */
+	void write_buffer ()
+	{
+		size_t written = 0;
+		while (written < buffer_.size()) {
+			ssize_t result = write(log_, buffer_.data() + written, buffer_.size() - written);
+			if (result < 0) {
+				fail("write");
+			}
+			written += result;
+		}
+		log_size_ += buffer_.size();
+		buffer_.clear();
+	}
+	
+	/**
+	 * Append a record to the buffer. It isn't committed until the change has been applied to the tree
+	 * (see commit_change()), so that a checkpoint never misses a change whose record it cuts off the log.
+	 * @return the position of the record in the buffer (see cancel_record())
+	 */
+	size_t log (record_type type, const key_type & key, const mapped_type * value)
+	{
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+		size_t offset = buffer_.size();
+		buffer_.resize(offset + record_size, 0);
+		char * record = &buffer_[offset];
+		record_header header = {0, static_cast<uint32_t>(type)};
+		std::memcpy(record, &header, sizeof(header));
+		std::memcpy(record + sizeof(header), &key, sizeof(TKey));
+		if (value != nullptr) {
+			std::memcpy(record + sizeof(header) + sizeof(TKey), value, sizeof(TVal));
+		}
+		header.checksum = checksum(record);
+		std::memcpy(record, &header, sizeof(header));
+		return offset;
+	}
+	
+	/**
+	 * Drop the last record from the buffer after its change has failed
+	 */
+	void cancel_record (size_t offset)
+	{
+		buffer_.resize(offset);
+	}
+	
+	/**
+	 * Commit the buffer once a change has been applied, if the commit interval has passed
+	 * (the committer takes care of it otherwise), and write a checkpoint if the log is long enough
+	 */
+	void commit_change ()
+	{
+		if (options_.commit_interval.count() == 0 || std::chrono::steady_clock::now() - last_commit_ >= options_.commit_interval) {
+			commit();
+		} else if (buffer_.size() >= buffer_limit) {
+			write_buffer();
+		}
+		if (options_.checkpoint_size > 0 && log_size_ >= options_.checkpoint_size) {
+			write_checkpoint();
+		}
+	}
+	
+	/**
+	 * Write the buffer to the log and sync it
+	 */
+	void commit ()
+	{
+		if (!buffer_.empty()) {
+			write_buffer();
+			if (fdatasync(log_) != 0) {
+				fail("sync");
+			}
+		}
+		last_commit_ = std::chrono::steady_clock::now();
+	}
+	
+	/**
+	 * The committer: commits the records left in the buffer when no change comes to do it
+	 * within the commit interval
+	 */
+	void run_committer ()
+	{
+		std::unique_lock<std::mutex> guard(lock_);
+		while (!stopping_) {
+			auto deadline = last_commit_ + options_.commit_interval;
+			if (buffer_.empty() || std::chrono::steady_clock::now() < deadline) {
+				wake_.wait_until(guard, buffer_.empty() ? std::chrono::steady_clock::now() + options_.commit_interval : deadline);
+				continue;
+			}
+			try {
+				commit();
+			} catch (...) {
+				error_ = std::current_exception();
+				return;
+			}
+		}
+	}
+	
+	/**
+	 * Stop the committer (if it runs)
+	 */
+	void stop_committer ()
+	{
+		if (committer_.joinable()) {
+			{
+				std::lock_guard<std::mutex> guard(lock_);
+				stopping_ = true;
+			}
+			wake_.notify_all();
+			committer_.join();
+		}
+	}
+	
+	/**
+	 * Write the whole tree to a new checkpoint and start the log over (see checkpoint())
+	 */
+	void write_checkpoint ()
+	{
+		if (!buffer_.empty()) {
+			write_buffer();
+		}
+		std::string checkpoint = path_ + ".checkpoint";
+		std::string temporary = checkpoint + ".tmp";
+		abtree_write_mapped(temporary, tree_);
+		sync_file(temporary);
+		if (std::rename(temporary.c_str(), checkpoint.c_str()) != 0) {
+			fail("rename the checkpoint of");
+		}
+		sync_file(directory());
+		
+		if (ftruncate(log_, sizeof(log_header)) != 0 || fsync(log_) != 0) {
+			fail("truncate");
+		}
+		log_size_ = sizeof(log_header);
+		last_commit_ = std::chrono::steady_clock::now();
+	}
+	
+	/**
+	 * Log a change, apply it to the tree and commit it
+	 * @param type, key, value the record of the change
+	 * @param f the function that applies the change to the tree
+	 * @return the result of the function
+	 */
+	template <typename F>
+	auto change (record_type type, const key_type & key, const mapped_type * value, F f) -> decltype(f())
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		size_t offset = log(type, key, value);
+		auto result = apply(offset, f);
+		commit_change();
+		return result;
+	}
+	
+	/**
+	 * Apply a logged change to the tree, dropping its record if it fails
+	 */
+	template <typename F>
+	auto apply (size_t offset, F & f) -> decltype(f())
+	{
+		try {
+			return f();
+		} catch (...) {
+			cancel_record(offset);
+			throw;
+		}
+	}
+	
+	/**
+	 * Load the checkpoint, replay the log and open it for appending.
+	 * Records after the first damaged one are cut off.
+	 */
+	void recover ()
+	{
+		std::string checkpoint = path_ + ".checkpoint";
+		if (access(checkpoint.c_str(), F_OK) == 0) {
+			abtree_mapped<TKey, TVal> mapped(checkpoint);
+			tree_.assign(mapped.begin(), mapped.end());
+		}
+		
+		std::string log_path = path_ + ".log";
+		log_header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, signature(), sizeof(header.magic));
+		header.key_size = sizeof(TKey);
+		header.value_size = sizeof(TVal);
+		
+		size_t valid = 0;
+		std::ifstream in(log_path, std::ios::binary);
+		log_header found;
+		if (in.read(reinterpret_cast<char *>(&found), sizeof(found))) {
+			if (std::memcmp(&found, &header, sizeof(header)) != 0) {
+				throw std::runtime_error(log_path + " is not a compatible abtree log");
+			}
+			valid = sizeof(header);
+			
+			char record[record_size];
+			while (in.read(record, record_size)) {
+				record_header h;
+				std::memcpy(&h, record, sizeof(h));
+				if (h.checksum != checksum(record) || (h.type != record_assign && h.type != record_erase)) {
+					break;
+				}
+				key_type key;
+				std::memcpy(&key, record + sizeof(h), sizeof(TKey));
+				if (h.type == record_assign) {
+					mapped_type value;
+					std::memcpy(&value, record + sizeof(h) + sizeof(TKey), sizeof(TVal));
+					tree_.insert_or_assign(key, value);
+				} else {
+					tree_.erase(key);
+				}
+				valid += record_size;
+			}
+		}
+		in.close();
+		
+		log_ = open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (log_ < 0) {
+			fail("open");
+		}
+		try {
+			if (ftruncate(log_, valid) != 0) {
+				fail("truncate");
+			}
+			log_size_ = valid;
+			if (valid == 0) {
+				buffer_.assign(reinterpret_cast<const char *>(&header), reinterpret_cast<const char *>(&header) + sizeof(header));
+				write_buffer();
+			}
+			if (fsync(log_) != 0) {
+				fail("sync");
+			}
+		} catch (...) {
+			close(log_);
+			throw;
+		}
+		last_commit_ = std::chrono::steady_clock::now();
+		
+		if (options_.commit_interval.count() > 0) {
+			committer_ = std::thread(&abtree_durable::run_committer, this);
+		}
+	}
+
+public:
+	/**
+	 * Open (or create) a durable tree
+	 * @param path The path of the files of the tree, without the suffixes
+	 * @param a, b The (a, b) parameters of the tree (see abtree)
+	 * @param options The commit interval and the checkpoint size
+	 * @throws std::runtime_error if the files can't be read or written
+	 */
+	abtree_durable (const std::string & path, size_t a, size_t b, const abtree_durable_options & options = abtree_durable_options())
+		: tree_(a, b), path_(path), options_(options), log_(-1), stopping_(false)
+	{
+		recover();
+	}
+	
+	/**
+	 * Open (or create) a durable tree whose (a, b) parameters are given as template arguments
+	 */
+	explicit abtree_durable (const std::string & path, const abtree_durable_options & options = abtree_durable_options())
+		: path_(path), options_(options), log_(-1), stopping_(false)
+	{
+		recover();
+	}
+	
+	abtree_durable (const abtree_durable &) = delete;
+	abtree_durable & operator= (const abtree_durable &) = delete;
+	
+	/**
+	 * The destructor. Commits the records that haven't been committed yet.
+	 */
+	~abtree_durable ()
+	{
+		stop_committer();
+		if (log_ >= 0) {
+			try {
+				sync();
+			} catch (std::runtime_error &) {
+				// The changes since the last commit are lost, as if the process crashed
+			}
+			close(log_);
+		}
+	}
+	
+	/**
+	 * The tree in memory (read-only)
+	 */
+	const tree_type & tree () const
+	{
+		return tree_;
+	}
+	
+	/**
+	 * @name Return an iterator to the first item of the tree (or behind the last one)
+	 */
+	//@{
+	const_iterator begin () const
+	{
+		return tree_.cbegin();
+	}
+	
+	const_iterator end () const
+	{
+		return tree_.cend();
+	}
+	//@}
+	
+	/**
+	 * Find an item with given key (see abtree::find())
+	 */
+	const_iterator find (const key_type & key) const
+	{
+		return tree_.find(key);
+	}
+	
+	/**
+	 * Insert an item or replace the value of the item with the same key (see abtree::insert())
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	std::pair<const_iterator, bool> insert (const value_type & pair)
+	{
+		auto result = change(record_assign, pair.first, &pair.second, [this, &pair] () {
+			return tree_.insert(pair);
+		});
+		return std::make_pair(const_iterator(result.first), result.second);
+	}
+	
+	/**
+	 * Insert an item or replace the value of the item with the same key (see abtree::insert_or_assign())
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	std::pair<const_iterator, bool> insert_or_assign (const key_type & key, const mapped_type & value)
+	{
+		auto result = change(record_assign, key, &value, [this, &key, &value] () {
+			return tree_.insert_or_assign(key, value);
+		});
+		return std::make_pair(const_iterator(result.first), result.second);
+	}
+	
+	/**
+	 * Erase the item with given key, if there's any (see abtree::erase())
+	 */
+	void erase (const key_type & key)
+	{
+		change(record_erase, key, nullptr, [this, &key] () {
+			tree_.erase(key);
+			return true;
+		});
+	}
+	
+	/**
+	 * Commit the records of all changes made so far. Once it returns, the changes survive a crash.
+	 * If the log has outgrown the checkpoint size, a checkpoint is written.
+	 * @throws std::runtime_error if the log can't be written
+	 */
+	void sync ()
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+		commit();
+		if (options_.checkpoint_size > 0 && log_size_ >= options_.checkpoint_size) {
+			write_checkpoint();
+		}
+	}
+	
+	/**
+	 * Write the whole tree to a new checkpoint and start the log over. The checkpoint is written
+	 * to a temporary file, synced and renamed over the previous one, so a crash leaves either
+	 * the old checkpoint with the whole log or the new one. Replaying the log over the new checkpoint
+	 * doesn't change anything, so the log can be emptied afterwards.
+	 * @throws std::runtime_error if the files can't be written
+	 */
+	void checkpoint ()
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		write_checkpoint();
+	}
+	
+	/**
+	 * Get the total number of items in the tree
+	 */
+	size_t size () const
+	{
+		return tree_.size();
+	}
+	
+	/**
+	 * Find out whether the tree is empty
+	 */
+	bool empty () const
+	{
+		return tree_.empty();
+	}
+};
+
+#endif
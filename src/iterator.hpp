@@ -2,18 +2,46 @@
 #define _ABTREE_ITERATOR_HPP_
 
 #include <iterator>
+#include <type_traits>
 #include "vertex.hpp"
 
-template <typename TKey, typename TVal>
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator, typename Aggregate>
 class abtree;
 
 /**
- * An (a, b)-tree iterator
+ * The keys and values of a vertex are stored in separate arrays, so dereferencing an iterator
+ * yields a pair of references instead of a reference to a pair.
+ * This wrapper holds such a pair so that it can be returned by operator->.
  */
-template <typename TKey, typename TVal>
-class abtree_iterator: public std::iterator<std::bidirectional_iterator_tag, std::pair<TKey, TVal> > {
+template <typename TReference>
+struct abtree_arrow_proxy
+{
+	TReference ref;
+	
+	TReference * operator-> ()
+	{
+		return &ref;
+	}
+};
+
+/**
+ * An (a, b)-tree iterator. A const_iterator is obtained by using a const-qualified value type.
+ * @tparam TVertex The vertex type of the tree
+ * @tparam TVal The value type of the tree (possibly const-qualified)
+ */
+template <typename TVertex, typename TVal>
+class abtree_iterator: public std::iterator<
+	std::bidirectional_iterator_tag,
+	std::pair<const typename TVertex::key_type, typename std::remove_const<TVal>::type>,
+	std::ptrdiff_t,
+	abtree_arrow_proxy<std::pair<const typename TVertex::key_type &, TVal &> >,
+	std::pair<const typename TVertex::key_type &, TVal &>
+> {
 public:
-	typedef abtree_vertex<TKey, TVal> vertex;
+	typedef TVertex vertex;
+	typedef typename TVertex::key_type key_type;
+	typedef std::pair<const key_type &, TVal &> reference;
+	typedef abtree_arrow_proxy<reference> pointer;
 	
 	/**
 	 * Parameterless constructor (used only for variable declarations)
@@ -27,8 +55,8 @@ public:
 	abtree_iterator & operator++ ()
 	{
 		bool descending = false;
-		if (vertex_->children[0] != nullptr) {
-			while (vertex_->children[0] != nullptr) {
+		if (!vertex_->leaf) {
+			while (!vertex_->leaf) {
 				if (position_ < vertex_->item_count) {
 					if (!descending) {
 						vertex_ = vertex_->children[position_ + 1];
@@ -42,13 +70,18 @@ public:
 					break;
 				}
 			}
+			// The walk through a new leaf has just begun, there's plenty of time to load the next one
+			vertex * parent = vertex_->parent;
+			if (vertex_->leaf && parent != nullptr && vertex_->index < parent->item_count) {
+				vertex_->prefetch_sibling(parent->children[vertex_->index + 1]);
+			}
 		} else {
 			position_++;
 			while (position_ >= vertex_->item_count) {
 				if (vertex_->parent == nullptr) {
 					break; // incrementing end
 				} else {
-					position_ = vertex_->parent->search(vertex_->items[0]->first);
+					position_ = vertex_->index;
 					vertex_ = vertex_->parent;
 				}
 			}
@@ -73,8 +106,8 @@ public:
 	abtree_iterator & operator-- ()
 	{
 		bool descending = false;
-		if (vertex_->children[0] != nullptr) {
-			while (vertex_->children[0] != nullptr) {
+		if (!vertex_->leaf) {
+			while (!vertex_->leaf) {
 				if (!descending) {
 					vertex_ = vertex_->children[position_];
 					descending = true;
@@ -83,12 +116,16 @@ public:
 				}
 				position_ = vertex_->item_count - 1;
 			}
+			vertex * parent = vertex_->parent;
+			if (parent != nullptr && vertex_->index > 0) {
+				vertex_->prefetch_sibling(parent->children[vertex_->index - 1]);
+			}
 		} else {
 			while (position_ == 0) {
 				if (vertex_->parent == nullptr) {
 					break; // decrementing start
 				} else {
-					position_ = vertex_->parent->search(vertex_->items[0]->first);
+					position_ = vertex_->index;
 					vertex_ = vertex_->parent;
 				}
 			}
@@ -108,14 +145,14 @@ public:
 		return old;
 	}
 	
-	std::pair<const TKey, TVal> & operator* ()
+	reference operator* () const
 	{
-		return *(vertex_->items[position_]);
+		return reference(vertex_->keys[position_], vertex_->values[position_]);
 	}
 	
-	std::pair<const TKey, TVal> * operator-> ()
+	pointer operator-> () const
 	{
-		return vertex_->items[position_];
+		return pointer{**this};
 	}
 	
 	/**
@@ -134,9 +171,17 @@ public:
 		return !operator==(it);
 	}
 	
-	operator abtree_iterator<TKey, TVal const> () const;
+	/**
+	 * An iterator can always be converted to a const_iterator pointing to the same item
+	 */
+	operator abtree_iterator<TVertex, TVal const> () const
+	{
+		return abtree_iterator<TVertex, TVal const>(vertex_, position_);
+	}
 private:
-	friend class abtree<TKey, TVal>;
+	template <typename, typename, size_t, size_t, typename, typename>
+	friend class abtree;
+	friend class abtree_iterator<TVertex, typename std::remove_const<TVal>::type>;
 	
 	/**
 	 * Construct an iterator pointing to given position in given vertex
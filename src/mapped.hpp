@@ -0,0 +1,366 @@
+#ifndef _ABTREE_MAPPED_HPP_
+#define _ABTREE_MAPPED_HPP_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <iterator>
+#include <type_traits>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mapped_vertex.hpp"
+#include "mapped_iterator.hpp"
+
+/**
+ * Write a sorted range of items to a file that abtree_mapped can open. The vertices are built bottom-up
+ * while the range is read (the leaves first, then the levels above them), each of them in its own block,
+ * so the file is written sequentially and only the separators of the level being built are kept in memory.
+ * The keys and the values are copied byte by byte, so they have to be trivially copyable.
+ * @param path The path of the file, an existing file is overwritten
+ * @param first, last The range of items (pairs of a key and a value) sorted by strictly increasing keys,
+ * such as a whole tree
+ * @param block_size The size of the blocks of the file, a multiple of the page size makes every vertex
+ * occupy whole pages
+ * @throws std::invalid_argument if the block size is not a multiple of 64 or it's too small for the items
+ * @throws std::runtime_error if the file can't be written
+ */
+template <typename InputIterator>
+void abtree_write_mapped (const std::string & path, InputIterator first, InputIterator last, size_t block_size = 4096)
+{
+	typedef typename std::iterator_traits<InputIterator>::value_type item_type;
+	typedef typename std::remove_const<typename item_type::first_type>::type key_type;
+	typedef typename std::remove_const<typename item_type::second_type>::type mapped_type;
+	typedef abtree_mapped_vertex<key_type, mapped_type> vertex;
+	static_assert(std::is_trivially_copyable<key_type>::value, "the keys have to be trivially copyable");
+	static_assert(std::is_trivially_copyable<mapped_type>::value, "the values have to be trivially copyable");
+	
+	size_t leaf_capacity = vertex::leaf_capacity(block_size);
+	size_t inner_capacity = vertex::inner_capacity(block_size);
+	if (block_size % 64 != 0 || block_size < sizeof(abtree_mapped_header) || leaf_capacity < 1 || inner_capacity < 3) {
+		throw std::invalid_argument("block_size");
+	}
+	
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	std::vector<char> block(block_size, 0);
+	out.write(block.data(), block_size); // The header is written at the end
+	
+	// The smallest key in every vertex of the level being built and the block of the vertex
+	std::vector<std::pair<key_type, uint64_t> > level;
+	uint64_t next_block = 1;
+	uint64_t size = 0;
+	
+	while (first != last) {
+		std::memset(block.data(), 0, block_size);
+		vertex * leaf = reinterpret_cast<vertex *>(block.data());
+		key_type * keys = const_cast<key_type *>(leaf->keys());
+		mapped_type * values = const_cast<mapped_type *>(leaf->values(leaf_capacity));
+		leaf->leaf = 1;
+		for (; first != last && leaf->item_count < leaf_capacity; ++first) {
+			keys[leaf->item_count] = first->first;
+			values[leaf->item_count] = first->second;
+			leaf->item_count++;
+		}
+		size += leaf->item_count;
+		level.push_back(std::make_pair(keys[0], next_block++));
+		out.write(block.data(), block_size);
+	}
+	uint64_t leaf_count = level.size();
+	
+	// The children are divided evenly, so every vertex but the root gets at least (inner_capacity + 1) / 2 of them
+	while (level.size() > 1) {
+		size_t fanout = inner_capacity + 1;
+		size_t groups = (level.size() + fanout - 1) / fanout;
+		std::vector<std::pair<key_type, uint64_t> > upper;
+		size_t child = 0;
+		for (size_t g = 0; g < groups; g++) {
+			size_t count = level.size() / groups + (g < level.size() % groups);
+			std::memset(block.data(), 0, block_size);
+			vertex * inner = reinterpret_cast<vertex *>(block.data());
+			key_type * keys = const_cast<key_type *>(inner->keys());
+			uint64_t * children = const_cast<uint64_t *>(inner->children(inner_capacity));
+			for (size_t i = 0; i < count; i++) {
+				if (i > 0) {
+					keys[i - 1] = level[child + i].first;
+				}
+				children[i] = level[child + i].second;
+			}
+			inner->item_count = count - 1;
+			upper.push_back(std::make_pair(level[child].first, next_block++));
+			out.write(block.data(), block_size);
+			child += count;
+		}
+		level.swap(upper);
+	}
+	
+	abtree_mapped_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, abtree_mapped_header::signature(), sizeof(header.magic));
+	header.version = abtree_mapped_header::current_version;
+	header.block_size = block_size;
+	header.key_size = sizeof(key_type);
+	header.value_size = sizeof(mapped_type);
+	header.size = size;
+	header.root = level.empty() ? 0 : level[0].second;
+	header.first_leaf = 1;
+	header.leaf_count = leaf_count;
+	out.seekp(0);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	
+	out.close();
+	if (!out) {
+		throw std::runtime_error("can't write " + path);
+	}
+}
+
+/**
+ * Write all items of a tree to a file that abtree_mapped can open (see above)
+ */
+template <typename TTree>
+void abtree_write_mapped (const std::string & path, const TTree & tree, size_t block_size = 4096)
+{
+	abtree_write_mapped(path, tree.cbegin(), tree.cend(), block_size);
+}
+
+/**
+ * A read-only (a, b)-tree served directly from a file written by abtree_write_mapped().
+ * Opening the file only maps it into memory, nothing is deserialized, so it takes O(1) time
+ * and the vertices are loaded by page faults as the searches reach them. Since a vertex occupies
+ * a whole block (page), a search touches one page per level and a traversal reads the leaves sequentially.
+ * The keys and the values are used in place, so they have to be trivially copyable and the file
+ * has to be written on the same kind of machine with the same types.
+ * Any number of threads can read the tree at once. The file mustn't change while it's mapped.
+ */
+template <typename TKey, typename TVal>
+class abtree_mapped
+{
+	typedef abtree_mapped_vertex<TKey, TVal> vertex;
+	static_assert(std::is_trivially_copyable<TKey>::value, "the keys have to be trivially copyable");
+	static_assert(std::is_trivially_copyable<TVal>::value, "the values have to be trivially copyable");
+	
+public:
+	typedef abtree_mapped_iterator<TKey, TVal> const_iterator;
+	typedef const_iterator iterator;
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+	
+private:
+	const char * base_;
+	size_t length_;
+	const abtree_mapped_header * header_;
+	size_t leaf_capacity_;
+	size_t inner_capacity_;
+	
+	/**
+	 * The vertex stored in given block
+	 */
+	const vertex * vertex_at (uint64_t block) const
+	{
+		return reinterpret_cast<const vertex *>(base_ + block * header_->block_size);
+	}
+	
+	/**
+	 * Check that the header describes a file this tree can read and that all of its blocks are present
+	 * @throws std::runtime_error otherwise
+	 */
+	void check_header (const std::string & path) const
+	{
+		const abtree_mapped_header & h = *header_;
+		uint64_t blocks = h.block_size > 0 ? length_ / h.block_size : 0;
+		bool valid = (
+			std::memcmp(h.magic, abtree_mapped_header::signature(), sizeof(h.magic)) == 0 &&
+			h.version == abtree_mapped_header::current_version &&
+			h.key_size == sizeof(TKey) && h.value_size == sizeof(TVal) &&
+			h.block_size % 64 == 0 && vertex::leaf_capacity(h.block_size) > 0 &&
+			h.root < blocks && h.first_leaf + h.leaf_count <= blocks &&
+			(h.size == 0) == (h.leaf_count == 0)
+		);
+		if (!valid) {
+			throw std::runtime_error(path + " is not a compatible abtree file");
+		}
+	}
+	
+	/**
+	 * Find the leaf that should contain given key and the position of the first key in it
+	 * that is larger than or equal to the key
+	 */
+	const_iterator do_lower_bound (const key_type & key) const
+	{
+		if (header_->size == 0) {
+			return end();
+		}
+		uint64_t block = header_->root;
+		const vertex * cursor = vertex_at(block);
+		while (!cursor->leaf) {
+			block = cursor->children(inner_capacity_)[cursor->child_index(key)];
+			cursor = vertex_at(block);
+		}
+		size_t i = cursor->search(key);
+		if (i == cursor->item_count) {
+			block++;
+			i = 0;
+		}
+		return const_iterator(base_, header_->block_size, leaf_capacity_, block, i);
+	}
+	
+public:
+	/**
+	 * Map a file written by abtree_write_mapped()
+	 * @param path The path of the file
+	 * @throws std::runtime_error if the file can't be mapped or it's not a compatible abtree file
+	 */
+	explicit abtree_mapped (const std::string & path)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("can't open " + path);
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(abtree_mapped_header)) {
+			close(fd);
+			throw std::runtime_error(path + " is not a compatible abtree file");
+		}
+		length_ = st.st_size;
+		void * mapping = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) {
+			throw std::runtime_error("can't map " + path);
+		}
+		
+		base_ = static_cast<const char *>(mapping);
+		header_ = reinterpret_cast<const abtree_mapped_header *>(base_);
+		try {
+			check_header(path);
+		} catch (...) {
+			munmap(mapping, length_);
+			throw;
+		}
+		leaf_capacity_ = vertex::leaf_capacity(header_->block_size);
+		inner_capacity_ = vertex::inner_capacity(header_->block_size);
+	}
+	
+	/**
+	 * The move constructor. The other tree is left without any mapping and can only be destroyed.
+	 */
+	abtree_mapped (abtree_mapped && other)
+		: base_(other.base_), length_(other.length_), header_(other.header_),
+		leaf_capacity_(other.leaf_capacity_), inner_capacity_(other.inner_capacity_)
+	{
+		other.base_ = nullptr;
+	}
+	
+	abtree_mapped (const abtree_mapped &) = delete;
+	abtree_mapped & operator= (const abtree_mapped &) = delete;
+	
+	/**
+	 * The destructor. Unmaps the file, iterators mustn't be used anymore.
+	 */
+	~abtree_mapped ()
+	{
+		if (base_ != nullptr) {
+			munmap(const_cast<char *>(base_), length_);
+		}
+	}
+	
+	/**
+	 * @name Return an iterator to the first (and smallest) item in the tree
+	 */
+	//@{
+	const_iterator begin () const
+	{
+		return const_iterator(base_, header_->block_size, leaf_capacity_, header_->first_leaf, 0);
+	}
+	
+	const_iterator cbegin () const
+	{
+		return begin();
+	}
+	//@}
+	
+	/**
+	 * @name Return an iterator pointing behind the last item in the tree
+	 */
+	//@{
+	const_iterator end () const
+	{
+		return const_iterator(base_, header_->block_size, leaf_capacity_, header_->first_leaf + header_->leaf_count, 0);
+	}
+	
+	const_iterator cend () const
+	{
+		return end();
+	}
+	//@}
+	
+	/**
+	 * Find an item with given key
+	 * @param key The key of the item
+	 * @return an iterator pointing to the item or end() if there's no such item
+	 */
+	const_iterator find (const key_type & key) const
+	{
+		const_iterator it = do_lower_bound(key);
+		if (it != end() && !(key < it->first)) {
+			return it;
+		}
+		return end();
+	}
+	
+	/**
+	 * Get the value of the item with given key
+	 * @throws std::out_of_range if there is no such item
+	 */
+	const TVal & at (const key_type & key) const
+	{
+		const_iterator it = find(key);
+		if (it != end()) {
+			return it->second;
+		}
+		throw std::out_of_range("abtree_mapped::at");
+	}
+	
+	/**
+	 * Find the first item whose key is larger than or equal to given key
+	 * @return an iterator pointing to the item or end() if there's no such item
+	 */
+	const_iterator lower_bound (const key_type & key) const
+	{
+		return do_lower_bound(key);
+	}
+	
+	/**
+	 * Find the first item whose key is larger than given key
+	 * @return an iterator pointing to the item or end() if there's no such item
+	 */
+	const_iterator upper_bound (const key_type & key) const
+	{
+		const_iterator it = do_lower_bound(key);
+		if (it != end() && !(key < it->first)) {
+			++it;
+		}
+		return it;
+	}
+	
+	/**
+	 * Get the total number of items in the tree
+	 */
+	size_t size () const
+	{
+		return header_->size;
+	}
+	
+	/**
+	 * Find out whether the tree is empty
+	 */
+	bool empty () const
+	{
+		return header_->size == 0;
+	}
+};
+
+#endif
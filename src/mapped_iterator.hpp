@@ -0,0 +1,133 @@
+#ifndef _ABTREE_MAPPED_ITERATOR_HPP_
+#define _ABTREE_MAPPED_ITERATOR_HPP_
+
+#include <iterator>
+#include "iterator.hpp"
+#include "mapped_vertex.hpp"
+
+/**
+ * A (read-only) iterator of a tree mapped from a file (see abtree_mapped). The leaves of the file occupy
+ * a contiguous run of blocks in the order of their keys and none of them is empty, so the iterator
+ * moves to the neighbouring leaf by moving to the neighbouring block.
+ * The past-the-end iterator points to the first item of the block behind the last leaf.
+ */
+template <typename TKey, typename TVal>
+class abtree_mapped_iterator: public std::iterator<
+	std::bidirectional_iterator_tag,
+	std::pair<const TKey, TVal>,
+	std::ptrdiff_t,
+	abtree_arrow_proxy<std::pair<const TKey &, const TVal &> >,
+	std::pair<const TKey &, const TVal &>
+> {
+public:
+	typedef abtree_mapped_vertex<TKey, TVal> vertex;
+	typedef std::pair<const TKey &, const TVal &> reference;
+	typedef abtree_arrow_proxy<reference> pointer;
+	
+	/**
+	 * Parameterless constructor (used only for variable declarations)
+	 */
+	abtree_mapped_iterator ()
+	{}
+	
+	/**
+	 * Move the iterator one item forward (prefix version)
+	 */
+	abtree_mapped_iterator & operator++ ()
+	{
+		position_++;
+		if (position_ == leaf()->item_count) {
+			block_++;
+			position_ = 0;
+		}
+		return *this;
+	}
+	
+	/**
+	 * Move the iterator one item forward (postfix version)
+	 */
+	abtree_mapped_iterator operator++ (int)
+	{
+		auto old = *this;
+		this->operator++();
+		return old;
+	}
+	
+	/**
+	 * Move the iterator one item backward (prefix version)
+	 */
+	abtree_mapped_iterator & operator-- ()
+	{
+		if (position_ == 0) {
+			block_--;
+			position_ = leaf()->item_count;
+		}
+		position_--;
+		return *this;
+	}
+	
+	/**
+	 * Move the iterator one item backward (postfix version)
+	 */
+	abtree_mapped_iterator operator-- (int)
+	{
+		auto old = *this;
+		this->operator--();
+		return old;
+	}
+	
+	reference operator* () const
+	{
+		return reference(leaf()->keys()[position_], leaf()->values(capacity_)[position_]);
+	}
+	
+	pointer operator-> () const
+	{
+		return pointer{**this};
+	}
+	
+	/**
+	 * Two iterators are considered equal when they point to the same block and position
+	 */
+	bool operator== (const abtree_mapped_iterator & it)
+	{
+		return (
+			position_ == it.position_ &&
+			block_ == it.block_
+		);
+	}
+	
+	bool operator!= (const abtree_mapped_iterator & it)
+	{
+		return !operator==(it);
+	}
+private:
+	template <typename, typename>
+	friend class abtree_mapped;
+	
+	/**
+	 * Construct an iterator pointing to given position in given leaf
+	 * (Only the tree can construct an iterator this way)
+	 * @param base the start of the mapping
+	 * @param block_size the size of the blocks of the file
+	 * @param capacity the number of items a leaf can hold
+	 * @param block the block of the leaf
+	 * @param position the position of the item in the leaf
+	 */
+	abtree_mapped_iterator (const char * base, size_t block_size, size_t capacity, uint64_t block, size_t position)
+		: base_(base), block_size_(block_size), capacity_(capacity), block_(block), position_(position)
+	{}
+	
+	const vertex * leaf () const
+	{
+		return reinterpret_cast<const vertex *>(base_ + block_ * block_size_);
+	}
+	
+	const char * base_;
+	size_t block_size_;
+	size_t capacity_;
+	uint64_t block_;
+	size_t position_;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef _ABTREE_MAPPED_VERTEX_HPP_
+#define _ABTREE_MAPPED_VERTEX_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include "search.hpp"
+#include "vertex.hpp"
+
+/**
+ * The first block of a file written by abtree_write_mapped(). All numbers are stored in the byte order
+ * of the machine that wrote the file, which has to be the machine that reads it.
+ */
+struct abtree_mapped_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t key_size;
+	uint32_t value_size;
+	uint64_t size; // The number of items
+	uint64_t root; // The block of the root (0 if the file doesn't contain any item)
+	uint64_t first_leaf; // The leaves occupy a contiguous run of blocks in the order of their keys
+	uint64_t leaf_count;
+	
+	/**
+	 * The magic string at the start of every file
+	 */
+	static const char * signature ()
+	{
+		return "abtree\x01";
+	}
+	
+	static const uint32_t current_version = 1;
+};
+
+/**
+ * A vertex of a tree stored in a file (see abtree_mapped). Every vertex occupies a block of the file.
+ * The layout is the one of abtree_bplus_vertex: the items are stored in the leaves, the inner vertices
+ * only contain separators (the smallest key in the subtree of the following child) and the positions
+ * of the blocks of their children instead of pointers. The vertex header is followed by the keys
+ * and then by either the values or the children.
+ * The file is never modified, so there's no need to leave room for insertions: all leaves are full
+ * except for the last one, and the children of every inner level are divided evenly among its vertices.
+ */
+template <typename TKey, typename TVal>
+struct abtree_mapped_vertex: private abtree_block_layout<abtree_mapped_vertex<TKey, TVal>, TKey, TVal, uint64_t>
+{
+	typedef abtree_block_layout<abtree_mapped_vertex, TKey, TVal, uint64_t> layout;
+	
+	uint32_t item_count;
+	uint32_t leaf;
+	
+	/**
+	 * @name Offsets of the arrays in a block (see abtree_block_layout)
+	 */
+	//@{
+	using layout::keys_offset;
+	using layout::values_offset;
+	using layout::children_offset;
+	//@}
+	
+	/**
+	 * @name The maximum number of keys in a leaf (and in an inner vertex) that fit in a block of given size
+	 */
+	//@{
+	static size_t leaf_capacity (size_t block_size)
+	{
+		size_t capacity = block_size / (sizeof(TKey) + sizeof(TVal));
+		while (capacity > 0 && layout::values_end(capacity) > block_size) {
+			capacity--;
+		}
+		return capacity;
+	}
+	
+	static size_t inner_capacity (size_t block_size)
+	{
+		size_t capacity = block_size / (sizeof(TKey) + sizeof(uint64_t));
+		while (capacity > 0 && layout::children_end(capacity, capacity + 1) > block_size) {
+			capacity--;
+		}
+		return capacity;
+	}
+	//@}
+	
+	/**
+	 * @name The arrays of the vertex. The capacity of the vertex is needed to find the values and the children.
+	 */
+	//@{
+	const TKey * keys () const
+	{
+		return reinterpret_cast<const TKey *>(reinterpret_cast<const char *>(this) + keys_offset());
+	}
+	
+	const TVal * values (size_t capacity) const
+	{
+		return reinterpret_cast<const TVal *>(reinterpret_cast<const char *>(this) + values_offset(capacity));
+	}
+	
+	const uint64_t * children (size_t capacity) const
+	{
+		return reinterpret_cast<const uint64_t *>(reinterpret_cast<const char *>(this) + children_offset(capacity));
+	}
+	//@}
+	
+	/**
+	 * Returns the index of the first key that is larger than or equal than given key
+	 */
+	size_t search (const TKey & key) const
+	{
+		return abtree_search<0>(keys(), item_count, key);
+	}
+	
+	/**
+	 * Returns the index of the child of an inner vertex whose subtree covers given key
+	 * (see abtree_bplus_vertex::child_index())
+	 */
+	size_t child_index (const TKey & key) const
+	{
+		size_t i = search(key);
+		return i < item_count && !(key < keys()[i]) ? i + 1 : i;
+	}
+};
+
+#endif
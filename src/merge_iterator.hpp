@@ -0,0 +1,104 @@
+#ifndef _ABTREE_MERGE_ITERATOR_HPP_
+#define _ABTREE_MERGE_ITERATOR_HPP_
+
+/**
+ * The set operations computed by abtree_merge_iterator
+ */
+enum abtree_set_operation
+{
+	abtree_union,
+	abtree_intersection,
+	abtree_difference
+};
+
+/**
+ * An iterator that walks two ranges of items sorted by strictly increasing keys at once
+ * and yields the items of their union, intersection or difference in the order of their keys.
+ * When both ranges contain a key, the item is taken from the first range.
+ * It only feeds the bulk load of a tree (see abtree::assign_union()), so it just supports
+ * what the bulk load needs: access to the key and the value of the current item and moving forward.
+ * @tparam TIterator The iterator type of both ranges
+ */
+template <typename TIterator>
+class abtree_merge_iterator
+{
+public:
+	/**
+	 * Construct an iterator pointing to the first item of the result
+	 * @param operation the set operation
+	 * @param x, x_end the first range
+	 * @param y, y_end the second range
+	 */
+	abtree_merge_iterator (abtree_set_operation operation, TIterator x, TIterator x_end, TIterator y, TIterator y_end)
+		: operation_(operation), x_(x), x_end_(x_end), y_(y), y_end_(y_end)
+	{
+		settle();
+	}
+	
+	/**
+	 * Move the iterator to the next item of the result
+	 */
+	abtree_merge_iterator & operator++ ()
+	{
+		if (from_x_) {
+			if (operation_ != abtree_difference && y_ != y_end_ && !(x_->first < y_->first)) {
+				++y_;
+			}
+			++x_;
+		} else {
+			++y_;
+		}
+		settle();
+		return *this;
+	}
+	
+	typename TIterator::pointer operator-> () const
+	{
+		return from_x_ ? x_.operator->() : y_.operator->();
+	}
+	
+	/**
+	 * Whether the iterator got past the last item of the result
+	 */
+	bool at_end ()
+	{
+		return x_ == x_end_ && (operation_ != abtree_union || y_ == y_end_);
+	}
+	
+private:
+	/**
+	 * Skip the items that don't belong to the result and find out which range the current item comes from
+	 */
+	void settle ()
+	{
+		from_x_ = true;
+		if (operation_ == abtree_union) {
+			from_x_ = x_ != x_end_ && (y_ == y_end_ || !(y_->first < x_->first));
+			return;
+		}
+		
+		while (x_ != x_end_) {
+			while (y_ != y_end_ && y_->first < x_->first) {
+				++y_;
+			}
+			bool in_y = y_ != y_end_ && !(x_->first < y_->first);
+			if (in_y == (operation_ == abtree_intersection)) {
+				return;
+			}
+			if (operation_ == abtree_intersection && y_ == y_end_) {
+				x_ = x_end_;
+				return;
+			}
+			++x_;
+		}
+	}
+	
+	abtree_set_operation operation_;
+	TIterator x_;
+	TIterator x_end_;
+	TIterator y_;
+	TIterator y_end_;
+	bool from_x_;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef _ABTREE_PARALLEL_HPP_
+#define _ABTREE_PARALLEL_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+
+/**
+ * The number of threads to use for a parallel operation, the number of hardware threads if it's 0
+ */
+inline size_t abtree_thread_count (size_t threads)
+{
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	return std::max(threads, size_t(1));
+}
+
+/**
+ * Call f(0), f(1), ..., f(n - 1), each on its own thread, and wait for all of them to finish.
+ * The calling thread runs f(0) itself. If any of the calls throws, the first exception
+ * (by the index of the call) is rethrown after all the threads have been joined.
+ * @param n the number of calls
+ * @param f the function
+ */
+template <typename F>
+void abtree_run_parallel (size_t n, F f)
+{
+	std::vector<std::exception_ptr> errors(n);
+	auto run = [&f, &errors] (size_t i) {
+		try {
+			f(i);
+		} catch (...) {
+			errors[i] = std::current_exception();
+		}
+	};
+	
+	std::vector<std::thread> threads;
+	threads.reserve(n);
+	for (size_t i = 1; i < n; i++) {
+		threads.emplace_back(run, i);
+	}
+	if (n > 0) {
+		run(0);
+	}
+	for (std::thread & thread: threads) {
+		thread.join();
+	}
+	
+	for (std::exception_ptr & error: errors) {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+/**
+ * Sort a range like std::stable_sort on given number of threads. The range is cut into one chunk
+ * per thread, the chunks are sorted at once and then merged in pairs, halving the number of chunks
+ * (and of the busy threads) in every round.
+ * @param first, last the range
+ * @param comp the comparison
+ * @param threads the number of threads
+ */
+template <typename RandomAccessIterator, typename Compare>
+void abtree_parallel_sort (RandomAccessIterator first, RandomAccessIterator last, Compare comp, size_t threads)
+{
+	size_t count = std::distance(first, last);
+	size_t chunks = std::max(std::min(threads, count / 2), size_t(1));
+	std::vector<RandomAccessIterator> bounds;
+	for (size_t i = 0; i <= chunks; i++) {
+		bounds.push_back(first + count * i / chunks);
+	}
+	
+	abtree_run_parallel(chunks, [&bounds, &comp] (size_t i) {
+		std::stable_sort(bounds[i], bounds[i + 1], comp);
+	});
+	
+	while (bounds.size() > 2) {
+		size_t pairs = (bounds.size() - 1) / 2;
+		abtree_run_parallel(pairs, [&bounds, &comp] (size_t i) {
+			std::inplace_merge(bounds[2 * i], bounds[2 * i + 1], bounds[2 * i + 2], comp);
+		});
+		
+		std::vector<RandomAccessIterator> merged;
+		for (size_t i = 0; i < bounds.size(); i += 2) {
+			merged.push_back(bounds[i]);
+		}
+		if (merged.back() != last) {
+			merged.push_back(last);
+		}
+		bounds.swap(merged);
+	}
+}
+
+#endif
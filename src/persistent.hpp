@@ -0,0 +1,738 @@
+#ifndef _ABTREE_PERSISTENT_HPP_
+#define _ABTREE_PERSISTENT_HPP_
+
+#include <stdexcept>
+#include "abtree.hpp"
+#include "persistent_vertex.hpp"
+#include "persistent_iterator.hpp"
+
+/**
+ * A read-only version of a persistent (a, b)-tree (see abtree_persistent). It's obtained in O(1)
+ * by abtree_persistent::snapshot() (or by copying any other snapshot) and it shares all of its vertices
+ * with the tree it's been taken from, no matter how the tree is modified afterwards.
+ * Nothing in a snapshot ever changes, so any number of threads can read it without locking, even while
+ * the tree it's been taken from is being modified. Vertices that only this snapshot still refers to
+ * are released when it's destroyed, which may happen in any thread as long as the allocator is thread-safe
+ * (the default one is).
+ * @tparam A, B The (a, b) parameters of the tree if they are fixed at compile time, 0 otherwise
+ * @tparam Allocator A std::allocator-compatible allocator (see abtree)
+ */
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >
+>
+class abtree_snapshot: private abtree_params<A, B> {
+protected:
+	typedef abtree_persistent_vertex<TKey, TVal, B> vertex;
+	typedef abtree_params<A, B> params;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<abtree_cache_line> block_allocator;
+	
+public:
+	typedef abtree_persistent_iterator<vertex> const_iterator;
+	typedef const_iterator iterator;
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+	typedef Allocator allocator_type;
+	
+protected:
+	using params::a;
+	using params::b;
+	
+	vertex * root;
+	size_t size_;
+	block_allocator alloc_;
+	
+	/**
+	 * Construct a handle without any root (used by abtree_persistent, which creates the root itself)
+	 */
+	abtree_snapshot (const params & p, const Allocator & alloc): params(p), root(nullptr), size_(0), alloc_(alloc)
+	{
+	}
+	
+	/**
+	 * Allocate a new vertex using the allocator of the tree
+	 * @param leaf whether the vertex is a leaf
+	 */
+	vertex * create_vertex (bool leaf)
+	{
+		return vertex::create(alloc_, b, leaf);
+	}
+	
+	/**
+	 * Destroy a vertex and return its memory to the allocator of the tree
+	 */
+	void destroy_vertex (vertex * v)
+	{
+		vertex::destroy(alloc_, v, b);
+	}
+	
+	/**
+	 * Drop a reference to a vertex. If it was the last one, the vertex is destroyed
+	 * and its children are released as well.
+	 */
+	void release (vertex * v)
+	{
+		if (v->references.fetch_sub(1) == 1) {
+			if (!v->leaf) {
+				for (size_t i = 0; i <= v->item_count; i++) {
+					release(v->children[i]);
+				}
+			}
+			destroy_vertex(v);
+		}
+	}
+	
+	/**
+	 * Find the leaf whose range covers given key
+	 */
+	vertex * find_leaf (const key_type & key) const
+	{
+		vertex * cursor = root;
+		while (!cursor->leaf) {
+			cursor = cursor->children[cursor->child_index(key)];
+		}
+		return cursor;
+	}
+	
+	/**
+	 * A function template for the lower_bound() and upper_bound() methods
+	 * @param key the key to search for
+	 * @param strict whether an item with a key equal to given key should be skipped
+	 */
+	const_iterator do_bound (const key_type & key, bool strict) const
+	{
+		vertex * leaf = find_leaf(key);
+		size_t i = leaf->search(key);
+		if (strict && i < leaf->item_count && leaf->keys[i] == key) {
+			i++;
+		}
+		return const_iterator(root, leaf, i);
+	}
+	
+public:
+	/**
+	 * The copy constructor. Both handles share the same vertices, so it takes O(1).
+	 */
+	abtree_snapshot (const abtree_snapshot & other)
+		: params(other), root(other.root), size_(other.size_), alloc_(other.alloc_)
+	{
+		root->references++;
+	}
+	
+	abtree_snapshot & operator= (const abtree_snapshot &) = delete;
+	
+	/**
+	 * The destructor. Releases the vertices no other version of the tree refers to.
+	 */
+	~abtree_snapshot ()
+	{
+		if (root != nullptr) {
+			release(root);
+		}
+	}
+	
+	/**
+	 * @name Return an iterator to the first (and smallest) item
+	 */
+	//@{
+	const_iterator begin () const
+	{
+		vertex * cursor = root;
+		while (!cursor->leaf) {
+			cursor = cursor->children[0];
+		}
+		return const_iterator(root, cursor, 0);
+	}
+	
+	const_iterator cbegin () const
+	{
+		return begin();
+	}
+	//@}
+	
+	/**
+	 * @name Return an iterator pointing to the item that would follow the last (and largest) item
+	 */
+	//@{
+	const_iterator end () const
+	{
+		return const_iterator(root, nullptr, 0);
+	}
+	
+	const_iterator cend () const
+	{
+		return end();
+	}
+	//@}
+	
+	/**
+	 * If an item with specified key is present, return an iterator pointing to it. If it is not, return end().
+	 * @param key The key to search for
+	 * @return an iterator pointing to given item or past the end
+	 */
+	const_iterator find (const key_type & key) const
+	{
+		vertex * leaf = find_leaf(key);
+		size_t i = leaf->search(key);
+		if (i < leaf->item_count && leaf->keys[i] == key) {
+			return const_iterator(root, leaf, i);
+		}
+		return end();
+	}
+	
+	/**
+	 * Return a reference to the value of the item with given key if it is present, throw an exception otherwise.
+	 * @return a reference to the value with specified key
+	 * @throws std::out_of_range if given key is not found
+	 */
+	const mapped_type & at (const key_type & key) const
+	{
+		vertex * leaf = find_leaf(key);
+		size_t i = leaf->search(key);
+		if (i < leaf->item_count && leaf->keys[i] == key) {
+			return leaf->values[i];
+		}
+		throw std::out_of_range("abtree_persistent::at");
+	}
+	
+	/**
+	 * Returns an iterator pointing to the smallest item that has a key larger or equal to given key.
+	 * If there's no such item, returns end().
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	const_iterator lower_bound (const key_type & key) const
+	{
+		return do_bound(key, false);
+	}
+	
+	/**
+	 * Returns an iterator pointing to the smallest item that has a key larger than given key.
+	 * If there's no such item, returns end().
+	 * @param key The key to search for
+	 * @return An iterator pointing to desired item or end()
+	 */
+	const_iterator upper_bound (const key_type & key) const
+	{
+		return do_bound(key, true);
+	}
+	
+	/**
+	 * Get a copy of the allocator the tree was constructed with
+	 */
+	allocator_type get_allocator () const
+	{
+		return allocator_type(alloc_);
+	}
+	
+	/**
+	 * Get the total number of items
+	 * @return the number of items
+	 */
+	size_t size () const
+	{
+		return size_;
+	}
+	
+	/**
+	 * Find out whether there are no items
+	 * @return True if there are no items, false otherwise
+	 */
+	bool empty () const
+	{
+		return size_ == 0;
+	}
+};
+
+/**
+ * A persistent associative container that uses the B+ variant of (a, b)-trees to store data.
+ * Vertices are reference-counted and shared between the tree and its snapshots: snapshot() (as well as
+ * copying the tree) takes O(1) and every later insert or erase copies just the vertices it modifies
+ * that are still shared, which is the path from the root to a leaf (and the neighbours it borrows
+ * items from). Vertices are rebalanced on the way down: an insertion splits every full vertex before
+ * entering it and an erasure refills every vertex with a - 1 keys from a neighbour (or merges the two),
+ * so a modification never has to go back up the path. Splitting a full vertex leaves both halves
+ * with at least a - 1 keys only if b >= 2a.
+ * The tree itself needs external synchronization just like abtree, but its snapshots don't (see abtree_snapshot).
+ * Only read-only iterators are provided, and all of them are invalidated by any modification of the tree.
+ * @tparam A, B The (a, b) parameters of the tree if they should be fixed at compile time.
+ * If both of them are 0 (the default), the parameters are passed to the constructor instead.
+ * b has to be at least 2a.
+ * @tparam Allocator A std::allocator-compatible allocator (see abtree)
+ */
+template <
+	typename TKey,
+	typename TVal,
+	size_t A = 0,
+	size_t B = 0,
+	typename Allocator = abtree_aligned_allocator<std::pair<const TKey, TVal> >
+>
+class abtree_persistent: public abtree_snapshot<TKey, TVal, A, B, Allocator> {
+	static_assert(B == 0 || B >= 2 * A, "b has to be at least 2 * a");
+	
+	typedef abtree_snapshot<TKey, TVal, A, B, Allocator> base;
+	typedef typename base::vertex vertex;
+	typedef typename base::params params;
+	
+public:
+	typedef base snapshot_type;
+	typedef typename base::const_iterator const_iterator;
+	typedef typename base::iterator iterator;
+	typedef typename base::key_type key_type;
+	typedef typename base::mapped_type mapped_type;
+	typedef typename base::value_type value_type;
+	typedef typename base::allocator_type allocator_type;
+	
+private:
+	using base::a;
+	using base::b;
+	using base::root;
+	using base::size_;
+	using base::create_vertex;
+	using base::destroy_vertex;
+	using base::release;
+	
+	/**
+	 * Create a copy of a shared vertex, which refers to the same children
+	 */
+	vertex * clone (const vertex * v)
+	{
+		vertex * copy = create_vertex(v->leaf);
+		try {
+			for (size_t i = 0; i < v->item_count; i++) {
+				if (v->leaf) {
+					copy->construct_item(i, v->keys[i], v->values[i]);
+				} else {
+					new (&copy->keys[i]) TKey(v->keys[i]);
+				}
+				copy->item_count++;
+			}
+		} catch (...) {
+			destroy_vertex(copy);
+			throw;
+		}
+		if (!v->leaf) {
+			for (size_t i = 0; i <= v->item_count; i++) {
+				copy->children[i] = v->children[i];
+				copy->children[i]->references++;
+			}
+		}
+		return copy;
+	}
+	
+	/**
+	 * Make sure that a vertex is referenced only by this tree, so that it can be modified.
+	 * A shared vertex is replaced by its copy. The vertex holding the pointer has to be owned already.
+	 * @param v the pointer to the vertex (the root or a child of an owned vertex)
+	 * @return the owned vertex
+	 */
+	vertex * own (vertex *& v)
+	{
+		if (v->references.load() > 1) {
+			vertex * copy = clone(v);
+			release(v);
+			v = copy;
+		}
+		return v;
+	}
+	
+	/**
+	 * Split the i-th child of given vertex, which has b - 1 keys, in half. In case of leaves, a copy of
+	 * the first key of the new leaf becomes the separator, otherwise the middle separator moves up.
+	 * Both the vertex and the child have to be owned.
+	 * @param parent the vertex, which must have less than b - 1 keys
+	 * @param i the position of the child
+	 */
+	void split_child (vertex * parent, size_t i)
+	{
+		vertex * child = parent->children[i];
+		vertex * sibling = create_vertex(child->leaf);
+		size_t count = child->item_count;
+		size_t middle = count / 2;
+		
+		for (size_t j = parent->item_count; j > i; j--) {
+			parent->move_key(j - 1, parent, j);
+			parent->children[j + 1] = parent->children[j];
+		}
+		parent->children[i + 1] = sibling;
+		parent->item_count++;
+		
+		if (child->leaf) {
+			for (size_t j = middle; j < count; j++) {
+				child->move_item(j, sibling, j - middle);
+			}
+			sibling->item_count = count - middle;
+			child->item_count = middle;
+			new (&parent->keys[i]) TKey(sibling->keys[0]);
+		} else {
+			for (size_t j = middle + 1; j < count; j++) {
+				child->move_key(j, sibling, j - (middle + 1));
+			}
+			for (size_t j = middle + 1; j <= count; j++) {
+				sibling->children[j - (middle + 1)] = child->children[j];
+			}
+			sibling->item_count = count - (middle + 1);
+			child->item_count = middle;
+			child->move_key(middle, parent, i);
+		}
+	}
+	
+	/**
+	 * Move the last item (or child) of the k-th child of an owned vertex to the (k + 1)-th child.
+	 * Both children have to be owned.
+	 */
+	void rotate_right (vertex * parent, size_t k)
+	{
+		vertex * left = parent->children[k];
+		vertex * right = parent->children[k + 1];
+		
+		if (right->leaf) {
+			for (size_t j = right->item_count; j > 0; j--) {
+				right->move_item(j - 1, right, j);
+			}
+			left->move_item(left->item_count - 1, right, 0);
+			parent->keys[k] = right->keys[0];
+		} else {
+			for (size_t j = right->item_count; j > 0; j--) {
+				right->move_key(j - 1, right, j);
+			}
+			for (size_t j = right->item_count + 1; j > 0; j--) {
+				right->children[j] = right->children[j - 1];
+			}
+			parent->move_key(k, right, 0);
+			right->children[0] = left->children[left->item_count];
+			left->move_key(left->item_count - 1, parent, k);
+		}
+		
+		right->item_count++;
+		left->item_count--;
+	}
+	
+	/**
+	 * Move the first item (or child) of the (k + 1)-th child of an owned vertex to the k-th child.
+	 * Both children have to be owned.
+	 */
+	void rotate_left (vertex * parent, size_t k)
+	{
+		vertex * left = parent->children[k];
+		vertex * right = parent->children[k + 1];
+		
+		if (left->leaf) {
+			right->move_item(0, left, left->item_count);
+			for (size_t j = 1; j < right->item_count; j++) {
+				right->move_item(j, right, j - 1);
+			}
+			parent->keys[k] = right->keys[0];
+		} else {
+			parent->move_key(k, left, left->item_count);
+			left->children[left->item_count + 1] = right->children[0];
+			right->move_key(0, parent, k);
+			for (size_t j = 1; j < right->item_count; j++) {
+				right->move_key(j, right, j - 1);
+			}
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->children[j] = right->children[j + 1];
+			}
+		}
+		
+		left->item_count++;
+		right->item_count--;
+	}
+	
+	/**
+	 * Merge the (k + 1)-th child of an owned vertex into the k-th child. The separator between them is dropped
+	 * (in case of leaves) or moved down (in case of inner vertices). Both children have to be owned.
+	 */
+	void merge_children (vertex * parent, size_t k)
+	{
+		vertex * left = parent->children[k];
+		vertex * right = parent->children[k + 1];
+		
+		if (left->leaf) {
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->move_item(j, left, left->item_count + j);
+			}
+			parent->keys[k].~TKey();
+		} else {
+			parent->move_key(k, left, left->item_count);
+			left->item_count++;
+			for (size_t j = 0; j < right->item_count; j++) {
+				right->move_key(j, left, left->item_count + j);
+			}
+			for (size_t j = 0; j <= right->item_count; j++) {
+				left->children[left->item_count + j] = right->children[j];
+			}
+		}
+		left->item_count += right->item_count;
+		right->item_count = 0;
+		// The children of the right vertex now belong to the left one, so it's destroyed without releasing them
+		destroy_vertex(right);
+		
+		for (size_t j = k + 1; j < parent->item_count; j++) {
+			parent->move_key(j, parent, j - 1);
+			parent->children[j] = parent->children[j + 1];
+		}
+		parent->item_count--;
+	}
+	
+	/**
+	 * Refill the i-th child of an owned vertex, which has a - 1 keys, either by moving an item from
+	 * a neighbour or by merging it with the neighbour. The child has to be owned as well.
+	 * If the last two children of the root get merged, the merged vertex becomes the new root.
+	 * @param parent the vertex, which must have at least a keys unless it's the root
+	 * @param i the position of the child
+	 * @return the vertex that covers the range of the child afterwards
+	 */
+	vertex * refill_child (vertex * parent, size_t i)
+	{
+		size_t k = i > 0 ? i - 1 : i;
+		vertex * neighbour = own(parent->children[i > 0 ? k : k + 1]);
+		
+		if (neighbour->item_count >= a) {
+			if (i > 0) {
+				rotate_right(parent, k);
+			} else {
+				rotate_left(parent, k);
+			}
+			return parent->children[i];
+		}
+		
+		merge_children(parent, k);
+		vertex * left = parent->children[k];
+		if (parent->item_count == 0) {
+			// The reference of the old root passes to its only child
+			root = left;
+			destroy_vertex(parent);
+		}
+		return left;
+	}
+	
+	/**
+	 * Insert an item with a key that isn't present yet. Full vertices on the way to the leaf
+	 * are split before entering them, so the leaf always has room for the item.
+	 * @param key the key of the item
+	 * @param args the arguments passed to the constructor of the value
+	 * @return an iterator pointing to the new item
+	 */
+	template <typename K, typename... Args>
+	iterator emplace_new (K && key, Args &&... args)
+	{
+		vertex * cursor = own(root);
+		if (cursor->item_count == b - 1) {
+			vertex * new_root = create_vertex(false);
+			new_root->children[0] = cursor;
+			try {
+				split_child(new_root, 0);
+			} catch (...) {
+				destroy_vertex(new_root);
+				throw;
+			}
+			root = cursor = new_root;
+		}
+		
+		while (!cursor->leaf) {
+			size_t i = cursor->child_index(key);
+			if (own(cursor->children[i])->item_count == b - 1) {
+				split_child(cursor, i);
+				i = cursor->child_index(key);
+			}
+			cursor = cursor->children[i];
+		}
+		
+		size_t i = cursor->search(key);
+		for (size_t j = cursor->item_count; j > i; j--) {
+			cursor->move_item(j - 1, cursor, j);
+		}
+		cursor->construct_item(i, std::forward<K>(key), std::forward<Args>(args)...);
+		cursor->item_count++;
+		size_++;
+		return iterator(root, cursor, i);
+	}
+	
+	/**
+	 * Insert an item with given key, unless the key is already present. The tree is searched first
+	 * without copying anything, so if the key is present, no vertex shared with a snapshot gets copied.
+	 * The value is constructed in place, the arguments are left untouched if the key is present.
+	 * @param key the key of the item
+	 * @param args the arguments passed to the constructor of the value
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	template <typename K, typename... Args>
+	std::pair<iterator, bool> emplace_item (K && key, Args &&... args)
+	{
+		const_iterator found = this->find(key);
+		if (found != this->end()) {
+			return std::make_pair(found, false);
+		}
+		return std::make_pair(emplace_new(std::forward<K>(key), std::forward<Args>(args)...), true);
+	}
+	
+	/**
+	 * Insert an item, or replace the value of the item with the same key. If the key is present,
+	 * only the path to its leaf is copied, nothing is split on the way.
+	 * @return an iterator pointing to the item with given key and whether it has been inserted
+	 */
+	template <typename K, typename V>
+	std::pair<iterator, bool> assign_item (K && key, V && value)
+	{
+		if (this->find(key) == this->end()) {
+			return std::make_pair(emplace_new(std::forward<K>(key), std::forward<V>(value)), true);
+		}
+		
+		vertex * cursor = own(root);
+		while (!cursor->leaf) {
+			cursor = own(cursor->children[cursor->child_index(key)]);
+		}
+		size_t i = cursor->search(key);
+		cursor->values[i] = std::forward<V>(value);
+		return std::make_pair(iterator(root, cursor, i), false);
+	}
+	
+public:
+	/**
+	 * The basic constructor
+	 * @param a The minimum number of children for all non-root vertices (has to be at least 2)
+	 * @param b The maximum number of children for all vertices (has to be at least 2a)
+	 * @param alloc The allocator used for the vertices of the tree
+	 * @throws std::invalid_argument if a and b don't meet the conditions
+	 */
+	abtree_persistent (size_t a, size_t b, const Allocator & alloc = Allocator()): base(params(a, b), alloc)
+	{
+		if (b < 2 * a) {
+			throw std::invalid_argument("b");
+		}
+		root = create_vertex(true);
+	}
+	
+	/**
+	 * The constructor of a tree whose (a, b) parameters are given as template arguments
+	 * @param alloc The allocator used for the vertices of the tree
+	 */
+	explicit abtree_persistent (const Allocator & alloc = Allocator()): base(params(), alloc)
+	{
+		root = create_vertex(true);
+	}
+	
+	/**
+	 * The copy constructor. Both trees share all vertices until they're modified, so it takes O(1).
+	 */
+	abtree_persistent (const abtree_persistent & other): base(other)
+	{
+	}
+	
+	abtree_persistent & operator= (const abtree_persistent &) = delete;
+	
+	/**
+	 * Take a read-only snapshot of the current contents of the tree in O(1)
+	 */
+	snapshot_type snapshot () const
+	{
+		return snapshot_type(*this);
+	}
+	
+	/**
+	 * @name Inserts a new item into the tree. If there's already an item with the same key in the tree,
+	 * its value gets replaced by the value of the new item.
+	 * @param pair The item that gets copied (or moved) into the tree
+	 * @return An iterator pointing to the inserted item and whether a new item has been added
+	 */
+	//@{
+	std::pair<iterator, bool> insert (const value_type & pair)
+	{
+		return assign_item(pair.first, pair.second);
+	}
+	
+	std::pair<iterator, bool> insert (value_type && pair)
+	{
+		return assign_item(pair.first, std::move(pair.second));
+	}
+	//@}
+	
+	/**
+	 * @name If there's no item with given key in the tree, insert one whose value is constructed in place
+	 * from given arguments. Otherwise, nothing happens (the arguments aren't moved from).
+	 * @param key The key of the item
+	 * @param args The arguments passed to the constructor of mapped_type
+	 * @return An iterator pointing to the item with given key and whether it has been inserted
+	 */
+	//@{
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace (const key_type & key, Args &&... args)
+	{
+		return emplace_item(key, std::forward<Args>(args)...);
+	}
+	
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace (key_type && key, Args &&... args)
+	{
+		return emplace_item(std::move(key), std::forward<Args>(args)...);
+	}
+	//@}
+	
+	/**
+	 * @name Insert an item with given key and value, or assign the value to the item if the key is already present
+	 * @param key The key of the item
+	 * @param value The value of the item
+	 * @return An iterator pointing to the item with given key and whether it has been inserted
+	 */
+	//@{
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign (const key_type & key, M && value)
+	{
+		return assign_item(key, std::forward<M>(value));
+	}
+	
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign (key_type && key, M && value)
+	{
+		return assign_item(std::move(key), std::forward<M>(value));
+	}
+	//@}
+	
+	/**
+	 * Erase the item with given key from the tree. If such item isn't present in the tree, don't do anything
+	 * (the tree is searched first, so no vertex shared with a snapshot gets copied in that case).
+	 * Children with a - 1 keys on the way to the leaf are refilled before entering them,
+	 * so the leaf can always lose an item.
+	 * @param key The key of the item to be erased
+	 */
+	void erase (const key_type & key)
+	{
+		if (this->find(key) == this->end()) {
+			return;
+		}
+		
+		vertex * cursor = own(root);
+		while (!cursor->leaf) {
+			size_t i = cursor->child_index(key);
+			vertex * child = own(cursor->children[i]);
+			cursor = child->item_count == a - 1 ? refill_child(cursor, i) : child;
+		}
+		
+		size_t i = cursor->search(key);
+		cursor->keys[i].~TKey();
+		cursor->values[i].~TVal();
+		for (size_t j = i + 1; j < cursor->item_count; j++) {
+			cursor->move_item(j, cursor, j - 1);
+		}
+		cursor->item_count--;
+		size_--;
+	}
+	
+	/**
+	 * Remove all items from the tree. Snapshots keep their items.
+	 */
+	void clear ()
+	{
+		vertex * empty_root = create_vertex(true);
+		release(root);
+		root = empty_root;
+		size_ = 0;
+	}
+};
+
+#endif
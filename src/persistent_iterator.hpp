@@ -0,0 +1,177 @@
+#ifndef _ABTREE_PERSISTENT_ITERATOR_HPP_
+#define _ABTREE_PERSISTENT_ITERATOR_HPP_
+
+#include <iterator>
+#include "iterator.hpp"
+#include "persistent_vertex.hpp"
+
+/**
+ * A (read-only) iterator of a persistent (a, b)-tree. Vertices are shared between versions of the tree,
+ * so they can't point to their parents or neighbours. Instead, the iterator remembers the root of the version
+ * it belongs to and when it runs out of a leaf, it finds the neighbouring leaf by searching from the root
+ * for the last (or first) key of the leaf. That costs O(log n), but only once per leaf.
+ * The past-the-end iterator doesn't point into any leaf.
+ * @tparam TVertex The vertex type of the tree
+ */
+template <typename TVertex>
+class abtree_persistent_iterator: public std::iterator<
+	std::bidirectional_iterator_tag,
+	std::pair<const typename TVertex::key_type, typename TVertex::mapped_type>,
+	std::ptrdiff_t,
+	abtree_arrow_proxy<std::pair<const typename TVertex::key_type &, const typename TVertex::mapped_type &> >,
+	std::pair<const typename TVertex::key_type &, const typename TVertex::mapped_type &>
+> {
+public:
+	typedef TVertex vertex;
+	typedef typename TVertex::key_type key_type;
+	typedef typename TVertex::mapped_type mapped_type;
+	typedef std::pair<const key_type &, const mapped_type &> reference;
+	typedef abtree_arrow_proxy<reference> pointer;
+	
+	/**
+	 * Parameterless constructor (used only for variable declarations)
+	 */
+	abtree_persistent_iterator ()
+	{}
+	
+	/**
+	 * Move the iterator one item forward (prefix version)
+	 */
+	abtree_persistent_iterator & operator++ ()
+	{
+		position_++;
+		skip_end_of_leaf();
+		return *this;
+	}
+	
+	/**
+	 * Move the iterator one item forward (postfix version)
+	 */
+	abtree_persistent_iterator operator++ (int)
+	{
+		auto old = *this;
+		this->operator++();
+		return old;
+	}
+	
+	/**
+	 * Move the iterator one item backward (prefix version)
+	 */
+	abtree_persistent_iterator & operator-- ()
+	{
+		if (vertex_ == nullptr) {
+			vertex_ = root_;
+			while (!vertex_->leaf) {
+				vertex_ = vertex_->children[vertex_->item_count];
+			}
+			position_ = vertex_->item_count;
+		} else if (position_ == 0) {
+			const key_type & key = vertex_->keys[0];
+			vertex * cursor = root_;
+			vertex * prev = nullptr;
+			while (!cursor->leaf) {
+				size_t i = cursor->child_index(key);
+				if (i > 0) {
+					prev = cursor->children[i - 1];
+				}
+				cursor = cursor->children[i];
+			}
+			while (!prev->leaf) {
+				prev = prev->children[prev->item_count];
+			}
+			vertex_ = prev;
+			position_ = prev->item_count;
+		}
+		position_--;
+		return *this;
+	}
+	
+	/**
+	 * Move the iterator one item backward (postfix version)
+	 */
+	abtree_persistent_iterator operator-- (int)
+	{
+		auto old = *this;
+		this->operator--();
+		return old;
+	}
+	
+	reference operator* () const
+	{
+		return reference(vertex_->keys[position_], vertex_->values[position_]);
+	}
+	
+	pointer operator-> () const
+	{
+		return pointer{**this};
+	}
+	
+	/**
+	 * Two iterators are considered equal when they point to the same leaf and position
+	 */
+	bool operator== (const abtree_persistent_iterator & it)
+	{
+		return (
+			position_ == it.position_ &&
+			vertex_ == it.vertex_
+		);
+	}
+	
+	bool operator!= (const abtree_persistent_iterator & it)
+	{
+		return !operator==(it);
+	}
+private:
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_snapshot;
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_persistent;
+	
+	/**
+	 * Construct an iterator pointing to given position in given leaf
+	 * (Only the tree can construct an iterator this way)
+	 * @param root the root of the version of the tree the leaf belongs to
+	 * @param current_vertex the leaf the iterator should point to, nullptr for the past-the-end iterator
+	 * @param position the position of the item the iterator should point to. If it's equal to the item count
+	 * of the leaf, the iterator points to the first item of the next leaf instead.
+	 */
+	abtree_persistent_iterator (vertex * root, vertex * current_vertex, size_t position)
+		: root_(root), vertex_(current_vertex), position_(position)
+	{
+		skip_end_of_leaf();
+	}
+	
+	/**
+	 * If the iterator points behind the last item of its leaf, move it to the first item of the next leaf
+	 * (or past the end, if there's no next leaf)
+	 */
+	void skip_end_of_leaf ()
+	{
+		if (vertex_ == nullptr || position_ < vertex_->item_count) {
+			return;
+		}
+		vertex * next = nullptr;
+		if (vertex_->item_count > 0) {
+			const key_type & key = vertex_->keys[vertex_->item_count - 1];
+			vertex * cursor = root_;
+			while (!cursor->leaf) {
+				size_t i = cursor->child_index(key);
+				if (i < cursor->item_count) {
+					next = cursor->children[i + 1];
+				}
+				cursor = cursor->children[i];
+			}
+		}
+		while (next != nullptr && !next->leaf) {
+			next = next->children[0];
+		}
+		vertex_ = next;
+		position_ = 0;
+	}
+	
+	vertex * root_;
+	vertex * vertex_;
+	size_t position_;
+};
+
+#endif
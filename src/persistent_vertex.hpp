@@ -0,0 +1,111 @@
+#ifndef _ABTREE_PERSISTENT_VERTEX_HPP_
+#define _ABTREE_PERSISTENT_VERTEX_HPP_
+
+#include <new>
+#include <atomic>
+#include <utility>
+#include <cstddef>
+#include <memory>
+#include "search.hpp"
+#include "vertex.hpp"
+
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator>
+class abtree_snapshot;
+
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator>
+class abtree_persistent;
+
+/**
+ * A vertex of a persistent (a, b)-tree. The layout is the one of abtree_bplus_vertex (items live in the leaves,
+ * inner vertices only hold separators), but a vertex can be shared by several versions of the tree,
+ * so it has neither a parent pointer nor links to its neighbours. Instead, it counts the vertices
+ * (and tree handles, in case of a root) that point to it. A vertex with more than one reference is never modified.
+ * @tparam B The maximum number of children if it's known at compile time, 0 otherwise
+ */
+template <typename TKey, typename TVal, size_t B = 0>
+struct abtree_persistent_vertex: private abtree_block_layout<abtree_persistent_vertex<TKey, TVal, B>, TKey, TVal>
+{
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	
+	std::atomic<size_t> references;
+	size_t item_count;
+	bool leaf;
+	TKey * keys;
+	TVal * values; // Leaves only
+	abtree_persistent_vertex ** children; // Inner vertices only
+	
+	/**
+	 * The destructor. Destroys the keys (and values) that are still stored in the vertex,
+	 * the children are released by the tree.
+	 */
+	~abtree_persistent_vertex ()
+	{
+		for (size_t i = 0; i < item_count; i++) {
+			keys[i].~TKey();
+			if (leaf) {
+				values[i].~TVal();
+			}
+		}
+	}
+	
+	/**
+	 * Returns the index of the first key that is larger than or equal than given key
+	 * @param key the key to search for
+	 * @return the index of the desired key
+	 */
+	size_t search (const TKey & key) const
+	{
+		return abtree_search<B>(keys, item_count, key);
+	}
+	
+	/**
+	 * Returns the index of the child of an inner vertex whose subtree covers given key
+	 * (see abtree_bplus_vertex::child_index())
+	 */
+	size_t child_index (const TKey & key) const
+	{
+		size_t i = search(key);
+		return i < item_count && !(key < keys[i]) ? i + 1 : i;
+	}
+	
+private:
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_snapshot;
+	template <typename, typename, size_t, size_t, typename>
+	friend class abtree_persistent;
+	
+	typedef abtree_block_layout<abtree_persistent_vertex, TKey, TVal> layout;
+	friend layout;
+	using layout::cache_line_size;
+	using layout::align;
+	using layout::keys_offset;
+	using layout::values_offset;
+	using layout::children_offset;
+	
+	/**
+	 * Compute the size of the memory block of a vertex (see abtree_block_layout)
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf (which has values instead of children)
+	 */
+	static size_t block_size (size_t max_children, bool leaf)
+	{
+		size_t size = leaf ? layout::values_end(max_children) : layout::children_end(max_children, max_children);
+		return align(size, cache_line_size);
+	}
+	
+	/**
+	 * Set up the arrays inside the memory block. The new vertex has a single reference.
+	 * @param block the memory block the vertex is placed in
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf
+	 */
+	abtree_persistent_vertex (char * block, size_t max_children, bool leaf): references(1), item_count(0), leaf(leaf)
+	{
+		keys = reinterpret_cast<TKey *>(block + keys_offset());
+		values = leaf ? reinterpret_cast<TVal *>(block + values_offset(max_children)) : nullptr;
+		children = leaf ? nullptr : reinterpret_cast<abtree_persistent_vertex **>(block + children_offset(max_children));
+	}
+};
+
+#endif
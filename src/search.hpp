@@ -0,0 +1,444 @@
+#ifndef _ABTREE_SEARCH_HPP_
+#define _ABTREE_SEARCH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(ABTREE_NO_SIMD)
+#define ABTREE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * The instruction set extensions that can be used to search arithmetic keys
+ */
+enum abtree_simd_level
+{
+	ABTREE_SIMD_NONE,
+	ABTREE_SIMD_SSE2,
+	ABTREE_SIMD_AVX2
+};
+
+/**
+ * Find out which instruction set extensions the CPU we're running on supports
+ */
+inline abtree_simd_level abtree_detect_simd ()
+{
+#ifdef ABTREE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return ABTREE_SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return ABTREE_SIMD_SSE2;
+	}
+#endif
+	return ABTREE_SIMD_NONE;
+}
+
+/**
+ * The instruction set extensions available on this CPU. The detection only runs once,
+ * so a single binary uses the best available implementation on every host.
+ */
+inline abtree_simd_level abtree_simd_support ()
+{
+	static const abtree_simd_level level = abtree_detect_simd();
+	return level;
+}
+
+/**
+ * Classification of key types that have a vectorized implementation
+ */
+enum abtree_simd_kind
+{
+	ABTREE_KIND_NONE,
+	ABTREE_KIND_I32,
+	ABTREE_KIND_U32,
+	ABTREE_KIND_I64,
+	ABTREE_KIND_U64,
+	ABTREE_KIND_F32,
+	ABTREE_KIND_F64
+};
+
+template <typename T>
+struct abtree_simd_kind_of
+{
+	static const abtree_simd_kind value =
+		std::is_same<T, float>::value ? ABTREE_KIND_F32 :
+		std::is_same<T, double>::value ? ABTREE_KIND_F64 :
+		!std::is_integral<T>::value || std::is_same<T, bool>::value ? ABTREE_KIND_NONE :
+		sizeof(T) == 4 ? (std::is_signed<T>::value ? ABTREE_KIND_I32 : ABTREE_KIND_U32) :
+		sizeof(T) == 8 ? (std::is_signed<T>::value ? ABTREE_KIND_I64 : ABTREE_KIND_U64) :
+		ABTREE_KIND_NONE;
+};
+
+/**
+ * Vectorized kernels that count the keys smaller than given key.
+ * Every kernel processes whole vectors only and returns how many keys it has examined,
+ * the rest is left to the scalar loop of abtree_count_less().
+ * The comparison masks are summed without branching, because the window being scanned is short
+ * and stopping early would mostly cost a mispredicted branch.
+ * Key types without a vectorized implementation don't examine anything.
+ */
+template <typename T, abtree_simd_kind Kind = abtree_simd_kind_of<T>::value>
+struct abtree_simd_kernel
+{
+	static size_t sse2 (const T *, size_t, T, size_t &)
+	{
+		return 0;
+	}
+	
+	static size_t avx2 (const T *, size_t, T, size_t &)
+	{
+		return 0;
+	}
+};
+
+#ifdef ABTREE_SIMD_X86
+
+template <typename T>
+struct abtree_simd_kernel<T, ABTREE_KIND_I32>
+{
+	__attribute__((target("sse2")))
+	static size_t sse2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m128i k = _mm_set1_epi32(key);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, k)));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+	
+	__attribute__((target("avx2,popcnt")))
+	static size_t avx2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m256i k = _mm256_set1_epi32(key);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+			int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v)));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+};
+
+template <typename T>
+struct abtree_simd_kernel<T, ABTREE_KIND_U32>
+{
+	__attribute__((target("sse2")))
+	static size_t sse2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		// There's no unsigned comparison, flipping the sign bit maps the order to the signed one
+		__m128i bias = _mm_set1_epi32(INT32_MIN);
+		__m128i k = _mm_xor_si128(_mm_set1_epi32(key), bias);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i)), bias);
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, k)));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+	
+	__attribute__((target("avx2,popcnt")))
+	static size_t avx2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m256i bias = _mm256_set1_epi32(INT32_MIN);
+		__m256i k = _mm256_xor_si256(_mm256_set1_epi32(key), bias);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), bias);
+			int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v)));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+};
+
+/**
+ * SSE2 can't compare 64-bit integers, so they are only vectorized with AVX2
+ */
+template <typename T>
+struct abtree_simd_kernel<T, ABTREE_KIND_I64>
+{
+	static size_t sse2 (const T *, size_t, T, size_t &)
+	{
+		return 0;
+	}
+	
+	__attribute__((target("avx2,popcnt")))
+	static size_t avx2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m256i k = _mm256_set1_epi64x(key);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+			int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v)));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+};
+
+template <typename T>
+struct abtree_simd_kernel<T, ABTREE_KIND_U64>
+{
+	static size_t sse2 (const T *, size_t, T, size_t &)
+	{
+		return 0;
+	}
+	
+	__attribute__((target("avx2,popcnt")))
+	static size_t avx2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m256i bias = _mm256_set1_epi64x(INT64_MIN);
+		__m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), bias);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), bias);
+			int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v)));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+};
+
+template <typename T>
+struct abtree_simd_kernel<T, ABTREE_KIND_F32>
+{
+	__attribute__((target("sse2")))
+	static size_t sse2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m128 k = _mm_set1_ps(key);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			int mask = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), k));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+	
+	__attribute__((target("avx2,popcnt")))
+	static size_t avx2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m256 k = _mm256_set1_ps(key);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), k, _CMP_LT_OQ));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+};
+
+template <typename T>
+struct abtree_simd_kernel<T, ABTREE_KIND_F64>
+{
+	__attribute__((target("sse2")))
+	static size_t sse2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m128d k = _mm_set1_pd(key);
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2) {
+			int mask = _mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), k));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+	
+	__attribute__((target("avx2,popcnt")))
+	static size_t avx2 (const T * keys, size_t n, T key, size_t & count)
+	{
+		__m256d k = _mm256_set1_pd(key);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LT_OQ));
+			count += __builtin_popcount(mask);
+		}
+		return i;
+	}
+};
+
+#endif
+
+/**
+ * The number of keys examined by the linear part of a search.
+ * It covers a cache line, which is where a linear scan beats further halving.
+ */
+template <typename T>
+struct abtree_search_window
+{
+	static const size_t value = sizeof(T) >= 64 ? 1 : 64 / sizeof(T);
+};
+
+/**
+ * Count the keys in a sorted array that are smaller than given key.
+ * Vectorized kernels are used where available, the rest is counted by a branchless scalar loop.
+ * @param keys the sorted keys
+ * @param n the number of keys
+ * @param key the key to compare with
+ * @return the number of keys smaller than key
+ */
+template <typename T>
+size_t abtree_count_less (const T * keys, size_t n, T key)
+{
+	size_t count = 0;
+	size_t i = 0;
+	
+	switch (abtree_simd_support()) {
+		case ABTREE_SIMD_AVX2:
+			i = abtree_simd_kernel<T>::avx2(keys, n, key, count);
+			break;
+		case ABTREE_SIMD_SSE2:
+			i = abtree_simd_kernel<T>::sse2(keys, n, key, count);
+			break;
+		case ABTREE_SIMD_NONE:
+			break;
+	}
+	
+	for (; i < n; i++) {
+		count += keys[i] < key;
+	}
+	
+	return count;
+}
+
+/**
+ * Return the index of the first key in a sorted array that is larger than or equal to given key.
+ * A branchless binary search narrows the range down to abtree_search_window keys,
+ * which are then examined by abtree_count_less().
+ * @param keys the sorted keys
+ * @param n the number of keys
+ * @param key the key to search for
+ * @return the index of the desired key (n if all the keys are smaller)
+ */
+template <typename T>
+size_t abtree_search_arithmetic (const T * keys, size_t n, T key)
+{
+	const T * base = keys;
+	
+	while (n > abtree_search_window<T>::value) {
+		size_t half = n / 2;
+		base = base[half - 1] < key ? base + half : base;
+		n -= half;
+	}
+	
+	return (base - keys) + abtree_count_less(base, n, key);
+}
+
+/**
+ * A binary search for keys that are expensive to compare
+ * @param keys the sorted keys
+ * @param n the number of keys
+ * @param key the key to search for
+ * @return the index of the first key that is larger than or equal to given key
+ */
+template <typename T>
+size_t abtree_search_generic (const T * keys, size_t n, const T & key)
+{
+	size_t i, step;
+	size_t first = 0;
+	size_t count = n;
+	
+	while (count > 0) {
+		i = first + (step = count / 2);
+		if (keys[i] < key) {
+			first = i + 1;
+			count -= step + 1;
+		} else {
+			count = step;
+		}
+	}
+	
+	return first;
+}
+
+/**
+ * The largest power of two that is not larger than n
+ */
+constexpr size_t abtree_floor_pow2 (size_t n, size_t p = 1)
+{
+	return p * 2 > n ? p : abtree_floor_pow2(n, p * 2);
+}
+
+/**
+ * A binary search whose number of steps only depends on the maximum number of keys N,
+ * so that the compiler can unroll it completely.
+ * The result is built from powers of two, every step checks whether the key is larger than
+ * the last key of the next block.
+ * The unrolled search turned out to be faster than finishing the search with a vectorized scan.
+ * @param keys the sorted keys
+ * @param n the number of keys (at most N)
+ * @param key the key to search for
+ * @return the index of the first key that is larger than or equal to given key
+ */
+template <size_t N, typename T>
+size_t abtree_search_fixed (const T * keys, size_t n, T key)
+{
+	size_t first = 0;
+	for (size_t step = abtree_floor_pow2(N); step > 0; step /= 2) {
+		if (first + step <= n && keys[first + step - 1] < key) {
+			first += step;
+		}
+	}
+	return first;
+}
+
+/**
+ * @name Search strategies, selected by the key type and by whether the maximum number of keys is known
+ * at compile time
+ */
+//@{
+struct abtree_generic_search_tag {};
+struct abtree_arithmetic_search_tag {};
+struct abtree_fixed_search_tag {};
+
+template <typename T, size_t N>
+struct abtree_search_strategy
+{
+	typedef typename std::conditional<
+		!std::is_arithmetic<T>::value,
+		abtree_generic_search_tag,
+		typename std::conditional<N == 0, abtree_arithmetic_search_tag, abtree_fixed_search_tag>::type
+	>::type type;
+};
+
+template <size_t N, typename T>
+size_t abtree_search (const T * keys, size_t n, const T & key, abtree_generic_search_tag)
+{
+	return abtree_search_generic(keys, n, key);
+}
+
+template <size_t N, typename T>
+size_t abtree_search (const T * keys, size_t n, const T & key, abtree_arithmetic_search_tag)
+{
+	return abtree_search_arithmetic(keys, n, key);
+}
+
+template <size_t N, typename T>
+size_t abtree_search (const T * keys, size_t n, const T & key, abtree_fixed_search_tag)
+{
+	return abtree_search_fixed<N>(keys, n, key);
+}
+//@}
+
+/**
+ * Return the index of the first key in a sorted array of a vertex that is larger than or equal to given key,
+ * using the best strategy for the key type
+ * @tparam N the maximum number of keys if it's known at compile time, 0 otherwise
+ * @param keys the sorted keys
+ * @param n the number of keys
+ * @param key the key to search for
+ */
+template <size_t N, typename T>
+size_t abtree_search (const T * keys, size_t n, const T & key)
+{
+	return abtree_search<N>(keys, n, key, typename abtree_search_strategy<T, N>::type());
+}
+
+#endif
@@ -1,7 +1,22 @@
 #include <iostream>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include <algorithm>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <map>
+#include <fstream>
+#include <random>
 #include "abtree.hpp"
+#include "bplus.hpp"
+#include "concurrent.hpp"
+#include "persistent.hpp"
+#include "mapped.hpp"
+#include "durable.hpp"
+#include "buffered.hpp"
 
 void msg (std::string text)
 {
@@ -17,7 +32,8 @@ void report (bool value)
 	}
 }
 
-bool check_order (abtree<int, std::string>::iterator it, std::vector<int> & keys)
+template <typename TIterator>
+bool check_order (TIterator it, std::vector<int> & keys)
 {
 	for (int key: keys) {
 		if (key != it->first) {
@@ -28,6 +44,961 @@ bool check_order (abtree<int, std::string>::iterator it, std::vector<int> & keys
 	return true;
 }
 
+/**
+ * Fill a tree with arithmetic keys (including negative ones for signed types)
+ * and compare its lower bounds with std::lower_bound
+ */
+template <typename TTree>
+bool check_arithmetic_keys (TTree && tree)
+{
+	typedef typename std::decay<TTree>::type::key_type key_type;
+	std::vector<key_type> keys;
+	for (int i = 0; i < 2000; i++) {
+		key_type key = static_cast<key_type>((i * 7919) % 2000) - static_cast<key_type>(1000);
+		tree.insert(std::make_pair(key, i));
+		keys.push_back(key);
+	}
+	std::sort(keys.begin(), keys.end());
+	
+	for (size_t i = 0; i < keys.size(); i += 3) {
+		auto it = tree.lower_bound(keys[i]);
+		if (it == tree.end() || it->first != *std::lower_bound(keys.begin(), keys.end(), keys[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Bulk load trees of various sizes and fill factors, check their contents and modify them afterwards
+ */
+template <size_t A, size_t B>
+bool check_bulk_load (double fill)
+{
+	for (int n = 0; n < 500; n += 7) {
+		std::vector<std::pair<int, int> > items;
+		std::vector<int> keys;
+		for (int i = 0; i < n; i++) {
+			items.push_back(std::make_pair(2 * i, i));
+			keys.push_back(2 * i);
+		}
+		
+		abtree<int, int, A, B> tree(items.begin(), items.end(), fill);
+		if (tree.size() != keys.size() || !check_order(tree.begin(), keys)) {
+			return false;
+		}
+		
+		for (int i = 0; i < n; i += 2) {
+			tree.insert(std::make_pair(2 * i + 1, i));
+			tree.erase(2 * i);
+		}
+		for (int i = 0; i < n; i++) {
+			if ((tree.find(2 * i) != tree.end()) != (i % 2 == 1) || (tree.find(2 * i + 1) != tree.end()) != (i % 2 == 0)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Compare batched lookups with single ones, for batches in random order, sorted batches
+ * and batches of keys that aren't in the tree
+ */
+template <typename TTree>
+bool check_batch (TTree && tree)
+{
+	std::mt19937 random(1);
+	for (int n: {0, 1, 100, 5000}) {
+		tree.erase(tree.cbegin(), tree.cend());
+		for (int i = 0; i < n; i++) {
+			tree.insert(std::make_pair(int(random() % (4 * n)), i));
+		}
+		
+		std::vector<int> queries;
+		for (int i = 0; i < 3 * n + 40; i++) {
+			queries.push_back(int(random() % (4 * n + 20)) - 10);
+		}
+		for (int sorted = 0; sorted < 2; sorted++) {
+			if (sorted) {
+				std::sort(queries.begin(), queries.end());
+			}
+			std::vector<typename std::remove_reference<TTree>::type::iterator> found, bounds;
+			tree.find_batch(queries.begin(), queries.end(), std::back_inserter(found));
+			tree.lower_bound_batch(queries.begin(), queries.end(), std::back_inserter(bounds));
+			
+			const auto & const_tree = tree;
+			std::vector<typename std::remove_reference<TTree>::type::const_iterator> const_found(queries.size());
+			auto end = const_tree.find_batch(queries.begin(), queries.end(), const_found.begin());
+			
+			if (found.size() != queries.size() || bounds.size() != queries.size() || end != const_found.end()) {
+				return false;
+			}
+			for (size_t i = 0; i < queries.size(); i++) {
+				if (found[i] != tree.find(queries[i]) || bounds[i] != tree.lower_bound(queries[i]) || const_found[i] != const_tree.find(queries[i])) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Apply random sorted batches by insert_sorted() and erase_sorted(), with a few keys out of order
+ * and some keys repeated, and compare the tree with a std::map after every batch. The positions
+ * of the items and the sums of the values check the subtree sizes and the aggregates.
+ */
+template <typename TTree>
+bool check_sorted_batches (TTree && tree)
+{
+	std::mt19937 random(1);
+	std::map<int, int> expected;
+	for (int round = 0; round < 40; round++) {
+		std::vector<std::pair<int, int> > items;
+		for (int i = round % 4 == 0 ? 3000 : 300; i > 0; i--) {
+			items.push_back(std::make_pair(int(random() % 6000), round));
+		}
+		std::stable_sort(items.begin(), items.end(), [] (const std::pair<int, int> & x, const std::pair<int, int> & y) {
+			return x.first < y.first;
+		});
+		for (size_t i = 0; i < items.size(); i += 97) {
+			std::swap(items[i], items[items.size() - 1 - i]);
+		}
+		
+		if (round % 3 != 2) {
+			tree.insert_sorted(items.begin(), items.end());
+			for (auto & item: items) {
+				expected[item.first] = item.second;
+			}
+		} else {
+			std::vector<int> keys;
+			for (auto & item: items) {
+				keys.push_back(item.first);
+				expected.erase(item.first);
+			}
+			tree.erase_sorted(keys.begin(), keys.end());
+		}
+		
+		if (tree.size() != expected.size()) {
+			return false;
+		}
+		int sum = 0;
+		auto it = tree.begin();
+		size_t position = 0;
+		for (auto & item: expected) {
+			if (it->first != item.first || it->second != item.second || (position % 50 == 0 && tree.select(position) != it)) {
+				return false;
+			}
+			sum += item.second;
+			++it;
+			position++;
+		}
+		if (it != tree.end() || tree.reduce() != sum) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Build trees of various sizes in parallel, from sorted items and from shuffled items with duplicate keys,
+ * and compare them with the trees built by assign(). Then walk ranges of them with parallel_for_each().
+ */
+template <typename TTree>
+bool check_parallel (TTree && tree, TTree && serial, double fill)
+{
+	for (int n: {0, 1, 10, 500, 20000}) {
+		std::vector<std::pair<int, int> > items;
+		for (int i = 0; i < n; i++) {
+			items.push_back(std::make_pair(2 * i, i));
+		}
+		std::vector<std::pair<int, int> > shuffled(items);
+		for (int i = 0; i < n; i += 3) {
+			shuffled.push_back(std::make_pair(2 * i, -i));
+		}
+		std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(n));
+		
+		for (size_t threads: {1, 2, 3, 8}) {
+			for (auto * input: {&items, &shuffled}) {
+				tree.assign_parallel(input->begin(), input->end(), threads, fill);
+				serial.assign(input->begin(), input->end(), fill);
+				if (tree.size() != serial.size() || !std::equal(tree.begin(), tree.end(), serial.begin())) {
+					return false;
+				}
+				for (int i = 0; i < n; i += 97) {
+					if (tree.rank(2 * i) != size_t(i) || tree.select(i)->first != 2 * i) {
+						return false;
+					}
+				}
+			}
+			
+			int lo = n / 3;
+			int hi = 3 * n / 2;
+			std::atomic<long> sum(0);
+			tree.parallel_for_each(lo, hi, [&sum] (const int & key, int & value) {
+				sum += key;
+				value = key;
+			}, threads);
+			long expected = 0;
+			for (auto it = serial.lower_bound(lo); it != serial.lower_bound(hi); ++it) {
+				expected += it->first;
+			}
+			if (sum != expected) {
+				return false;
+			}
+			for (auto it = tree.begin(); it != tree.end(); ++it) {
+				bool changed = it->first >= lo && it->first < hi;
+				if ((it->second == it->first) != changed && it->first != 0) {
+					return false;
+				}
+			}
+			
+			for (int i = 0; i < n; i += 2) {
+				tree.erase(2 * i);
+				tree.insert(std::make_pair(2 * i + 1, i));
+			}
+			if (tree.size() != size_t(n)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Run the basic checks on a tree: insertion, traversal in both directions, search and erasure
+ */
+template <typename TTree>
+bool check_tree (TTree && tree, const std::vector<int> & key_data)
+{
+	std::vector<int> keys = key_data;
+	for (int key: keys) {
+		auto result = tree.insert(std::make_pair(key, key));
+		if (!result.second || result.first->first != key) {
+			return false;
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	if (!check_order(tree.begin(), keys)) {
+		return false;
+	}
+	
+	auto it = tree.end();
+	for (size_t i = keys.size(); i > 0; i--) {
+		if ((--it)->first != keys[i - 1]) {
+			return false;
+		}
+	}
+	
+	for (int key: keys) {
+		if (tree.find(key)->second != key || tree.lower_bound(key - 1)->first != key || tree.find(key + 1) != tree.end()) {
+			return false;
+		}
+	}
+	
+	for (size_t i = 0; i < key_data.size(); i++) {
+		tree.erase(key_data[i]);
+		keys.erase(std::find(keys.begin(), keys.end(), key_data[i]));
+		if (tree.find(key_data[i]) != tree.end() || !check_order(tree.begin(), keys)) {
+			return false;
+		}
+	}
+	return tree.size() == 0 && tree.begin() == tree.end();
+}
+
+/**
+ * Insert keys into a tree one by one, with values equal to the keys, or erase them,
+ * keeping a sorted copy of the keys that are in the tree
+ * @param keys the sorted copy of the keys
+ * @param erase whether the keys are erased instead of inserted
+ * @param step only every step-th key is used
+ * @param visit called with the index of the key after every operation, it returns false to stop
+ * @return false if visit() stopped the operations
+ */
+template <typename TTree, typename F>
+bool modify_keys (TTree && tree, std::vector<int> & keys, const std::vector<int> & key_data, bool erase, size_t step, F visit)
+{
+	for (size_t i = 0; i < key_data.size(); i += step) {
+		int key = key_data[i];
+		if (erase) {
+			tree.erase(key);
+			keys.erase(std::lower_bound(keys.begin(), keys.end(), key));
+		} else {
+			tree.insert(std::make_pair(key, key));
+			keys.insert(std::lower_bound(keys.begin(), keys.end(), key), key);
+		}
+		if (!visit(i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Check rank(), select(), count_range() and distance() against a sorted copy of the keys
+ * while the tree is being filled and emptied
+ */
+template <typename TTree>
+bool check_order_statistics (TTree && tree, const std::vector<int> & key_data)
+{
+	std::vector<int> keys;
+	auto check = [&tree, &keys] () {
+		for (size_t i = 0; i < keys.size(); i++) {
+			auto it = tree.select(i);
+			if (it->first != keys[i] || tree.rank(keys[i]) != i || tree.rank(keys[i] + 1) != i + 1 || tree.rank(it) != i) {
+				return false;
+			}
+		}
+		size_t quarter = keys.size() / 4;
+		return (
+			tree.select(keys.size()) == tree.end() &&
+			tree.distance(tree.begin(), tree.end()) == std::ptrdiff_t(keys.size()) &&
+			(keys.empty() || tree.count_range(keys[quarter], keys[3 * quarter]) == 2 * quarter)
+		);
+	};
+	
+	auto sometimes = [&check] (size_t i) {
+		return i % 200 != 0 || check();
+	};
+	
+	return (
+		modify_keys(tree, keys, key_data, false, 1, sometimes) &&
+		modify_keys(tree, keys, key_data, true, 1, sometimes) &&
+		check()
+	);
+}
+
+/**
+ * Fill a tree whose values are equal to their keys and check reduce() on a few ranges against
+ * a brute-force fold over the items, then negate some values by update() and empty the tree,
+ * checking it again after each step
+ * @tparam TAggregate The aggregate of the tree
+ */
+template <typename TAggregate, typename TTree>
+bool check_aggregates (TTree && tree, const std::vector<int> & key_data)
+{
+	std::vector<int> keys;
+	auto check = [&tree, &keys] () {
+		for (size_t i = 0; i < 20; i++) {
+			int lo = keys.empty() ? 0 : keys[i * 7 % keys.size()] - int(i % 2);
+			int hi = lo + int(i * 131);
+			typename TAggregate::value_type expected = TAggregate::identity();
+			for (auto it = tree.lower_bound(lo); it != tree.end() && it->first < hi; ++it) {
+				expected = TAggregate::combine(expected, TAggregate::from_item(it->first, it->second));
+			}
+			if (tree.reduce(lo, hi) != expected) {
+				return false;
+			}
+		}
+		return true;
+	};
+	
+	auto sometimes = [&check] (size_t i) {
+		return i % 200 != 0 || check();
+	};
+	
+	if (!modify_keys(tree, keys, key_data, false, 1, sometimes)) {
+		return false;
+	}
+	for (int key: keys) {
+		if (key % 3 == 0) {
+			tree.update(tree.find(key), [] (int & value) {
+				value = -value;
+			});
+		}
+	}
+	if (!check()) {
+		return false;
+	}
+	return modify_keys(tree, keys, key_data, true, 2, sometimes) && check();
+}
+
+/**
+ * Split a filled tree at a few keys and join the parts back, then erase a few ranges (by keys and by iterators)
+ * and compare the contents of the trees with the sorted keys every time
+ */
+template <typename TTree>
+bool check_split_join (TTree && tree, const std::vector<int> & key_data)
+{
+	std::vector<int> keys(key_data);
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	for (int key: key_data) {
+		tree.insert(std::make_pair(key, key));
+	}
+	
+	for (size_t i = 0; i <= 10; i++) {
+		size_t middle = keys.size() * i / 10;
+		int key = middle < keys.size() ? keys[middle] : keys.back() + 1;
+		auto upper = tree.split(key);
+		std::vector<int> lower_keys(keys.begin(), keys.begin() + middle);
+		std::vector<int> upper_keys(keys.begin() + middle, keys.end());
+		if (
+			tree.size() != middle || upper.size() != keys.size() - middle ||
+			!check_order(tree.begin(), lower_keys) || !check_order(upper.begin(), upper_keys)
+		) {
+			return false;
+		}
+		tree.join(upper);
+		if (tree.size() != keys.size() || !upper.empty() || !check_order(tree.begin(), keys)) {
+			return false;
+		}
+	}
+	
+	for (size_t i = 0; i < 10 && keys.size() > 100; i++) {
+		size_t first = (i * 7919) % (keys.size() - 100);
+		size_t last = first + (i * 131) % 100;
+		if (i % 2 == 0) {
+			tree.erase_range(keys[first], keys[last]);
+		} else {
+			auto next = tree.erase(tree.select(first), tree.select(last));
+			if (next != tree.select(first)) {
+				return false;
+			}
+		}
+		keys.erase(keys.begin() + first, keys.begin() + last);
+		if (tree.size() != keys.size() || !check_order(tree.begin(), keys)) {
+			return false;
+		}
+	}
+	tree.erase(tree.cbegin(), tree.cend());
+	return tree.empty() && tree.begin() == tree.end();
+}
+
+/**
+ * Fill two overlapping trees and compare their union, intersection and difference with the results
+ * of the standard set algorithms on the keys. The values of the first tree are positive, so it's possible
+ * to tell which tree an item comes from. The parallel variants are checked the same way, along with
+ * the ranks of the keys, which show whether the joined parts have the right subtree sizes.
+ */
+template <typename TTree>
+bool check_set_operations (TTree && x, TTree && y, TTree && result, const std::vector<int> & key_data)
+{
+	std::vector<int> x_keys, y_keys, keys;
+	for (size_t i = 0; i < key_data.size(); i++) {
+		if (i % 2 == 0) {
+			x.insert(std::make_pair(key_data[i], key_data[i] + 1));
+		}
+		if (i % 3 == 0) {
+			y.insert(std::make_pair(key_data[i], -key_data[i]));
+		}
+	}
+	for (auto it = x.begin(); it != x.end(); ++it) {
+		x_keys.push_back(it->first);
+	}
+	for (auto it = y.begin(); it != y.end(); ++it) {
+		y_keys.push_back(it->first);
+	}
+	auto check = [&result, &x, &keys] () {
+		for (auto it = result.begin(); it != result.end(); ++it) {
+			if (x.find(it->first) != x.end() && it->second <= 0) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (result.rank(keys[i]) != i) {
+				return false;
+			}
+		}
+		return result.size() == keys.size() && check_order(result.begin(), keys);
+	};
+	
+	std::set_union(x_keys.begin(), x_keys.end(), y_keys.begin(), y_keys.end(), std::back_inserter(keys));
+	result.assign_union(x, y);
+	if (!check()) {
+		return false;
+	}
+	for (size_t threads: {2, 3, 8}) {
+		result.assign_union_parallel(x, y, threads);
+		if (!check()) {
+			return false;
+		}
+	}
+	
+	keys.clear();
+	std::set_intersection(x_keys.begin(), x_keys.end(), y_keys.begin(), y_keys.end(), std::back_inserter(keys));
+	result.assign_intersection(x, y, 0.5);
+	if (!check()) {
+		return false;
+	}
+	for (size_t threads: {2, 3, 8}) {
+		result.assign_intersection_parallel(x, y, threads, 0.5);
+		if (!check()) {
+			return false;
+		}
+	}
+	
+	keys.clear();
+	std::set_difference(x_keys.begin(), x_keys.end(), y_keys.begin(), y_keys.end(), std::back_inserter(keys));
+	result.assign_difference(x, y);
+	if (!check()) {
+		return false;
+	}
+	for (size_t threads: {2, 3, 8}) {
+		result.assign_difference_parallel(x, y, threads);
+		if (!check()) {
+			return false;
+		}
+	}
+	
+	// The result may be one of the operands
+	keys.clear();
+	std::set_difference(y_keys.begin(), y_keys.end(), x_keys.begin(), x_keys.end(), std::back_inserter(keys));
+	result.assign_union(y, y);
+	result.assign_difference_parallel(result, x, 3);
+	if (result.size() != keys.size() || !check_order(result.begin(), keys)) {
+		return false;
+	}
+	y.assign_difference(y, x);
+	return y.size() == keys.size() && check_order(y.begin(), keys);
+}
+
+/**
+ * Write a tree to a file, map it and compare the mapped tree with the original one:
+ * traversal in both directions, searches for present and missing keys and bounds
+ * @param block_size the block size of the file
+ */
+template <typename TTree>
+bool check_mapped (TTree && tree, const std::vector<int> & key_data, size_t block_size)
+{
+	const char * path = "abtree_test.map";
+	for (int key: key_data) {
+		tree.insert(std::make_pair(key, -key));
+	}
+	abtree_write_mapped(path, tree, block_size);
+	abtree_mapped<int, int> mapped(path);
+	std::remove(path);
+	
+	bool status = mapped.size() == tree.size() && mapped.empty() == tree.empty();
+	auto it = tree.begin();
+	for (auto mit = mapped.begin(); mit != mapped.end(); ++mit, ++it) {
+		status = status && it != tree.end() && mit->first == it->first && mit->second == it->second;
+	}
+	status = status && it == tree.end();
+	for (auto mit = mapped.end(); mit != mapped.begin();) {
+		--mit;
+		--it;
+		status = status && mit->first == it->first;
+	}
+	for (int key: key_data) {
+		status = status && mapped.find(key) != mapped.end() && mapped.at(key) == -key && mapped.find(key + 1) == mapped.end();
+		auto bound = tree.lower_bound(key + 1);
+		auto mapped_bound = mapped.lower_bound(key + 1);
+		status = status && (bound == tree.end() ? mapped_bound == mapped.end() : mapped_bound->first == bound->first);
+		status = status && mapped.upper_bound(key) == mapped_bound;
+	}
+	return status;
+}
+
+/**
+ * Make changes to a durable tree, which writes a few checkpoints along the way, then reopen it
+ * and compare it with a map. Then damage the end of its log as if a crash tore the last record,
+ * make another change and reopen it again.
+ */
+bool check_durable (size_t a, size_t b, const std::vector<int> & key_data)
+{
+	const std::string path = "abtree_test";
+	abtree_durable_options options;
+	options.checkpoint_size = 16 * 1024;
+	std::map<int, int> expected;
+	auto same = [&expected] (const abtree_durable<int, int> & tree) {
+		auto it = tree.begin();
+		for (auto & item: expected) {
+			if (it == tree.end() || it->first != item.first || it->second != item.second) {
+				return false;
+			}
+			++it;
+		}
+		return it == tree.end() && tree.size() == expected.size();
+	};
+	
+	bool status = true;
+	{
+		abtree_durable<int, int> tree(path, a, b, options);
+		for (size_t i = 0; i < key_data.size(); i++) {
+			if (i % 3 == 2) {
+				tree.erase(key_data[i - 1]);
+				expected.erase(key_data[i - 1]);
+			} else {
+				tree.insert_or_assign(key_data[i], int(i));
+				expected[key_data[i]] = int(i);
+			}
+			if (i == key_data.size() / 2) {
+				tree.checkpoint();
+			}
+		}
+		status = status && same(tree);
+	}
+	{
+		abtree_durable<int, int> tree(path, a, b, options);
+		status = status && same(tree);
+	}
+	
+	std::ofstream(path + ".log", std::ios::binary | std::ios::app) << "torn";
+	{
+		abtree_durable<int, int> tree(path, a, b, options);
+		status = status && same(tree);
+		tree.insert(std::make_pair(-1, -1));
+		expected[-1] = -1;
+		
+		// Inserting a key that is already present replaces its value, like abtree::insert() does
+		int present = expected.rbegin()->first;
+		status = status && !tree.insert(std::make_pair(present, -3)).second && tree.find(present)->second == -3;
+		expected[present] = -3;
+	}
+	{
+		abtree_durable<int, int> tree(path, a, b, options);
+		status = status && same(tree);
+	}
+	
+	// A complete record whose checksum doesn't match is cut off like a torn one
+	char record[16] = {0};
+	int bad[3] = {1, -2, -2};
+	std::memcpy(record + 4, bad, sizeof(bad));
+	std::ofstream(path + ".log", std::ios::binary | std::ios::app).write(record, sizeof(record));
+	{
+		abtree_durable<int, int> tree(path, a, b, options);
+		status = status && same(tree) && tree.find(-2) == tree.end();
+	}
+	std::remove((path + ".log").c_str());
+	std::remove((path + ".checkpoint").c_str());
+	
+	// The changes that trigger checkpoints have to make it into them
+	abtree_durable_options small_checkpoints;
+	small_checkpoints.commit_interval = std::chrono::milliseconds(0);
+	small_checkpoints.checkpoint_size = 200;
+	expected.clear();
+	{
+		abtree_durable<int, int> tree(path, a, b, small_checkpoints);
+		for (int i = 0; i < 100; i++) {
+			tree.insert_or_assign(i, -i);
+			expected[i] = -i;
+		}
+	}
+	{
+		abtree_durable<int, int> tree(path, a, b, small_checkpoints);
+		status = status && same(tree);
+	}
+	
+	// An idle tree commits its changes once the commit interval passes. The files are copied
+	// while the tree is still open, as if the process crashed then.
+	abtree_durable_options short_interval;
+	short_interval.commit_interval = std::chrono::milliseconds(20);
+	const std::string crashed = path + "_crashed";
+	{
+		abtree_durable<int, int> tree(path, a, b, short_interval);
+		tree.insert_or_assign(1000, 1);
+		tree.insert_or_assign(1001, 2);
+		expected[1000] = 1;
+		expected[1001] = 2;
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		for (const char * suffix: {".log", ".checkpoint"}) {
+			std::ifstream in(path + suffix, std::ios::binary);
+			if (in) {
+				std::ofstream(crashed + suffix, std::ios::binary) << in.rdbuf();
+			}
+		}
+	}
+	{
+		abtree_durable<int, int> tree(crashed, a, b, short_interval);
+		status = status && same(tree);
+	}
+	
+	for (const std::string & prefix: {path, crashed}) {
+		std::remove((prefix + ".log").c_str());
+		std::remove((prefix + ".checkpoint").c_str());
+	}
+	return status;
+}
+
+/**
+ * Insert, assign, emplace and erase keys in a buffered tree and compare its lookups, lower bounds
+ * and traversals with a std::map while most of the changes are still waiting in the buffers
+ */
+template <typename TTree>
+bool check_buffered (TTree && tree, const std::vector<int> & key_data)
+{
+	std::map<int, int> expected;
+	auto same = [&tree, &expected] () {
+		std::vector<std::pair<int, int> > items;
+		tree.for_each([&items] (int key, int value) {
+			items.push_back(std::make_pair(key, value));
+		});
+		return items == std::vector<std::pair<int, int> >(expected.begin(), expected.end());
+	};
+	
+	bool status = true;
+	for (size_t i = 0; i < 2 * key_data.size(); i++) {
+		int key = key_data[i % key_data.size()];
+		int value = int(i);
+		switch (i % 5) {
+		case 0:
+		case 1:
+			tree.insert(std::make_pair(key, value));
+			expected[key] = value;
+			break;
+		case 2:
+			tree.try_emplace(key, value);
+			expected.emplace(key, value);
+			break;
+		case 3:
+			tree.insert_or_assign(key + 1, value);
+			expected[key + 1] = value;
+			break;
+		default:
+			tree.erase(key_data[(i * 7) % key_data.size()]);
+			expected.erase(key_data[(i * 7) % key_data.size()]);
+		}
+		
+		if (i % 13 == 0) {
+			int found_key = 0;
+			auto lower = expected.lower_bound(key - 1);
+			status = status && (tree.find(key, value) == (expected.count(key) > 0));
+			status = status && (expected.count(key) == 0 || value == expected[key]);
+			status = status && (tree.lower_bound(key - 1, found_key, value) == (lower != expected.end()));
+			status = status && (lower == expected.end() || (found_key == lower->first && value == lower->second));
+		}
+		if (i % 499 == 0) {
+			status = status && same();
+		}
+	}
+	
+	status = status && same() && tree.size() == expected.size() && same();
+	for (auto & item: expected) {
+		tree.erase(item.first);
+	}
+	return status && tree.empty() && tree.size() == 0;
+}
+
+/**
+ * The number of blocks handed out by all counting_allocator instances
+ */
+size_t allocated_blocks = 0;
+
+/**
+ * The default allocator of the trees, which counts the blocks it hands out, so that a test can tell
+ * whether a tree has allocated (or copied) any vertices
+ */
+template <typename T>
+struct counting_allocator: abtree_aligned_allocator<T>
+{
+	counting_allocator ()
+	{}
+	
+	template <typename U>
+	counting_allocator (const counting_allocator<U> &)
+	{}
+	
+	T * allocate (size_t n)
+	{
+		allocated_blocks++;
+		return abtree_aligned_allocator<T>::allocate(n);
+	}
+};
+
+/**
+ * Check that the operations that leave a persistent tree as it is (erasing a missing key, try_emplace()
+ * with a present key) don't copy any vertex it shares with a snapshot, while replacing a value does
+ * @param tree a tree with counting_allocator
+ */
+template <typename TTree>
+bool check_snapshot_copies (TTree && tree, const std::vector<int> & key_data)
+{
+	for (int key: key_data) {
+		tree.insert(std::make_pair(key, key));
+	}
+	auto snapshot = tree.snapshot();
+	int present = key_data[0];
+	int missing = -1;
+	
+	size_t allocated = allocated_blocks;
+	tree.erase(missing);
+	if (tree.try_emplace(present, 0).second || allocated_blocks != allocated) {
+		return false;
+	}
+	tree.insert_or_assign(present, -present);
+	return (
+		allocated_blocks > allocated &&
+		tree.find(present)->second == -present &&
+		snapshot.find(present)->second == present
+	);
+}
+
+/**
+ * Take a snapshot after every few modifications of a persistent tree and check
+ * that none of the snapshots changes while the tree keeps changing
+ */
+template <typename TTree>
+bool check_snapshots (TTree && tree, const std::vector<int> & key_data)
+{
+	std::vector<typename std::decay<TTree>::type::snapshot_type> snapshots;
+	std::vector<std::vector<int> > contents;
+	std::vector<int> keys;
+	auto take_snapshot = [&tree, &snapshots, &contents, &keys] (size_t i) {
+		if (i % 97 == 0) {
+			snapshots.push_back(tree.snapshot());
+			contents.push_back(keys);
+		}
+		return true;
+	};
+	modify_keys(tree, keys, key_data, false, 1, take_snapshot);
+	modify_keys(tree, keys, key_data, true, 1, take_snapshot);
+	
+	for (size_t i = 0; i < snapshots.size(); i++) {
+		if (snapshots[i].size() != contents[i].size() || !check_order(snapshots[i].begin(), contents[i])) {
+			return false;
+		}
+	}
+	return tree.empty() && tree.begin() == tree.end();
+}
+
+/**
+ * Hammer a concurrent tree from several threads. Every writer owns its own keys, so it knows what
+ * its operations should return; the readers keep looking for keys that are never removed.
+ */
+template <typename TTree>
+bool check_concurrent (TTree && tree, int writers, int readers)
+{
+	const int stable = 2000;
+	for (int i = 1; i <= stable; i++) {
+		tree.insert(std::make_pair(-i, i));
+	}
+	
+	std::atomic<bool> status(true);
+	std::atomic<int> running(writers);
+	std::vector<std::thread> threads;
+	for (int w = 0; w < writers; w++) {
+		threads.emplace_back([&tree, &status, &running, w, writers] () {
+			std::set<int> owned;
+			unsigned int seed = w + 1;
+			for (int i = 0; i < 30000; i++) {
+				seed = seed * 1103515245 + 12345;
+				int key = (seed >> 8) % 5000 * writers + w;
+				int value = 0;
+				bool present = owned.count(key) > 0;
+				switch ((seed >> 4) % 3) {
+				case 0:
+					if (tree.insert(std::make_pair(key, 3 * key)) == present) {
+						status = false;
+					}
+					owned.insert(key);
+					break;
+				case 1:
+					if (tree.erase(key) != present) {
+						status = false;
+					}
+					owned.erase(key);
+					break;
+				default:
+					if (tree.find(key, value) != present || (present && value != 3 * key)) {
+						status = false;
+					}
+				}
+			}
+			for (int key: owned) {
+				if (!tree.contains(key)) {
+					status = false;
+				}
+			}
+			running--;
+		});
+	}
+	for (int r = 0; r < readers; r++) {
+		threads.emplace_back([&tree, &status, &running, stable] () {
+			int value = 0;
+			while (running > 0) {
+				for (int i = 1; i <= stable; i += 7) {
+					if (!tree.find(-i, value) || value != i) {
+						status = false;
+					}
+				}
+			}
+		});
+	}
+	for (auto & thread: threads) {
+		thread.join();
+	}
+	
+	for (int i = 1; i <= stable; i++) {
+		if (!tree.erase(-i)) {
+			return false;
+		}
+	}
+	return status;
+}
+
+/**
+ * Let several writers fight over the same keys while readers check that every key they find carries
+ * the value all writers store with it. Writers can't predict their results, but the inserts and erases
+ * that succeeded have to add up to the final contents of the tree.
+ */
+template <typename TTree>
+bool check_concurrent_overlapping (TTree && tree, int writers, int readers)
+{
+	const int range = 3000;
+	const int stable = 500;
+	for (int i = 1; i <= stable; i++) {
+		tree.insert(std::make_pair(-i, i));
+	}
+	
+	std::atomic<bool> status(true);
+	std::atomic<long> net(0);
+	std::atomic<int> running(writers);
+	std::vector<std::thread> threads;
+	for (int w = 0; w < writers; w++) {
+		threads.emplace_back([&tree, &net, &running, w] () {
+			long changes = 0;
+			unsigned int seed = w + 1;
+			for (int i = 0; i < 30000; i++) {
+				seed = seed * 1103515245 + 12345;
+				int key = (seed >> 8) % range;
+				if ((seed >> 4) % 2 == 0) {
+					changes += tree.insert(std::make_pair(key, 3 * key));
+				} else {
+					changes -= tree.erase(key);
+				}
+			}
+			net += changes;
+			running--;
+		});
+	}
+	for (int r = 0; r < readers; r++) {
+		threads.emplace_back([&tree, &status, &running, r, range, stable] () {
+			int value = 0;
+			while (running > 0) {
+				for (int key = r; key < range; key += 3) {
+					if (tree.find(key, value) && value != 3 * key) {
+						status = false;
+					}
+				}
+				for (int i = 1; i <= stable; i += 7) {
+					if (!tree.find(-i, value) || value != i) {
+						status = false;
+					}
+				}
+				if (tree.contains(range) || tree.contains(-stable - 1)) {
+					status = false;
+				}
+			}
+		});
+	}
+	for (auto & thread: threads) {
+		thread.join();
+	}
+	
+	long found = 0;
+	for (int key = 0; key < range; key++) {
+		found += tree.erase(key);
+	}
+	for (int i = 1; i <= stable; i++) {
+		if (!tree.erase(-i)) {
+			return false;
+		}
+	}
+	return status && found == net && tree.empty();
+}
+
 int main (int argc, char ** argv)
 {
 	abtree<int, std::string> tree(2, 3);
@@ -46,8 +1017,8 @@ int main (int argc, char ** argv)
 	msg("Checking insert & traversal order");
 	status = true;
 	for (int key: keys) {
-		auto it = tree.insert(std::make_pair(key, std::string("foo")));
-		status = status && it->first == key;
+		auto result = tree.insert(std::make_pair(key, std::string("foo")));
+		status = status && result.first->first == key && result.second;
 	}
 	
 	std::sort(begin(keys), end(keys));
@@ -77,9 +1048,23 @@ int main (int argc, char ** argv)
 	
 	msg("Trying to insert something that's already in the tree");
 	int key = key_data[sizeof(key_data) / (2 * sizeof(int))];
-	tree.insert(std::make_pair(key, std::string("bar")));
+	auto result = tree.insert(std::make_pair(key, std::string("bar")));
 	it = tree.find(key);
-	report(it->second == std::string("bar"));
+	report(it->second == std::string("bar") && result.first == it && !result.second);
+	
+	msg("Checking emplace, try_emplace, insert_or_assign and operator[]");
+	std::string moved_value("baz");
+	result = tree.try_emplace(key, std::move(moved_value));
+	status = !result.second && result.first->second == "bar" && moved_value == "baz";
+	result = tree.insert_or_assign(key, std::string("baz"));
+	status = status && !result.second && result.first->second == "baz";
+	result = tree.emplace(666, "devil");
+	status = status && result.second && result.first->first == 666;
+	tree[666] += "!";
+	status = status && tree.at(666) == "devil!";
+	tree.erase(666);
+	tree[key] = "bar";
+	report(status && tree.find(666) == tree.end() && tree.size() == keys.size());
 	
 	msg("Trying to find a bogus key");
 	it = tree.find(666);
@@ -149,5 +1134,234 @@ int main (int argc, char ** argv)
 	}
 	report(tree.size() == 0);
 	
+	msg("Checking a tree with compile-time parameters");
+	abtree<int, std::string, 2, 3> static_tree;
+	keys.assign(key_data, key_data + sizeof(key_data) / sizeof(int));
+	status = true;
+	for (int key: keys) {
+		auto result = static_tree.insert(std::make_pair(key, std::string("foo")));
+		status = status && result.first->first == key && result.second;
+	}
+	std::sort(begin(keys), end(keys));
+	status = status && check_order(static_tree.begin(), keys);
+	for (int key: key_data) {
+		status = status && static_tree.find(key)->first == key;
+		static_tree.erase(key);
+		status = status && static_tree.find(key) == static_tree.end();
+	}
+	report(status && static_tree.size() == 0);
+	
+	msg("Checking lower bound on arithmetic keys");
+	report(
+		check_arithmetic_keys(abtree<double, int>(8, 20)) &&
+		check_arithmetic_keys(abtree<unsigned, int, 16, 40>()) &&
+		check_arithmetic_keys(abtree<long long, int>(64, 127)) &&
+		check_arithmetic_keys(abtree<float, int, 64, 127>())
+	);
+	
+	msg("Checking a tree with a pool allocator");
+	abtree_pool_allocator<std::pair<const int, std::string> > pool;
+	abtree<int, std::string, 0, 0, abtree_pool_allocator<std::pair<const int, std::string> > > pool_tree(2, 3, pool);
+	keys.assign(key_data, key_data + sizeof(key_data) / sizeof(int));
+	status = pool_tree.get_allocator() == pool;
+	for (int round = 0; round < 2; round++) {
+		for (int key: keys) {
+			pool_tree.insert(std::make_pair(key, std::string("foo")));
+		}
+		std::vector<int> sorted = keys;
+		std::sort(begin(sorted), end(sorted));
+		status = status && check_order(pool_tree.begin(), sorted);
+		for (int key: key_data) {
+			pool_tree.erase(key);
+			status = status && pool_tree.find(key) == pool_tree.end();
+		}
+	}
+	auto * empty = pool.allocate(0);
+	status = status && empty != nullptr;
+	pool.deallocate(empty, 0);
+	report(status && pool_tree.size() == 0);
+	
+	msg("Checking bulk load");
+	report(
+		check_bulk_load<2, 3>(1.0) &&
+		check_bulk_load<3, 5>(0.5) &&
+		check_bulk_load<16, 31>(1.0) &&
+		check_bulk_load<16, 31>(0.7)
+	);
+	
+	msg("Checking bulk load from unsorted items");
+	std::vector<std::pair<int, std::string> > unsorted;
+	for (int key: key_data) {
+		unsorted.push_back(std::make_pair(key, std::string("foo")));
+	}
+	unsorted.push_back(std::make_pair(key_data[0], std::string("bar")));
+	abtree<int, std::string> loaded_tree(unsorted.begin(), unsorted.end(), 2, 3);
+	keys.assign(key_data, key_data + sizeof(key_data) / sizeof(int));
+	std::sort(begin(keys), end(keys));
+	report(
+		loaded_tree.size() == keys.size() &&
+		check_order(loaded_tree.begin(), keys) &&
+		loaded_tree.find(key_data[0])->second == "bar"
+	);
+	
+	msg("Checking batched lookups");
+	report(
+		check_batch(abtree<int, int>(2, 3)) &&
+		check_batch(abtree<int, int, 3, 6>()) &&
+		check_batch(abtree<int, int>(8, 20))
+	);
+	
+	msg("Checking parallel bulk load and range walks");
+	report(
+		check_parallel(abtree<int, int>(2, 3), abtree<int, int>(2, 3), 1.0) &&
+		check_parallel(abtree<int, int, 3, 6>(), abtree<int, int, 3, 6>(), 0.5) &&
+		check_parallel(abtree<int, int>(8, 20), abtree<int, int>(8, 20), 1.0)
+	);
+	
+	msg("Checking sorted batch insert and erase");
+	abtree<int, int> batch_tree(3, 5);
+	std::vector<std::pair<int, int> > batch;
+	std::vector<int> batch_keys;
+	for (int i = 0; i < 1000; i += 2) {
+		batch.push_back(std::make_pair(i, i));
+	}
+	batch_tree.insert_sorted(batch.begin(), batch.end());
+	batch.clear();
+	for (int i = 0; i < 1000; i += 3) {
+		batch.push_back(std::make_pair(i, -i));
+	}
+	batch_tree.insert_sorted(batch.begin(), batch.end());
+	for (int i = 0; i < 1000; i += 4) {
+		batch_keys.push_back(i);
+	}
+	batch_tree.erase_sorted(batch_keys.begin(), batch_keys.end());
+	status = true;
+	keys.clear();
+	for (int i = 0; i < 1000; i++) {
+		if ((i % 2 == 0 || i % 3 == 0) && i % 4 != 0) {
+			keys.push_back(i);
+			status = status && batch_tree.find(i)->second == (i % 3 == 0 ? -i : i);
+		}
+	}
+	report(status && batch_tree.size() == keys.size() && check_order(batch_tree.begin(), keys));
+	
+	msg("Checking random sorted batches");
+	typedef abtree_aligned_allocator<std::pair<const int, int> > int_allocator;
+	report(
+		check_sorted_batches(abtree<int, int, 0, 0, int_allocator, abtree_sum<int> >(2, 3)) &&
+		check_sorted_batches(abtree<int, int, 3, 6, int_allocator, abtree_sum<int> >()) &&
+		check_sorted_batches(abtree<int, int, 0, 0, int_allocator, abtree_sum<int> >(8, 20))
+	);
+	
+	msg("Checking hinted insert and search from an iterator");
+	abtree<int, int> hint_tree(2, 3);
+	auto hint = hint_tree.end();
+	keys.clear();
+	for (int i = 0; i < 500; i++) {
+		hint = hint_tree.insert(hint, std::make_pair(2 * i, i));
+		keys.push_back(2 * i);
+	}
+	hint = hint_tree.emplace_hint(hint_tree.begin(), 1001, 0);
+	keys.push_back(1001);
+	status = hint->first == 1001 && check_order(hint_tree.begin(), keys);
+	hint = hint_tree.begin();
+	for (int i = 0; i < 999; i++) {
+		auto found = hint_tree.find(hint, i);
+		status = status && (i % 2 == 0 ? found->first == i : found == hint_tree.end());
+		hint = hint_tree.lower_bound(hint, i);
+		status = status && hint->first == i + i % 2;
+	}
+	report(status && hint_tree.lower_bound(hint, 1002) == hint_tree.end());
+	
+	msg("Checking the B+ tree variant");
+	std::vector<int> even_keys;
+	for (int key: key_data) {
+		even_keys.push_back(2 * key);
+	}
+	for (int i = 0; i < 2000; i++) {
+		even_keys.push_back(2 * ((i * 7919) % 2000 + 100));
+	}
+	report(
+		check_tree(abtree_bplus<int, int>(2, 3), even_keys) &&
+		check_tree(abtree_bplus<int, int, 3, 5>(), even_keys) &&
+		check_tree(abtree_bplus<int, int>(16, 40), even_keys)
+	);
+	
+	msg("Checking order statistics");
+	report(
+		check_order_statistics(abtree<int, int>(2, 3), even_keys) &&
+		check_order_statistics(abtree<int, int, 3, 6>(), even_keys) &&
+		check_order_statistics(abtree<int, int>(8, 20), even_keys)
+	);
+	
+	msg("Checking aggregates");
+	report(
+		check_aggregates<abtree_sum<int> >(abtree<int, int, 0, 0, int_allocator, abtree_sum<int> >(2, 3), even_keys) &&
+		check_aggregates<abtree_sum<int> >(abtree<int, int, 3, 6, int_allocator, abtree_sum<int> >(), even_keys) &&
+		check_aggregates<abtree_max<int> >(abtree<int, int, 0, 0, int_allocator, abtree_max<int> >(8, 20), even_keys) &&
+		check_aggregates<abtree_min<int> >(abtree<int, int, 0, 0, int_allocator, abtree_min<int> >(4, 9), even_keys)
+	);
+	
+	msg("Checking range erase, split and join");
+	report(
+		check_split_join(abtree<int, int>(2, 3), even_keys) &&
+		check_split_join(abtree<int, int, 3, 6>(), even_keys) &&
+		check_split_join(abtree<int, int>(8, 20), even_keys)
+	);
+	
+	msg("Checking set operations");
+	report(
+		check_set_operations(abtree<int, int>(2, 3), abtree<int, int>(2, 3), abtree<int, int>(2, 3), even_keys) &&
+		check_set_operations(abtree<int, int, 3, 6>(), abtree<int, int, 3, 6>(), abtree<int, int, 3, 6>(), even_keys) &&
+		check_set_operations(abtree<int, int>(8, 20), abtree<int, int>(8, 20), abtree<int, int>(8, 20), even_keys)
+	);
+	
+	msg("Checking the memory-mapped format");
+	report(
+		check_mapped(abtree<int, int>(2, 3), std::vector<int>(), 4096) &&
+		check_mapped(abtree<int, int>(2, 3), std::vector<int>(1, 42), 4096) &&
+		check_mapped(abtree<int, int>(8, 20), even_keys, 128) &&
+		check_mapped(abtree<int, int>(8, 20), even_keys, 4096)
+	);
+	
+	msg("Checking the write-ahead log and checkpoints");
+	report(
+		check_durable(2, 3, even_keys) &&
+		check_durable(8, 20, even_keys)
+	);
+	
+	msg("Checking the buffered variant");
+	abtree_buffered_options small_buffers;
+	small_buffers.buffer_size = 3;
+	small_buffers.leaf_size = 4;
+	report(
+		check_buffered(abtree_buffered<int, int>(2, 3, small_buffers), even_keys) &&
+		check_buffered(abtree_buffered<int, int, 3, 6>(small_buffers), even_keys) &&
+		check_buffered(abtree_buffered<int, int>(4, 8), even_keys)
+	);
+	
+	msg("Checking the persistent variant");
+	report(
+		check_tree(abtree_persistent<int, int>(2, 4), even_keys) &&
+		check_tree(abtree_persistent<int, int, 3, 6>(), even_keys) &&
+		check_snapshots(abtree_persistent<int, int>(2, 4), even_keys) &&
+		check_snapshots(abtree_persistent<int, int>(8, 20), even_keys) &&
+		check_snapshot_copies(abtree_persistent<int, int, 0, 0, counting_allocator<std::pair<const int, int> > >(2, 4), even_keys)
+	);
+	
+	msg("Checking the concurrent variant");
+	report(
+		check_concurrent(abtree_concurrent<int, int>(2, 4), 3, 1) &&
+		check_concurrent(abtree_concurrent<int, int, 3, 6>(), 2, 2) &&
+		check_concurrent(abtree_concurrent<int, int>(16, 32), 4, 2)
+	);
+	
+	msg("Checking the concurrent variant with overlapping writers");
+	report(
+		check_concurrent_overlapping(abtree_concurrent<int, int>(2, 4), 3, 2) &&
+		check_concurrent_overlapping(abtree_concurrent<int, int, 3, 6>(), 4, 1) &&
+		check_concurrent_overlapping(abtree_concurrent<int, int>(16, 32), 4, 3)
+	);
+	
 	return 0;
 }
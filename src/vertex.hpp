@@ -2,25 +2,295 @@
 #define _ABTREE_VERTEX_HPP_
 
 #include <iostream>
+#include <new>
+#include <utility>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+#include "search.hpp"
+#include "aggregate.hpp"
 
-template <typename TKey, typename TVal>
+template <typename TKey, typename TVal, size_t A, size_t B, typename Allocator, typename Aggregate>
 class abtree;
 
 /**
- * A vertex of an (a, b)-tree
+ * The unit in which vertices are allocated. Its alignment makes every vertex start on a cache line.
  */
-template <typename TKey, typename TVal>
-struct abtree_vertex
+struct alignas(64) abtree_cache_line
 {
+	char bytes[64];
+};
+
+/**
+ * Ask the CPU to start loading a range of memory into the cache, one cache line at a time,
+ * so that the loads overlap instead of waiting for each other. It's only a hint, it never faults.
+ * Prefetching can be turned off by defining ABTREE_NO_PREFETCH.
+ * @param address the start of the range
+ * @param bytes the length of the range
+ */
+inline void abtree_prefetch (const void * address, size_t bytes)
+{
+#if defined(__GNUC__) && !defined(ABTREE_NO_PREFETCH)
+	const char * line = static_cast<const char *>(address);
+	for (size_t offset = 0; offset < bytes; offset += sizeof(abtree_cache_line)) {
+		__builtin_prefetch(line + offset);
+	}
+#endif
+}
+
+/**
+ * The layout of the memory block of a vertex, shared by all kinds of vertices.
+ * The vertex itself is the header of the block. It's followed by the keys and then by either the values
+ * (in a leaf) or the children (in an inner vertex), each array aligned for its elements.
+ * A vertex derives from its layout and provides a block_size() whose arguments are the ones of its
+ * constructor after the block (with the leaf flag last), e.g. block_size(max_children, leaf)
+ * and Vertex(block, max_children, leaf).
+ * @tparam Vertex The vertex at the start of the block
+ * @tparam TKey The type of the elements of the keys array
+ * @tparam TVal The type of the elements of the values array
+ * @tparam TChild The type of the elements of the children array
+ */
+template <typename Vertex, typename TKey, typename TVal, typename TChild = Vertex *>
+struct abtree_block_layout
+{
+	/**
+	 * The alignment of the memory block of a vertex
+	 */
+	static const size_t cache_line_size = sizeof(abtree_cache_line);
+	
+	/**
+	 * Round given offset up to a multiple of given alignment
+	 */
+	static size_t align (size_t offset, size_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+	
+	/**
+	 * @name Offsets of the arrays in the memory block of a vertex with room for given number of keys
+	 */
+	//@{
+	static size_t keys_offset ()
+	{
+		return align(sizeof(Vertex), alignof(TKey));
+	}
+	
+	static size_t values_offset (size_t max_keys)
+	{
+		return align(keys_offset() + max_keys * sizeof(TKey), alignof(TVal));
+	}
+	
+	static size_t children_offset (size_t max_keys)
+	{
+		return align(keys_offset() + max_keys * sizeof(TKey), alignof(TChild));
+	}
+	//@}
+	
+	/**
+	 * @name Ends of the values of a leaf and of the children of an inner vertex
+	 */
+	//@{
+	static size_t values_end (size_t max_keys)
+	{
+		return values_offset(max_keys) + max_keys * sizeof(TVal);
+	}
+	
+	static size_t children_end (size_t max_keys, size_t max_children)
+	{
+		return children_offset(max_keys) + max_children * sizeof(TChild);
+	}
+	//@}
+	
+	/**
+	 * Allocate a memory block and construct a vertex in it
+	 * @param alloc an allocator of abtree_cache_line objects
+	 * @param args the arguments of the constructor of the vertex (after the block)
+	 * @return the new vertex
+	 * @throws std::bad_alloc if the memory can't be allocated
+	 */
+	template <typename TAlloc, typename... Args>
+	static Vertex * create (TAlloc & alloc, Args... args)
+	{
+		size_t lines = Vertex::block_size(args...) / cache_line_size;
+		char * block = reinterpret_cast<char *>(&*std::allocator_traits<TAlloc>::allocate(alloc, lines));
+		return new (block) Vertex(block, args...);
+	}
+	
+	/**
+	 * Destroy a vertex created by create() and release its memory block
+	 * @param alloc the allocator the vertex was created with
+	 * @param v the vertex to be destroyed
+	 * @param sizes the arguments the vertex was created with, except for the leaf flag
+	 */
+	template <typename TAlloc, typename... Sizes>
+	static void destroy (TAlloc & alloc, Vertex * v, Sizes... sizes)
+	{
+		size_t lines = Vertex::block_size(sizes..., v->leaf) / cache_line_size;
+		v->~Vertex();
+		std::allocator_traits<TAlloc>::deallocate(alloc, reinterpret_cast<abtree_cache_line *>(v), lines);
+	}
+	
+	/**
+	 * Move the item at position from to position to of the target vertex (which might be this vertex).
+	 * The target position must be unoccupied, the source position is left unoccupied.
+	 * The item count of neither vertex is changed.
+	 * @param from the position of the item to be moved
+	 * @param target the vertex that receives the item
+	 * @param to the position in the target vertex
+	 */
+	void move_item (size_t from, Vertex * target, size_t to)
+	{
+		Vertex * self = static_cast<Vertex *>(this);
+		target->construct_item(to, std::move(self->keys[from]), std::move(self->values[from]));
+		self->keys[from].~TKey();
+		self->values[from].~TVal();
+	}
+	
+	/**
+	 * Construct an item at an unoccupied position. The item count is not changed.
+	 * If the value can't be constructed, the key is destroyed again and the position is left unoccupied.
+	 * @param to the position of the new item
+	 * @param key the key of the new item
+	 * @param args the arguments passed to the constructor of the value
+	 */
+	template <typename K, typename... Args>
+	void construct_item (size_t to, K && key, Args &&... args)
+	{
+		Vertex * self = static_cast<Vertex *>(this);
+		new (&self->keys[to]) TKey(std::forward<K>(key));
+		try {
+			new (&self->values[to]) TVal(std::forward<Args>(args)...);
+		} catch (...) {
+			self->keys[to].~TKey();
+			throw;
+		}
+	}
+	
+	/**
+	 * Move the key at position from to position to of the target vertex (which might be this vertex).
+	 * Used for the separators in inner vertices of the B+ variants. The item counts aren't changed.
+	 */
+	void move_key (size_t from, Vertex * target, size_t to)
+	{
+		Vertex * self = static_cast<Vertex *>(this);
+		new (&target->keys[to]) TKey(std::move(self->keys[from]));
+		self->keys[from].~TKey();
+	}
+};
+
+/**
+ * Uninitialized storage for N objects of type T embedded directly in a vertex.
+ * The objects are constructed and destroyed by the vertex as items come and go.
+ */
+template <typename T, size_t N>
+struct abtree_inline_array
+{
+	std::array<typename std::aligned_storage<sizeof(T), alignof(T)>::type, N> slots;
+	
+	T & operator[] (size_t i)
+	{
+		return *reinterpret_cast<T *>(&slots[i]);
+	}
+	
+	const T & operator[] (size_t i) const
+	{
+		return *reinterpret_cast<const T *>(&slots[i]);
+	}
+};
+
+/**
+ * Selects the types of the key, value and children arrays of a vertex.
+ * If the maximum number of children B is known at compile time, the keys and the values are embedded
+ * in the vertex. The children are placed right behind it, so that a leaf, which has none,
+ * can be allocated without them and still hold a complete vertex.
+ */
+template <typename TKey, typename TVal, typename TVertex, size_t B>
+struct abtree_vertex_arrays
+{
+	typedef abtree_inline_array<TKey, B> keys_type;
+	typedef abtree_inline_array<TVal, B> values_type;
+	typedef TVertex ** children_type;
+};
+
+/**
+ * If the maximum number of children is only known at runtime (B == 0), the arrays are placed
+ * behind the vertex in the same memory block and the vertex points to them.
+ */
+template <typename TKey, typename TVal, typename TVertex>
+struct abtree_vertex_arrays<TKey, TVal, TVertex, 0>
+{
+	typedef TKey * keys_type;
+	typedef TVal * values_type;
+	typedef TVertex ** children_type;
+};
+
+/**
+ * A vertex of an (a, b)-tree.
+ * The items are stored inline, with the keys and the values in two separate arrays,
+ * so a search inside the vertex only touches the memory occupied by keys.
+ * The header, the keys, the values and the children of a vertex all live in a single
+ * cache-line-aligned block of memory. Leaves don't have any children, so their block
+ * ends right after the values (or the vertex itself, if B is known at compile time).
+ * @tparam B The maximum number of children if it's known at compile time, 0 otherwise
+ * @tparam Aggregate The aggregate cached for the subtree of the vertex (see aggregate.hpp)
+ */
+template <typename TKey, typename TVal, size_t B = 0, typename Aggregate = abtree_no_aggregate>
+struct abtree_vertex: private abtree_block_layout<abtree_vertex<TKey, TVal, B, Aggregate>, TKey, TVal>
+{
+	typedef TKey key_type;
+	typedef TVal mapped_type;
+	typedef abtree_vertex_arrays<TKey, TVal, abtree_vertex, B> arrays;
+	
 	abtree_vertex * parent;
+	size_t index; // The position of the vertex among the children of its parent
 	size_t item_count;
-	std::pair<const TKey, TVal> ** items;
-	abtree_vertex ** children;
+	size_t subtree_size; // The number of items in the subtree of the vertex
+	bool leaf;
+	typename Aggregate::value_type aggregate; // The aggregate of the items in the subtree of the vertex
+	typename arrays::keys_type keys;
+	typename arrays::values_type values;
+	typename arrays::children_type children; // nullptr in leaves
 	
+	/**
+	 * The destructor. Destroys the items that are still stored in the vertex.
+	 */
 	~abtree_vertex ()
 	{
-		delete[] items;
-		delete[] children;
+		for (size_t i = 0; i < item_count; i++) {
+			destroy_item(i);
+		}
+	}
+	
+	/**
+	 * The most cache lines prefetch() loads at once. A search only reads a few lines of the keys
+	 * of a wide vertex, loading all of them would just occupy the memory bus.
+	 */
+	static const size_t prefetch_lines = 16;
+	
+	/**
+	 * Start loading the header and the keys of the vertex into the cache. A search calls this right
+	 * before it searches the vertex, so there's hardly any other work to hide the first miss behind,
+	 * but the misses on the lines of the keys overlap with each other instead of coming one after another
+	 * as the binary search jumps through the keys.
+	 * @param max_children the maximum amount of children the vertex was created with
+	 */
+	void prefetch (size_t max_children) const
+	{
+		abtree_prefetch(this, std::min(keys_end(max_children), prefetch_lines * cache_line_size));
+	}
+	
+	/**
+	 * Start loading the items of a leaf next to the current one, which an iterator is going to visit
+	 * after the current one. The leaves of a tree have the same layout and mostly similar sizes,
+	 * so the items of the current leaf tell how much of the other one to load.
+	 * @param sibling the other leaf
+	 */
+	void prefetch_sibling (const abtree_vertex * sibling) const
+	{
+		const char * used_end = reinterpret_cast<const char *>(&values[0] + item_count);
+		abtree_prefetch(sibling, used_end - reinterpret_cast<const char *>(this));
 	}
 	
 	/**
@@ -31,44 +301,151 @@ struct abtree_vertex
 	 */
 	size_t search (const TKey & key) const
 	{
-		size_t i, step;
-		size_t first = 0;
-		size_t count = item_count;
-		
-		while (count > 0) {
-			i = first + (step = count / 2);
-			if (items[i]->first < key) {
-				first = i + 1;
-				count -= step + 1;
-			} else {
-				count = step;
-			}
-		}
-		
-		return first;
+		return abtree_search<B>(&keys[0], item_count, key);
 	}
 	
 private:
-	friend class abtree<TKey, TVal>;
+	template <typename, typename, size_t, size_t, typename, typename>
+	friend class abtree;
+	
+	typedef abtree_block_layout<abtree_vertex, TKey, TVal> layout;
+	friend layout;
+	using layout::cache_line_size;
+	using layout::align;
+	using layout::keys_offset;
+	using layout::values_offset;
+	
+	/**
+	 * @name Offsets of the end of the keys and of the children in the memory block of a vertex
+	 * (only the children are placed in the block if B is known at compile time, see abtree_block_layout
+	 * for the other arrays)
+	 */
+	//@{
+	static size_t keys_end (size_t max_children)
+	{
+		return B != 0 ? offsetof(abtree_vertex, keys) + B * sizeof(TKey) : keys_offset() + max_children * sizeof(TKey);
+	}
+	
+	static size_t children_offset (size_t max_children)
+	{
+		size_t end = B != 0 ? sizeof(abtree_vertex) : layout::values_end(max_children);
+		return align(end, alignof(abtree_vertex *));
+	}
+	//@}
 	
 	/**
-	 * The default constructor. Allocates memory for given amount of items and children.
-	 * One more place in memory is allocated to simplify splitting.
-	 * Only the abtree container is able to conctruct a vertex.
+	 * Compute the size of the memory block of a vertex
 	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf (and doesn't need space for children)
 	 */
-	abtree_vertex (size_t max_children): parent(nullptr), item_count(0)
+	static size_t block_size (size_t max_children, bool leaf)
 	{
-		items = new std::pair<const TKey, TVal> * [max_children];
-		children = new abtree_vertex<TKey, TVal> * [max_children + 1];
+		size_t size;
+		if (leaf) {
+			size = B != 0 ? sizeof(abtree_vertex) : layout::values_end(max_children);
+		} else {
+			size = children_offset(max_children) + (max_children + 1) * sizeof(abtree_vertex *);
+		}
+		return align(size, cache_line_size);
+	}
+	
+	/**
+	 * Set up the arrays inside the memory block.
+	 * The children of an inner vertex are initialized to nullptr.
+	 * @param block the memory block the vertex is placed in
+	 * @param max_children specifies the maximum amount of children
+	 * @param leaf whether the vertex is a leaf
+	 */
+	abtree_vertex (char * block, size_t max_children, bool leaf)
+		: parent(nullptr), index(0), item_count(0), subtree_size(0), leaf(leaf), aggregate(Aggregate::identity())
+	{
+		init_arrays(block, max_children, std::integral_constant<bool, B == 0>());
 		
-		for (size_t i = 0; i < max_children; i++) {
-			items[i] = nullptr;
+		if (!leaf) {
+			for (size_t i = 0; i <= max_children; i++) {
+				children[i] = nullptr;
+			}
+		}
+	}
+	
+	/**
+	 * Point the arrays to their place in the memory block (if B is only known at runtime)
+	 */
+	void init_arrays (char * block, size_t max_children, std::true_type)
+	{
+		keys = reinterpret_cast<TKey *>(block + keys_offset());
+		values = reinterpret_cast<TVal *>(block + values_offset(max_children));
+		children = leaf ? nullptr : reinterpret_cast<abtree_vertex **>(block + children_offset(max_children));
+	}
+	
+	/**
+	 * The keys and the values are embedded in the vertex (if B is known at compile time),
+	 * only the children are placed behind it
+	 */
+	void init_arrays (char * block, size_t max_children, std::false_type)
+	{
+		children = leaf ? nullptr : reinterpret_cast<abtree_vertex **>(block + children_offset(max_children));
+	}
+	
+	/**
+	 * Place a child at given position of an inner vertex and let the child know where it is
+	 * @param i the position of the child
+	 * @param child the child
+	 */
+	void set_child (size_t i, abtree_vertex * child)
+	{
+		children[i] = child;
+		child->parent = this;
+		child->index = i;
+	}
+	
+	/**
+	 * Recompute the size and the aggregate of the subtree of the vertex from its items and its children
+	 * (after items or children have been moved between vertices)
+	 */
+	void update_subtree ()
+	{
+		subtree_size = item_count;
+		if (!leaf) {
+			for (size_t i = 0; i <= item_count; i++) {
+				subtree_size += children[i]->subtree_size;
+			}
 		}
-		for (size_t i = 0; i <= max_children; i++) {
-			children[i] = nullptr;
+		update_aggregate();
+	}
+	
+	/**
+	 * Recompute the aggregate of the subtree of the vertex (if there's any aggregate to compute)
+	 */
+	void update_aggregate ()
+	{
+		update_aggregate(std::integral_constant<bool, !std::is_same<Aggregate, abtree_no_aggregate>::value>());
+	}
+	
+	void update_aggregate (std::true_type)
+	{
+		typename Aggregate::value_type result = leaf ? Aggregate::identity() : children[0]->aggregate;
+		for (size_t i = 0; i < item_count; i++) {
+			result = Aggregate::combine(result, Aggregate::from_item(keys[i], values[i]));
+			if (!leaf) {
+				result = Aggregate::combine(result, children[i + 1]->aggregate);
+			}
 		}
+		aggregate = result;
+	}
+	
+	void update_aggregate (std::false_type)
+	{}
+	
+	/**
+	 * Destroy the item at given position, leaving the position unoccupied. The item count is not changed.
+	 * @param i the position of the item
+	 */
+	void destroy_item (size_t i)
+	{
+		keys[i].~TKey();
+		values[i].~TVal();
 	}
 };
 
-#endif
\ No newline at end of file
+#endif